@@ -0,0 +1,206 @@
+#include <allocator.hh>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+
+namespace {
+vk::DeviceSize alignUp(vk::DeviceSize value, vk::DeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+} // namespace
+
+DeviceAllocation &
+DeviceAllocation::operator=(DeviceAllocation &&other) noexcept {
+  if (this != &other) {
+    release();
+    m_allocator = other.m_allocator;
+    m_block = other.m_block;
+    m_offset = other.m_offset;
+    m_size = other.m_size;
+    other.m_allocator = nullptr;
+    other.m_block = nullptr;
+  }
+  return *this;
+}
+
+void DeviceAllocation::release() {
+  if (m_allocator != nullptr) {
+    m_allocator->free(m_block, m_offset, m_size);
+  }
+  m_allocator = nullptr;
+  m_block = nullptr;
+}
+
+DeviceAllocator::DeviceAllocator(
+    const raii::Device &device,
+    const vk::PhysicalDeviceMemoryProperties &memoryProperties,
+    vk::DeviceSize blockSize)
+    : m_device(device), m_memoryProperties(memoryProperties),
+      m_blockSize(blockSize) {}
+
+uint32_t DeviceAllocator::findMemoryType(
+    uint32_t typeFilter, vk::MemoryPropertyFlags properties) const {
+  for (uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; i++) {
+    if ((typeFilter & (1 << i)) &&
+        (m_memoryProperties.memoryTypes[i].propertyFlags & properties) ==
+            properties) {
+      return i;
+    }
+  }
+  throw std::runtime_error("failed to find suitable memory type!");
+}
+
+MemoryBlock &DeviceAllocator::createBlock(uint32_t memoryTypeIndex,
+                                          vk::DeviceSize size, MemoryPool pool,
+                                          bool optimalImage, bool dedicated) {
+  vk::MemoryAllocateInfo allocInfo{};
+  allocInfo.allocationSize = size;
+  allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+  auto block = std::make_unique<MemoryBlock>();
+  block->memory = m_device.allocateMemory(allocInfo);
+  block->size = size;
+  block->memoryTypeIndex = memoryTypeIndex;
+  block->pool = pool;
+  block->optimalImage = optimalImage;
+  block->dedicated = dedicated;
+  block->freeRanges.emplace(0, size);
+
+  auto flags = m_memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags;
+  if (flags & vk::MemoryPropertyFlagBits::eHostVisible) {
+    block->mapped = static_cast<std::byte *>(block->memory.mapMemory(0, size));
+  }
+
+  spdlog::info("allocate device memory block type {} size {}", memoryTypeIndex,
+               size);
+  m_blocks.push_back(std::move(block));
+  return *m_blocks.back();
+}
+
+bool DeviceAllocator::allocateFromBlock(
+    MemoryBlock &block, const vk::MemoryRequirements &requirements,
+    vk::DeviceSize &offset) {
+
+  if (block.pool == MemoryPool::Linear) {
+    auto aligned = alignUp(block.head, requirements.alignment);
+    if (aligned + requirements.size > block.size) {
+      return false;
+    }
+    block.head = aligned + requirements.size;
+    offset = aligned;
+    return true;
+  }
+
+  // first fit
+  for (auto it = block.freeRanges.begin(); it != block.freeRanges.end(); ++it) {
+    auto [rangeOffset, rangeSize] = *it;
+    auto aligned = alignUp(rangeOffset, requirements.alignment);
+    if (aligned + requirements.size > rangeOffset + rangeSize) {
+      continue;
+    }
+
+    block.freeRanges.erase(it);
+    //对齐留下的前半部分和剩余的后半部分继续保持空闲
+    if (aligned > rangeOffset) {
+      block.freeRanges.emplace(rangeOffset, aligned - rangeOffset);
+    }
+    auto end = aligned + requirements.size;
+    if (end < rangeOffset + rangeSize) {
+      block.freeRanges.emplace(end, rangeOffset + rangeSize - end);
+    }
+    offset = aligned;
+    return true;
+  }
+  return false;
+}
+
+DeviceAllocation
+DeviceAllocator::allocate(const vk::MemoryRequirements &requirements,
+                          vk::MemoryPropertyFlags properties, bool optimalImage,
+                          MemoryPool pool) {
+  auto memoryTypeIndex =
+      findMemoryType(requirements.memoryTypeBits, properties);
+
+  MemoryBlock *target = nullptr;
+  vk::DeviceSize offset = 0;
+
+  for (auto &block : m_blocks) {
+    if (block->memoryTypeIndex == memoryTypeIndex && block->pool == pool &&
+        block->optimalImage == optimalImage && !block->dedicated &&
+        allocateFromBlock(*block, requirements, offset)) {
+      target = block.get();
+      break;
+    }
+  }
+
+  if (target == nullptr) {
+    //大于半个块的资源单独分配，避免浪费块空间
+    bool dedicated = requirements.size > m_blockSize / 2;
+    auto blockSize = dedicated ? requirements.size : m_blockSize;
+    target = &createBlock(memoryTypeIndex, blockSize, pool, optimalImage,
+                          dedicated);
+    if (!allocateFromBlock(*target, requirements, offset)) {
+      throw std::runtime_error("failed to sub-allocate device memory!");
+    }
+  }
+
+  target->usedBytes += requirements.size;
+  target->allocationCount++;
+
+  DeviceAllocation allocation;
+  allocation.m_allocator = this;
+  allocation.m_block = target;
+  allocation.m_offset = offset;
+  allocation.m_size = requirements.size;
+  return allocation;
+}
+
+void DeviceAllocator::free(MemoryBlock *block, vk::DeviceSize offset,
+                           vk::DeviceSize size) {
+  block->usedBytes -= size;
+  block->allocationCount--;
+
+  if (block->pool == MemoryPool::Linear) {
+    if (block->allocationCount == 0) {
+      block->head = 0;
+    }
+  } else {
+    //插入空闲区间并与前后相邻的区间合并
+    auto [it, inserted] = block->freeRanges.emplace(offset, size);
+    auto next = std::next(it);
+    if (next != block->freeRanges.end() && it->first + it->second == next->first) {
+      it->second += next->second;
+      block->freeRanges.erase(next);
+    }
+    if (it != block->freeRanges.begin()) {
+      auto prev = std::prev(it);
+      if (prev->first + prev->second == it->first) {
+        prev->second += it->second;
+        block->freeRanges.erase(it);
+      }
+    }
+  }
+
+  if (block->dedicated && block->allocationCount == 0) {
+    std::erase_if(m_blocks,
+                  [block](const auto &item) { return item.get() == block; });
+  }
+}
+
+MemoryStats DeviceAllocator::stats() const {
+  MemoryStats result;
+  for (const auto &block : m_blocks) {
+    result.allocatedBytes += block->size;
+    result.usedBytes += block->usedBytes;
+    result.allocationCount += block->allocationCount;
+  }
+  result.blockCount = static_cast<uint32_t>(m_blocks.size());
+  return result;
+}
+
+void DeviceAllocator::logStats() const {
+  auto result = stats();
+  spdlog::info("device memory: {} blocks, {} bytes allocated, {} bytes used by "
+               "{} allocations",
+               result.blockCount, result.allocatedBytes, result.usedBytes,
+               result.allocationCount);
+}
@@ -0,0 +1,617 @@
+#include <algorithm>
+#include <apu.hh>
+
+namespace {
+
+constexpr std::array<uint8_t, 32> LENGTH_TABLE = {
+    10, 254, 20, 2,  40, 4,  80, 6,  160, 8,  60, 10, 14, 12, 26, 14,
+    12, 16,  24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30};
+
+constexpr std::array<std::array<uint8_t, 8>, 4> DUTY_TABLE = {{
+    {0, 1, 0, 0, 0, 0, 0, 0},
+    {0, 1, 1, 0, 0, 0, 0, 0},
+    {0, 1, 1, 1, 1, 0, 0, 0},
+    {1, 0, 0, 1, 1, 1, 1, 1},
+}};
+
+constexpr std::array<uint8_t, 32> TRIANGLE_SEQUENCE = {
+    15, 14, 13, 12, 11, 10, 9,  8,  7,  6,  5,  4,  3,  2,  1,  0,
+    0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 12, 13, 14, 15};
+
+// NTSC，单位为 CPU cycle
+constexpr std::array<uint16_t, 16> NOISE_PERIODS = {
+    4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068};
+
+constexpr std::array<uint16_t, 16> DMC_RATES = {
+    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54};
+
+// frame counter 每一步相对于序列开始的 CPU cycle，最后一个为序列的长度
+constexpr std::array<uint32_t, 5> FOUR_STEP_SEQUENCE = {7457, 14913, 22371,
+                                                        29829, 29830};
+constexpr std::array<uint32_t, 6> FIVE_STEP_SEQUENCE = {
+    7457, 14913, 22371, 29829, 37281, 37282};
+
+//一帧最多的采样数，System 每帧结束一次，留出几帧的余量
+constexpr uint32_t MAX_FRAME_SAMPLES = AUDIO_SAMPLE_RATE / 10;
+
+//使用 Resampler 时每个 APU cycle(两个 CPU cycle)采样一次
+constexpr double APU_SAMPLE_RATE = NES_CPU_CLOCK_RATE / 2;
+
+//重采样之后去直流的时间常数，和 BlipBuffer 的高通相同
+constexpr float DC_FILTER_RATE = 1.0F / 512;
+
+} // namespace
+
+void ApuEnvelope::Write(uint8_t value) {
+  loop = value & 0x20;
+  constantVolume = value & 0x10;
+  period = value & 0x0F;
+}
+
+void ApuEnvelope::Clock() {
+  if (start) {
+    start = false;
+    decay = 15;
+    divider = period;
+    return;
+  }
+  if (divider > 0) {
+    divider--;
+    return;
+  }
+  divider = period;
+  if (decay > 0) {
+    decay--;
+  } else if (loop) {
+    decay = 15;
+  }
+}
+
+void PulseChannel::WriteControl(uint8_t value) {
+  m_duty = value >> 6;
+  m_lengthHalt = value & 0x20;
+  m_envelope.Write(value);
+}
+
+void PulseChannel::WriteSweep(uint8_t value) {
+  m_sweepEnabled = value & 0x80;
+  m_sweepPeriod = (value >> 4) & 0x07;
+  m_sweepNegate = value & 0x08;
+  m_sweepShift = value & 0x07;
+  m_sweepReload = true;
+}
+
+void PulseChannel::WriteTimerLow(uint8_t value) {
+  m_timer = (m_timer & 0x0700) | value;
+}
+
+void PulseChannel::WriteTimerHigh(uint8_t value, bool enabled) {
+  m_timer = (m_timer & 0x00FF) | ((value & 0x07) << 8);
+  if (enabled) {
+    length = LENGTH_TABLE[value >> 3];
+  }
+  m_sequence = 0;
+  m_envelope.start = true;
+}
+
+uint16_t PulseChannel::SweepTarget() const {
+  int change = m_timer >> m_sweepShift;
+  if (!m_sweepNegate) {
+    return m_timer + change;
+  }
+  auto target = m_timer - change - (m_onesComplement ? 1 : 0);
+  return static_cast<uint16_t>(std::max(target, 0));
+}
+
+bool PulseChannel::SweepMuted() const {
+  //即使 sweep 没有打开，目标周期溢出时也会静音
+  return m_timer < 8 || SweepTarget() > 0x7FF;
+}
+
+void PulseChannel::ClockHalfFrame() {
+  if (!m_lengthHalt && length > 0) {
+    length--;
+  }
+  if (m_sweepDivider == 0 && m_sweepEnabled && m_sweepShift > 0 &&
+      !SweepMuted()) {
+    m_timer = SweepTarget();
+  }
+  if (m_sweepDivider == 0 || m_sweepReload) {
+    m_sweepDivider = m_sweepPeriod;
+    m_sweepReload = false;
+  } else {
+    m_sweepDivider--;
+  }
+}
+
+void PulseChannel::Step() {
+  m_sequence = (m_sequence + 1) & 0x07;
+  m_nextStep += Period();
+}
+
+void PulseChannel::Resume(uint64_t now) {
+  if (m_nextStep <= now) {
+    m_nextStep = now + Period();
+  }
+}
+
+uint8_t PulseChannel::Output() const {
+  if (length == 0 || SweepMuted() || DUTY_TABLE[m_duty][m_sequence] == 0) {
+    return 0;
+  }
+  return m_envelope.Volume();
+}
+
+void TriangleChannel::WriteControl(uint8_t value) {
+  m_control = value & 0x80;
+  m_linearPeriod = value & 0x7F;
+}
+
+void TriangleChannel::WriteTimerLow(uint8_t value) {
+  m_timer = (m_timer & 0x0700) | value;
+}
+
+void TriangleChannel::WriteTimerHigh(uint8_t value, bool enabled) {
+  m_timer = (m_timer & 0x00FF) | ((value & 0x07) << 8);
+  if (enabled) {
+    length = LENGTH_TABLE[value >> 3];
+  }
+  m_linearReload = true;
+}
+
+void TriangleChannel::ClockQuarterFrame() {
+  if (m_linearReload) {
+    m_linearCounter = m_linearPeriod;
+  } else if (m_linearCounter > 0) {
+    m_linearCounter--;
+  }
+  if (!m_control) {
+    m_linearReload = false;
+  }
+}
+
+void TriangleChannel::ClockHalfFrame() {
+  if (!m_control && length > 0) {
+    length--;
+  }
+}
+
+void TriangleChannel::Resume(uint64_t now) {
+  if (m_nextStep <= now) {
+    m_nextStep = now + Period();
+  }
+}
+
+uint8_t TriangleChannel::Output() const {
+  //停止时保持在当前的位置，不回到 0，避免爆音
+  return TRIANGLE_SEQUENCE[m_sequence];
+}
+
+void NoiseChannel::WriteControl(uint8_t value) {
+  m_lengthHalt = value & 0x20;
+  m_envelope.Write(value);
+}
+
+void NoiseChannel::WritePeriod(uint8_t value) {
+  m_shortMode = value & 0x80;
+  m_period = NOISE_PERIODS[value & 0x0F];
+}
+
+void NoiseChannel::WriteLength(uint8_t value, bool enabled) {
+  if (enabled) {
+    length = LENGTH_TABLE[value >> 3];
+  }
+  m_envelope.start = true;
+}
+
+void NoiseChannel::ClockHalfFrame() {
+  if (!m_lengthHalt && length > 0) {
+    length--;
+  }
+}
+
+void NoiseChannel::Step() {
+  auto other = m_shortMode ? (m_shiftRegister >> 6) : (m_shiftRegister >> 1);
+  auto feedback = (m_shiftRegister ^ other) & 0x01;
+  m_shiftRegister = (m_shiftRegister >> 1) | (feedback << 14);
+  m_nextStep += m_period;
+}
+
+void NoiseChannel::Resume(uint64_t now) {
+  if (m_nextStep <= now) {
+    m_nextStep = now + m_period;
+  }
+}
+
+uint8_t NoiseChannel::Output() const {
+  if (length == 0 || (m_shiftRegister & 0x01) != 0) {
+    return 0;
+  }
+  return m_envelope.Volume();
+}
+
+void DmcChannel::WriteControl(uint8_t value) {
+  m_irqEnabled = value & 0x80;
+  if (!m_irqEnabled) {
+    irq = false;
+  }
+  m_loop = value & 0x40;
+  m_period = DMC_RATES[value & 0x0F];
+}
+
+void DmcChannel::SetEnabled(bool enabled) {
+  irq = false;
+  if (!enabled) {
+    m_bytesRemaining = 0;
+    return;
+  }
+  if (m_bytesRemaining == 0) {
+    m_address = m_sampleAddress;
+    m_bytesRemaining = m_sampleLength;
+    FillBuffer();
+  }
+}
+
+void DmcChannel::FillBuffer() {
+  if (m_bufferFull || m_bytesRemaining == 0) {
+    return;
+  }
+  m_buffer = readMemory ? readMemory(m_address) : 0;
+  m_bufferFull = true;
+  m_address = m_address == 0xFFFF ? 0x8000 : m_address + 1;
+  m_bytesRemaining--;
+  if (m_bytesRemaining > 0) {
+    return;
+  }
+  if (m_loop) {
+    m_address = m_sampleAddress;
+    m_bytesRemaining = m_sampleLength;
+  } else if (m_irqEnabled) {
+    irq = true;
+  }
+}
+
+void DmcChannel::Step() {
+  if (!m_silence) {
+    if ((m_shiftRegister & 0x01) != 0) {
+      if (m_level <= 125) {
+        m_level += 2;
+      }
+    } else if (m_level >= 2) {
+      m_level -= 2;
+    }
+    m_shiftRegister >>= 1;
+  }
+
+  m_bitsRemaining--;
+  if (m_bitsRemaining == 0) {
+    m_bitsRemaining = 8;
+    m_silence = !m_bufferFull;
+    if (m_bufferFull) {
+      m_shiftRegister = m_buffer;
+      m_bufferFull = false;
+      FillBuffer();
+    }
+  }
+  m_nextStep += m_period;
+}
+
+void DmcChannel::Resume(uint64_t now) {
+  if (m_nextStep <= now) {
+    m_nextStep = now + m_period;
+  }
+}
+
+APU::APU() : m_blip(NES_CPU_CLOCK_RATE, AUDIO_SAMPLE_RATE, MAX_FRAME_SAMPLES) {
+  ResetFrameCounter();
+  ResumeChannels();
+}
+
+void APU::WriteRegister(uint16_t address, uint8_t value, uint32_t cycle) {
+  RunUntil(cycle);
+  switch (address) {
+  case 0x4000:
+    m_pulse1.WriteControl(value);
+    break;
+  case 0x4001:
+    m_pulse1.WriteSweep(value);
+    break;
+  case 0x4002:
+    m_pulse1.WriteTimerLow(value);
+    break;
+  case 0x4003:
+    m_pulse1.WriteTimerHigh(value, m_enabled & 0x01);
+    break;
+  case 0x4004:
+    m_pulse2.WriteControl(value);
+    break;
+  case 0x4005:
+    m_pulse2.WriteSweep(value);
+    break;
+  case 0x4006:
+    m_pulse2.WriteTimerLow(value);
+    break;
+  case 0x4007:
+    m_pulse2.WriteTimerHigh(value, m_enabled & 0x02);
+    break;
+  case 0x4008:
+    m_triangle.WriteControl(value);
+    break;
+  case 0x400A:
+    m_triangle.WriteTimerLow(value);
+    break;
+  case 0x400B:
+    m_triangle.WriteTimerHigh(value, m_enabled & 0x04);
+    break;
+  case 0x400C:
+    m_noise.WriteControl(value);
+    break;
+  case 0x400E:
+    m_noise.WritePeriod(value);
+    break;
+  case 0x400F:
+    m_noise.WriteLength(value, m_enabled & 0x08);
+    break;
+  case 0x4010:
+    m_dmc.WriteControl(value);
+    break;
+  case 0x4011:
+    m_dmc.WriteLevel(value);
+    break;
+  case 0x4012:
+    m_dmc.WriteAddress(value);
+    break;
+  case 0x4013:
+    m_dmc.WriteLength(value);
+    break;
+  case 0x4015:
+    m_enabled = value & 0x1F;
+    if ((m_enabled & 0x01) == 0) {
+      m_pulse1.length = 0;
+    }
+    if ((m_enabled & 0x02) == 0) {
+      m_pulse2.length = 0;
+    }
+    if ((m_enabled & 0x04) == 0) {
+      m_triangle.length = 0;
+    }
+    if ((m_enabled & 0x08) == 0) {
+      m_noise.length = 0;
+    }
+    m_dmc.SetEnabled(m_enabled & 0x10);
+    break;
+  case 0x4017:
+    m_fiveStep = value & 0x80;
+    m_irqInhibit = value & 0x40;
+    if (m_irqInhibit) {
+      m_frameIrq = false;
+    }
+    ResetFrameCounter();
+    //5 步模式在写入时立即产生一次 quarter 和 half frame
+    if (m_fiveStep) {
+      ClockQuarterFrame();
+      ClockHalfFrame();
+    }
+    break;
+  default:
+    break;
+  }
+  ResumeChannels();
+  UpdateOutput();
+}
+
+uint8_t APU::ReadStatus(uint32_t cycle) {
+  RunUntil(cycle);
+  uint8_t status = 0;
+  status |= m_pulse1.length > 0 ? 0x01 : 0;
+  status |= m_pulse2.length > 0 ? 0x02 : 0;
+  status |= m_triangle.length > 0 ? 0x04 : 0;
+  status |= m_noise.length > 0 ? 0x08 : 0;
+  status |= m_dmc.Playing() ? 0x10 : 0;
+  status |= m_frameIrq ? 0x40 : 0;
+  status |= m_dmc.irq ? 0x80 : 0;
+  m_frameIrq = false;
+  return status;
+}
+
+void APU::RunUntil(uint32_t cycle) {
+  auto target = m_frameStart + cycle;
+  while (true) {
+    auto next = std::min({m_pulse1.NextStep(), m_pulse2.NextStep(),
+                          m_triangle.NextStep(), m_noise.NextStep(),
+                          m_dmc.NextStep(), m_frameCounterNext});
+    if (next > target) {
+      break;
+    }
+    m_time = next;
+    if (m_pulse1.NextStep() == next) {
+      m_pulse1.Step();
+    }
+    if (m_pulse2.NextStep() == next) {
+      m_pulse2.Step();
+    }
+    if (m_triangle.NextStep() == next) {
+      m_triangle.Step();
+    }
+    if (m_noise.NextStep() == next) {
+      m_noise.Step();
+    }
+    if (m_dmc.NextStep() == next) {
+      m_dmc.Step();
+    }
+    if (m_frameCounterNext == next) {
+      ClockFrameCounter();
+      ResumeChannels();
+    }
+    UpdateOutput();
+  }
+  m_time = std::max(m_time, target);
+}
+
+void APU::EndFrame(uint32_t cycles) {
+  RunUntil(cycles);
+  if (m_resampler) {
+    ResampleFrame(cycles);
+  } else {
+    m_blip.EndFrame(cycles);
+  }
+  m_frameStart += cycles;
+}
+
+void APU::SetSampleRateScale(double scale) {
+  m_sampleRateScale = scale;
+  m_blip.SetRates(NES_CPU_CLOCK_RATE, AUDIO_SAMPLE_RATE * scale);
+  if (m_resampler) {
+    m_resampler->SetRates(APU_SAMPLE_RATE, AUDIO_SAMPLE_RATE * scale);
+  }
+}
+
+void APU::SetResampler(std::optional<ResamplerQuality> quality) {
+  m_blip.Clear();
+  m_steps.clear();
+  m_samples.clear();
+  m_samplesRead = 0;
+  m_frameAmplitude = m_amplitude;
+  m_resampler.reset();
+  if (quality) {
+    m_resampler = std::make_unique<Resampler>(
+        APU_SAMPLE_RATE, AUDIO_SAMPLE_RATE * m_sampleRateScale, *quality);
+  }
+}
+
+uint32_t APU::SamplesAvailable() const {
+  if (m_resampler) {
+    return static_cast<uint32_t>(m_samples.size()) - m_samplesRead;
+  }
+  return m_blip.SamplesAvailable();
+}
+
+uint32_t APU::ReadSamples(int16_t *samples, uint32_t count) {
+  if (!m_resampler) {
+    return m_blip.ReadSamples(samples, count);
+  }
+  count = std::min(count, SamplesAvailable());
+  std::copy_n(m_samples.begin() + m_samplesRead, count, samples);
+  m_samplesRead += count;
+  return count;
+}
+
+void APU::ResampleFrame(uint32_t cycles) {
+  //第 i 个输入对应第 2i 个 CPU cycle 的振幅
+  auto first = (m_frameStart + 1) / 2;
+  auto end = (m_frameStart + cycles + 1) / 2;
+  m_resamplerInput.resize(end - first);
+  auto amplitude = m_frameAmplitude;
+  auto step = m_steps.begin();
+  for (auto i = first; i < end; i++) {
+    while (step != m_steps.end() && step->time <= i * 2) {
+      amplitude = step->amplitude;
+      ++step;
+    }
+    m_resamplerInput[i - first] = static_cast<float>(amplitude);
+  }
+  m_steps.clear();
+  m_frameAmplitude = m_amplitude;
+
+  auto inputCount = static_cast<uint32_t>(m_resamplerInput.size());
+  m_resamplerOutput.resize(m_resampler->MaxOutput(inputCount));
+  auto count = m_resampler->Process(m_resamplerInput.data(), inputCount,
+                                    m_resamplerOutput.data());
+
+  //没有读取的采样移到开头
+  m_samples.erase(m_samples.begin(), m_samples.begin() + m_samplesRead);
+  m_samplesRead = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    auto value = m_resamplerOutput[i];
+    m_dcLevel += (value - m_dcLevel) * DC_FILTER_RATE;
+    auto sample = std::clamp(value - m_dcLevel, -32768.0F, 32767.0F);
+    m_samples.push_back(static_cast<int16_t>(sample));
+  }
+}
+
+void APU::ResetFrameCounter() {
+  m_frameSequenceStart = m_time;
+  m_frameStep = 0;
+  m_frameCounterNext = m_time + FOUR_STEP_SEQUENCE[0];
+}
+
+void APU::ClockFrameCounter() {
+  auto step = m_frameStep;
+  if (m_fiveStep) {
+    // 5 步模式的第 4 步什么都不做，也不产生 IRQ
+    if (step != 3) {
+      ClockQuarterFrame();
+    }
+    if (step == 1 || step == 4) {
+      ClockHalfFrame();
+    }
+  } else {
+    ClockQuarterFrame();
+    if (step == 1 || step == 3) {
+      ClockHalfFrame();
+    }
+    if (step == 3 && !m_irqInhibit) {
+      m_frameIrq = true;
+    }
+  }
+
+  auto steps = m_fiveStep ? FIVE_STEP_SEQUENCE.size() - 1
+                          : FOUR_STEP_SEQUENCE.size() - 1;
+  const auto *sequence =
+      m_fiveStep ? FIVE_STEP_SEQUENCE.data() : FOUR_STEP_SEQUENCE.data();
+  m_frameStep++;
+  if (m_frameStep == steps) {
+    m_frameStep = 0;
+    m_frameSequenceStart += sequence[steps];
+  }
+  m_frameCounterNext = m_frameSequenceStart + sequence[m_frameStep];
+}
+
+void APU::ClockQuarterFrame() {
+  m_pulse1.ClockQuarterFrame();
+  m_pulse2.ClockQuarterFrame();
+  m_triangle.ClockQuarterFrame();
+  m_noise.ClockQuarterFrame();
+}
+
+void APU::ClockHalfFrame() {
+  m_pulse1.ClockHalfFrame();
+  m_pulse2.ClockHalfFrame();
+  m_triangle.ClockHalfFrame();
+  m_noise.ClockHalfFrame();
+}
+
+void APU::ResumeChannels() {
+  m_pulse1.Resume(m_time);
+  m_pulse2.Resume(m_time);
+  m_triangle.Resume(m_time);
+  m_noise.Resume(m_time);
+  m_dmc.Resume(m_time);
+}
+
+int32_t MixApuOutputsFormula(uint8_t pulse1, uint8_t pulse2, uint8_t triangle,
+                             uint8_t noise, uint8_t dmc) {
+  double pulse = pulse1 + pulse2;
+  double pulseOut = pulse == 0 ? 0 : 95.88 / (8128.0 / pulse + 100);
+  double tnd = triangle / 8227.0 + noise / 12241.0 + dmc / 22638.0;
+  double tndOut = tnd == 0 ? 0 : 159.79 / (1 / tnd + 100);
+  return static_cast<int32_t>((pulseOut + tndOut) * APU_MIX_SCALE);
+}
+
+int32_t APU::Mix() const {
+  return MixApuOutputs(m_pulse1.Output(), m_pulse2.Output(),
+                       m_triangle.Output(), m_noise.Output(), m_dmc.Output());
+}
+
+void APU::UpdateOutput() {
+  auto amplitude = Mix();
+  if (amplitude == m_amplitude) {
+    return;
+  }
+  if (m_resampler) {
+    m_steps.push_back({m_time, amplitude});
+  } else {
+    m_blip.AddDelta(m_time - m_frameStart, amplitude - m_amplitude);
+  }
+  m_amplitude = amplitude;
+}
@@ -0,0 +1,125 @@
+#include <QAudioDeviceInfo>
+#include <QAudioFormat>
+#include <algorithm>
+#include <apu.hh>
+#include <audio.hh>
+#include <cstring>
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+
+namespace {
+
+//输出设备的缓冲，约 40ms
+constexpr uint32_t OUTPUT_BUFFER_SAMPLES = AUDIO_SAMPLE_RATE / 25;
+
+//按小端写入
+template <typename T> void WriteLittleEndian(std::ofstream &file, T value) {
+  for (size_t i = 0; i < sizeof(T); i++) {
+    file.put(static_cast<char>((value >> (i * 8)) & 0xFF));
+  }
+}
+
+} // namespace
+
+WavWriter::WavWriter(const std::string &path, uint32_t sampleRate,
+                     uint16_t channels)
+    : m_file(path, std::ios::binary), m_sampleRate(sampleRate),
+      m_channels(channels) {
+  if (!m_file) {
+    throw std::runtime_error(fmt::format("failed to open {}", path));
+  }
+  WriteHeader();
+}
+
+void WavWriter::WriteHeader() {
+  uint16_t blockAlign = m_channels * sizeof(int16_t);
+  m_file.write("RIFF", 4);
+  WriteLittleEndian<uint32_t>(m_file, 36 + m_dataBytes);
+  m_file.write("WAVEfmt ", 8);
+  WriteLittleEndian<uint32_t>(m_file, 16);
+  // PCM
+  WriteLittleEndian<uint16_t>(m_file, 1);
+  WriteLittleEndian<uint16_t>(m_file, m_channels);
+  WriteLittleEndian<uint32_t>(m_file, m_sampleRate);
+  WriteLittleEndian<uint32_t>(m_file, m_sampleRate * blockAlign);
+  WriteLittleEndian<uint16_t>(m_file, blockAlign);
+  WriteLittleEndian<uint16_t>(m_file, 16);
+  m_file.write("data", 4);
+  WriteLittleEndian<uint32_t>(m_file, m_dataBytes);
+}
+
+void WavWriter::Write(const int16_t *samples, uint32_t count) {
+  if (!m_file.is_open()) {
+    return;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    WriteLittleEndian(m_file, static_cast<uint16_t>(samples[i]));
+  }
+  m_dataBytes += count * sizeof(int16_t);
+}
+
+void WavWriter::Close() {
+  if (!m_file.is_open()) {
+    return;
+  }
+  m_file.seekp(0);
+  WriteHeader();
+  m_file.close();
+}
+
+AudioOutput::AudioOutput(AudioRing &ring) : m_ring(ring) {}
+
+AudioOutput::~AudioOutput() { stop(); }
+
+void AudioOutput::start() {
+  QAudioFormat format;
+  format.setSampleRate(AUDIO_SAMPLE_RATE);
+  format.setChannelCount(1);
+  format.setSampleSize(16);
+  format.setCodec("audio/pcm");
+  format.setByteOrder(QAudioFormat::LittleEndian);
+  format.setSampleType(QAudioFormat::SignedInt);
+
+  auto device = QAudioDeviceInfo::defaultOutputDevice();
+  if (device.isNull() || !device.isFormatSupported(format)) {
+    spdlog::warn("audio output does not support {} Hz 16 bit mono",
+                 AUDIO_SAMPLE_RATE);
+    return;
+  }
+  spdlog::info("audio output {}", device.deviceName().toStdString());
+
+  m_output = std::make_unique<QAudioOutput>(device, format);
+  m_output->setBufferSize(OUTPUT_BUFFER_SAMPLES * sizeof(int16_t));
+  open(QIODevice::ReadOnly);
+  m_output->start(this);
+}
+
+void AudioOutput::stop() {
+  if (m_output) {
+    m_output->stop();
+    m_output.reset();
+  }
+  if (isOpen()) {
+    close();
+  }
+}
+
+qint64 AudioOutput::readData(char *data, qint64 maxSize) {
+  auto count = static_cast<uint32_t>(maxSize / sizeof(int16_t));
+  auto *samples = reinterpret_cast<int16_t *>(data);
+  auto read = m_ring.Read(samples, count);
+  if (read < count) {
+    //模拟跟不上或者暂停时补静音，保持设备一直在播放
+    std::memset(samples + read, 0, (count - read) * sizeof(int16_t));
+    m_underruns++;
+  }
+  return count * sizeof(int16_t);
+}
+
+qint64 AudioOutput::bytesAvailable() const {
+  //总是可以提供数据，不足的部分为静音
+  return std::max<qint64>(m_ring.Size() * sizeof(int16_t),
+                          OUTPUT_BUFFER_SAMPLES * sizeof(int16_t)) +
+         QIODevice::bytesAvailable();
+}
@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <array>
+#include <blip.hh>
+#include <cmath>
+#include <numbers>
+
+namespace {
+
+template <uint32_t PhaseCount, uint32_t Width>
+using KernelTable = std::array<std::array<int32_t, Width>, PhaseCount>;
+
+//带限冲激，每个相位的和为 2^DELTA_BITS，累加后得到高度为 1 的阶跃
+template <uint32_t PhaseCount, uint32_t Width>
+KernelTable<PhaseCount, Width> MakeKernels(uint32_t deltaBits) {
+  //截止频率为 Nyquist 的 0.9 倍，Blackman 窗
+  const double cutoff = 0.9;
+  const double half = Width / 2.0;
+  KernelTable<PhaseCount, Width> kernels{};
+  for (uint32_t phase = 0; phase < PhaseCount; phase++) {
+    std::array<double, Width> values{};
+    double sum = 0;
+    for (uint32_t i = 0; i < Width; i++) {
+      double x = i - (half - 1) - static_cast<double>(phase) / PhaseCount;
+      double sinc = x == 0 ? 1.0
+                           : std::sin(std::numbers::pi * cutoff * x) /
+                                 (std::numbers::pi * cutoff * x);
+      double window = 0.42 + 0.5 * std::cos(std::numbers::pi * x / half) +
+                      0.08 * std::cos(2 * std::numbers::pi * x / half);
+      values[i] = sinc * window;
+      sum += values[i];
+    }
+
+    //取整的误差加在最大的系数上，保证阶跃之后没有直流偏差
+    int32_t total = 0;
+    for (uint32_t i = 0; i < Width; i++) {
+      kernels[phase][i] =
+          static_cast<int32_t>(std::lround(values[i] / sum * (1 << deltaBits)));
+      total += kernels[phase][i];
+    }
+    auto peak = std::max_element(kernels[phase].begin(), kernels[phase].end());
+    *peak += (1 << deltaBits) - total;
+  }
+  return kernels;
+}
+
+} // namespace
+
+BlipBuffer::BlipBuffer(double clockRate, double sampleRate,
+                       uint32_t maxFrameSamples)
+    : m_buffer(maxFrameSamples + KERNEL_WIDTH) {
+  SetRates(clockRate, sampleRate);
+}
+
+void BlipBuffer::SetRates(double clockRate, double sampleRate) {
+  m_factor =
+      static_cast<uint64_t>(std::llround(sampleRate / clockRate * 4294967296.0));
+}
+
+void BlipBuffer::AddDelta(uint64_t clock, int32_t delta) {
+  static const auto kernels =
+      MakeKernels<PHASE_COUNT, KERNEL_WIDTH>(DELTA_BITS);
+
+  auto position = m_offset + clock * m_factor;
+  auto index = m_available + static_cast<uint32_t>(position >> 32);
+  auto phase = static_cast<uint32_t>(position >> (32 - PHASE_BITS)) &
+               (PHASE_COUNT - 1);
+  //超过一帧的容量时丢弃
+  if (index + KERNEL_WIDTH > m_buffer.size()) {
+    return;
+  }
+
+  const auto &kernel = kernels[phase];
+  auto *output = &m_buffer[index];
+  for (uint32_t i = 0; i < KERNEL_WIDTH; i++) {
+    output[i] += kernel[i] * delta;
+  }
+}
+
+void BlipBuffer::EndFrame(uint64_t clocks) {
+  m_offset += clocks * m_factor;
+  m_available = std::min(m_available + static_cast<uint32_t>(m_offset >> 32),
+                         static_cast<uint32_t>(m_buffer.size()) - KERNEL_WIDTH);
+  m_offset &= 0xFFFFFFFF;
+}
+
+uint32_t BlipBuffer::ReadSamples(int16_t *samples, uint32_t count) {
+  count = std::min(count, m_available);
+  for (uint32_t i = 0; i < count; i++) {
+    m_integrator += m_buffer[i];
+    auto sample = static_cast<int32_t>(std::clamp<int64_t>(
+        m_integrator >> DELTA_BITS, INT16_MIN, INT16_MAX));
+    samples[i] = static_cast<int16_t>(sample);
+    m_integrator -= static_cast<int64_t>(sample) << (DELTA_BITS - BASS_SHIFT);
+  }
+
+  //剩下的采样和还没有结束的阶跃移到开头
+  auto remaining = m_available - count + KERNEL_WIDTH;
+  std::copy_n(m_buffer.begin() + count, remaining, m_buffer.begin());
+  std::fill(m_buffer.begin() + remaining, m_buffer.end(), 0);
+  m_available -= count;
+  return count;
+}
+
+void BlipBuffer::Clear() {
+  std::fill(m_buffer.begin(), m_buffer.end(), 0);
+  m_offset = 0;
+  m_available = 0;
+  m_integrator = 0;
+}
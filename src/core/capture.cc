@@ -0,0 +1,232 @@
+#include <QImage>
+#include <algorithm>
+#include <capture.hh>
+#include <filesystem>
+#include <palette.hh>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+
+namespace {
+
+// NTSC NES 的帧率 60.0988
+constexpr const char *Y4M_FRAME_RATE = "39375000:655171";
+constexpr const char *FFMPEG_FRAME_RATE = "39375000/655171";
+
+constexpr uint32_t CHROMA_WIDTH = NES_FRAME_WIDTH / 2;
+constexpr uint32_t CHROMA_HEIGHT = NES_FRAME_HEIGHT / 2;
+
+//作为 shell 的一个参数，单引号内只有 ' 需要处理，写成 '\''
+std::string ShellQuote(const std::string &value) {
+  std::string quoted = "'";
+  for (auto c : value) {
+    if (c == '\'') {
+      quoted += "'\\''";
+    } else {
+      quoted += c;
+    }
+  }
+  quoted += '\'';
+  return quoted;
+}
+
+} // namespace
+
+FrameCapture::FrameCapture(const CaptureConfig &config)
+    : m_config(config), m_rgba(NES_FRAME_WIDTH * NES_FRAME_HEIGHT) {
+  switch (m_config.format) {
+  case CaptureFormat::Png:
+    std::filesystem::create_directories(m_config.path);
+    break;
+  case CaptureFormat::Y4m:
+    m_file.open(m_config.path, std::ios::binary);
+    if (!m_file) {
+      throw std::runtime_error(fmt::format("failed to open {}", m_config.path));
+    }
+    // JPEG 的 full range BT.601，和 C420jpeg 的色度位置一致
+    m_file << fmt::format("YUV4MPEG2 W{} H{} F{} Ip A1:1 C420jpeg "
+                          "XCOLORRANGE=FULL\n",
+                          NES_FRAME_WIDTH, NES_FRAME_HEIGHT, Y4M_FRAME_RATE);
+    m_yuv.resize(NES_FRAME_WIDTH * NES_FRAME_HEIGHT +
+                 CHROMA_WIDTH * CHROMA_HEIGHT * 2);
+    break;
+  case CaptureFormat::Ffmpeg: {
+    auto command = fmt::format(
+        "ffmpeg -loglevel error -y -f rawvideo -pix_fmt rgba -s {}x{} "
+        "-framerate {} -i - -pix_fmt yuv420p {}",
+        NES_FRAME_WIDTH, NES_FRAME_HEIGHT, FFMPEG_FRAME_RATE,
+        ShellQuote(m_config.path));
+    m_pipe = popen(command.c_str(), "w");
+    if (m_pipe == nullptr) {
+      throw std::runtime_error(fmt::format("failed to run {}", command));
+    }
+    break;
+  }
+  }
+
+  auto bufferCount = std::max(1U, m_config.bufferCount);
+  m_buffers.reserve(bufferCount);
+  m_freeBuffers.reserve(bufferCount);
+  for (uint32_t i = 0; i < bufferCount; i++) {
+    m_buffers.push_back(std::make_unique<Frame>());
+    m_freeBuffers.push_back(m_buffers.back().get());
+  }
+  m_pendingBuffers.resize(bufferCount);
+
+  m_thread = std::thread(&FrameCapture::EncoderLoop, this);
+}
+
+void FrameCapture::Submit(const Frame &frame) {
+  Frame *buffer = nullptr;
+  {
+    std::lock_guard lock(m_mutex);
+    if (!m_running) {
+      return;
+    }
+    if (m_freeBuffers.empty()) {
+      m_droppedFrames++;
+      return;
+    }
+    buffer = m_freeBuffers.back();
+    m_freeBuffers.pop_back();
+  }
+
+  //缓冲只属于模拟线程，复制时不需要持有锁
+  *buffer = frame;
+
+  {
+    std::lock_guard lock(m_mutex);
+    auto tail = (m_pendingHead + m_pendingCount) % m_pendingBuffers.size();
+    m_pendingBuffers[tail] = buffer;
+    m_pendingCount++;
+  }
+  m_condition.notify_one();
+}
+
+void FrameCapture::Stop() {
+  {
+    std::lock_guard lock(m_mutex);
+    m_running = false;
+  }
+  m_condition.notify_one();
+  if (!m_thread.joinable()) {
+    return;
+  }
+  m_thread.join();
+
+  if (m_file.is_open()) {
+    m_file.close();
+  }
+  if (m_pipe != nullptr) {
+    if (pclose(m_pipe) != 0) {
+      spdlog::error("ffmpeg exited with an error");
+    }
+    m_pipe = nullptr;
+  }
+  spdlog::info("capture {}: {} frames written, {} dropped", m_config.path,
+               m_capturedFrames.load(), m_droppedFrames.load());
+}
+
+void FrameCapture::EncoderLoop() {
+  while (true) {
+    Frame *buffer = nullptr;
+    {
+      std::unique_lock lock(m_mutex);
+      m_condition.wait(lock,
+                       [this] { return m_pendingCount > 0 || !m_running; });
+      //停止后把已经提交的帧写完再退出
+      if (m_pendingCount == 0) {
+        return;
+      }
+      buffer = m_pendingBuffers[m_pendingHead];
+      m_pendingHead = (m_pendingHead + 1) % m_pendingBuffers.size();
+      m_pendingCount--;
+    }
+
+    Encode(*buffer);
+
+    std::lock_guard lock(m_mutex);
+    m_freeBuffers.push_back(buffer);
+  }
+}
+
+void FrameCapture::Encode(const Frame &frame) {
+  if (m_failed) {
+    return;
+  }
+  ConvertFrame(frame, m_rgba.data());
+
+  switch (m_config.format) {
+  case CaptureFormat::Png:
+    WritePng(frame);
+    break;
+  case CaptureFormat::Y4m:
+    WriteY4m();
+    break;
+  case CaptureFormat::Ffmpeg:
+    if (std::fwrite(m_rgba.data(), sizeof(uint32_t), m_rgba.size(), m_pipe) !=
+        m_rgba.size()) {
+      m_failed = true;
+    }
+    break;
+  }
+
+  if (m_failed) {
+    spdlog::error("failed to write capture {}, stop capturing", m_config.path);
+    return;
+  }
+  m_capturedFrames++;
+}
+
+void FrameCapture::WritePng(const Frame &frame) {
+  QImage image(reinterpret_cast<const uchar *>(m_rgba.data()), NES_FRAME_WIDTH,
+               NES_FRAME_HEIGHT, NES_FRAME_WIDTH * sizeof(uint32_t),
+               QImage::Format_RGBA8888);
+  auto path = fmt::format("{}/{:06}.png", m_config.path, frame.number);
+  if (!image.save(QString::fromStdString(path), "PNG")) {
+    m_failed = true;
+  }
+}
+
+void FrameCapture::WriteY4m() {
+  auto *luma = m_yuv.data();
+  auto *cb = luma + NES_FRAME_WIDTH * NES_FRAME_HEIGHT;
+  auto *cr = cb + CHROMA_WIDTH * CHROMA_HEIGHT;
+
+  //系数为 BT.601 乘以 256
+  for (uint32_t i = 0; i < m_rgba.size(); i++) {
+    auto pixel = m_rgba[i];
+    int red = pixel & 0xFF;
+    int green = (pixel >> 8) & 0xFF;
+    int blue = (pixel >> 16) & 0xFF;
+    luma[i] =
+        static_cast<uint8_t>((77 * red + 150 * green + 29 * blue + 128) >> 8);
+  }
+
+  //色度取 2x2 像素的平均值
+  for (uint32_t y = 0; y < CHROMA_HEIGHT; y++) {
+    for (uint32_t x = 0; x < CHROMA_WIDTH; x++) {
+      int red = 0, green = 0, blue = 0;
+      for (uint32_t dy = 0; dy < 2; dy++) {
+        for (uint32_t dx = 0; dx < 2; dx++) {
+          auto pixel = m_rgba[(y * 2 + dy) * NES_FRAME_WIDTH + x * 2 + dx];
+          red += pixel & 0xFF;
+          green += (pixel >> 8) & 0xFF;
+          blue += (pixel >> 16) & 0xFF;
+        }
+      }
+      //四个像素的和，右移 10 位同时除以 4 和 256
+      auto index = y * CHROMA_WIDTH + x;
+      cb[index] = static_cast<uint8_t>(std::min(
+          255, (-43 * red - 85 * green + 128 * blue + (128 << 10) + 512) >> 10));
+      cr[index] = static_cast<uint8_t>(std::min(
+          255, (128 * red - 107 * green - 21 * blue + (128 << 10) + 512) >> 10));
+    }
+  }
+
+  m_file << "FRAME\n";
+  m_file.write(reinterpret_cast<const char *>(m_yuv.data()),
+               static_cast<std::streamsize>(m_yuv.size()));
+  if (!m_file) {
+    m_failed = true;
+  }
+}
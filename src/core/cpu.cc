@@ -831,3 +831,19 @@ void CPU::Run() {
     auto op = m_memory[0];
   }
 }
+
+int CPU::Step() {
+  auto operatorCode = m_memory[m_PC];
+  m_PC += 1;
+
+  auto it = m_instructionMap.find(operatorCode);
+  if (it == m_instructionMap.end()) {
+    //未实现的指令按照 NOP 处理
+    return 2;
+  }
+
+  auto &instruction = it->second;
+  auto value = GetAddressOrMemoryValue(instruction.m_addressMode);
+  instruction.m_executor(value);
+  return instruction.m_cycleCount;
+}
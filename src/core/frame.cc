@@ -0,0 +1,32 @@
+#include <crc32c.hh>
+#include <frame.hh>
+
+void Frame::UpdateHashes() {
+  for (uint32_t line = 0; line < NES_FRAME_HEIGHT; line++) {
+    lineHashes[line] = Crc32c(&pixels[line * NES_FRAME_WIDTH],
+                              NES_FRAME_WIDTH * sizeof(pixels[0]));
+  }
+  hash = Crc32c(lineHashes.data(), sizeof(lineHashes));
+}
+
+void DirtyLineRanges(const Frame &frame,
+                     const std::array<uint32_t, NES_FRAME_HEIGHT> *previous,
+                     std::vector<LineRange> &ranges) {
+  ranges.clear();
+  if (previous == nullptr) {
+    ranges.push_back(LineRange{.first = 0, .count = NES_FRAME_HEIGHT});
+    return;
+  }
+
+  for (uint32_t line = 0; line < NES_FRAME_HEIGHT; line++) {
+    if (frame.lineHashes[line] == (*previous)[line]) {
+      continue;
+    }
+    if (!ranges.empty() &&
+        ranges.back().first + ranges.back().count == line) {
+      ranges.back().count++;
+    } else {
+      ranges.push_back(LineRange{.first = line, .count = 1});
+    }
+  }
+}
@@ -0,0 +1,159 @@
+#include <cmath>
+#include <latency.hh>
+#include <spdlog/spdlog.h>
+
+PresentLatencyMonitor::PresentLatencyMonitor(const raii::Device &device)
+    : m_device(device) {}
+
+void PresentLatencyMonitor::start(vk::SwapchainKHR swapchain,
+                                  std::string presentMode) {
+  stop();
+  m_swapchain = swapchain;
+  m_presentMode = std::move(presentMode);
+  m_sampleCount = 0;
+  {
+    //presented 和 waitPresented 在其他线程中持有 m_mutex 读取
+    std::lock_guard lock(m_mutex);
+    m_running = true;
+  }
+  m_thread = std::thread(&PresentLatencyMonitor::run, this);
+}
+
+void PresentLatencyMonitor::stop() {
+  {
+    std::lock_guard lock(m_mutex);
+    m_running = false;
+    m_pending.clear();
+    m_lastPresentedId = 0;
+    m_refreshPeriod = {};
+    m_periodSamples = 0;
+  }
+  m_condition.notify_one();
+  m_presentedCondition.notify_all();
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+}
+
+void PresentLatencyMonitor::presented(
+    uint64_t presentId, std::chrono::steady_clock::time_point submitTime) {
+  {
+    std::lock_guard lock(m_mutex);
+    if (!m_running) {
+      return;
+    }
+    m_pending.push_back(
+        PendingPresent{.presentId = presentId, .submitTime = submitTime});
+  }
+  m_condition.notify_one();
+}
+
+std::optional<std::chrono::steady_clock::time_point>
+PresentLatencyMonitor::waitPresented(uint64_t presentId,
+                                     std::chrono::milliseconds timeout) {
+  std::unique_lock lock(m_mutex);
+  if (!m_presentedCondition.wait_for(lock, timeout, [this, presentId] {
+        return !m_running || m_lastPresentedId >= presentId;
+      }) ||
+      m_lastPresentedId < presentId) {
+    return std::nullopt;
+  }
+  return m_lastPresentTime;
+}
+
+std::optional<PresentLatencyMonitor::PresentTiming>
+PresentLatencyMonitor::presentTiming() {
+  std::lock_guard lock(m_mutex);
+  if (m_periodSamples < MIN_PERIOD_SAMPLES) {
+    return std::nullopt;
+  }
+  return PresentTiming{.time = m_lastPresentTime,
+                       .refreshPeriod = m_refreshPeriod};
+}
+
+void PresentLatencyMonitor::measureRefreshPeriod(
+    std::chrono::steady_clock::time_point presentTime) {
+  if (m_lastPresentedId == 0) {
+    return;
+  }
+  std::chrono::duration<double> interval = presentTime - m_lastPresentTime;
+  //间隔比当前的估计短很多，说明之前测到的是刷新周期的倍数，重新开始
+  if (m_periodSamples == 0 || interval < m_refreshPeriod * 0.75) {
+    m_refreshPeriod = interval;
+    m_periodSamples = 1;
+    return;
+  }
+  //没有新的画面时会跳过几次 vblank，按估计的周期数折算，
+  //暂停之后的间隔太长，折算的误差大，不使用
+  auto vsyncs = std::round(interval / m_refreshPeriod);
+  if (vsyncs > 4) {
+    return;
+  }
+  auto sample = interval / vsyncs;
+  //唤醒的误差有零点几毫秒，平均约 128 次之后误差在 0.02% 以内
+  m_refreshPeriod += (sample - m_refreshPeriod) / 128.0;
+  m_periodSamples++;
+}
+
+void PresentLatencyMonitor::run() {
+  //超时后检查是否需要退出
+  const auto timeout = static_cast<uint64_t>(100e6);
+  auto &dispatcher = *m_device.getDispatcher();
+
+  while (true) {
+    PendingPresent present{};
+    {
+      std::unique_lock lock(m_mutex);
+      m_condition.wait(lock, [this] { return !m_running || !m_pending.empty(); });
+      if (!m_running) {
+        return;
+      }
+      present = m_pending.front();
+      m_pending.pop_front();
+    }
+
+    VkResult result = VK_TIMEOUT;
+    while (result == VK_TIMEOUT) {
+      result = dispatcher.vkWaitForPresentKHR(
+          static_cast<VkDevice>(*m_device), static_cast<VkSwapchainKHR>(m_swapchain),
+          present.presentId, timeout);
+      std::lock_guard lock(m_mutex);
+      if (!m_running) {
+        return;
+      }
+    }
+
+    if (result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR) {
+      auto now = std::chrono::steady_clock::now();
+      record(now - present.submitTime);
+      {
+        std::lock_guard lock(m_mutex);
+        measureRefreshPeriod(now);
+        m_lastPresentedId = present.presentId;
+        m_lastPresentTime = now;
+      }
+      m_presentedCondition.notify_all();
+    }
+  }
+}
+
+void PresentLatencyMonitor::record(std::chrono::steady_clock::duration latency) {
+  if (m_sampleCount == 0) {
+    m_total = {};
+    m_min = latency;
+    m_max = latency;
+  }
+  m_sampleCount++;
+  m_total += latency;
+  m_min = std::min(m_min, latency);
+  m_max = std::max(m_max, latency);
+
+  if (m_sampleCount == REPORT_INTERVAL) {
+    using Milliseconds = std::chrono::duration<double, std::milli>;
+    spdlog::info("{} submit to present latency avg {:.2f} ms min {:.2f} ms "
+                 "max {:.2f} ms",
+                 m_presentMode, Milliseconds(m_total / m_sampleCount).count(),
+                 Milliseconds(m_min).count(), Milliseconds(m_max).count());
+    m_sampleCount = 0;
+  }
+}
@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <cmath>
+#include <ntsc.hh>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+//每个 PPU 像素的采样数和副载波一个周期的采样数
+constexpr int SAMPLES_PER_PIXEL = 8;
+constexpr int SAMPLES_PER_CYCLE = 12;
+//每个输出像素占的采样数
+constexpr int SAMPLES_PER_OUTPUT = 4;
+
+// nesdev 的复合信号电平，前 4 个为低电平，后 4 个为高电平
+constexpr float SIGNAL_LEVELS[8] = {0.228f, 0.312f, 0.552f, 0.880f,
+                                    0.616f, 0.840f, 1.100f, 1.100f};
+constexpr float BLACK_LEVEL = 0.312f;
+constexpr float WHITE_LEVEL = 1.100f;
+// emphasis 生效时的衰减
+constexpr float EMPHASIS_ATTENUATION = 0.746f;
+
+//解调的基准相位和色度增益，使默认设置的纯色和 NES_PALETTE_RGB 接近
+constexpr float BASE_HUE = 3.9f;
+constexpr float CHROMA_GAIN = 1.6f;
+
+bool InColorPhase(int color, int phase) {
+  return (color + phase) % SAMPLES_PER_CYCLE < 6;
+}
+
+//颜色索引在某个相位上的信号，已归一化到黑电平为 0，白电平为 1
+float Signal(uint32_t index, int phase) {
+  int color = index & 0x0F;
+  int level = (index >> 4) & 0x03;
+  int emphasis = index >> 6;
+
+  if (color > 13) {
+    level = 1;
+  }
+  auto low = SIGNAL_LEVELS[level];
+  auto high = SIGNAL_LEVELS[4 + level];
+  if (color == 0) {
+    low = high;
+  }
+  if (color > 12) {
+    high = low;
+  }
+
+  auto signal = InColorPhase(color, phase) ? high : low;
+  if (((emphasis & 0x01) && InColorPhase(0, phase)) ||
+      ((emphasis & 0x02) && InColorPhase(4, phase)) ||
+      ((emphasis & 0x04) && InColorPhase(8, phase))) {
+    signal *= EMPHASIS_ATTENUATION;
+  }
+  return (signal - BLACK_LEVEL) / (WHITE_LEVEL - BLACK_LEVEL);
+}
+
+} // namespace
+
+NtscFilter::NtscFilter(WorkerPool &workerPool, const NtscSetup &setup,
+                       bool useSimd)
+    : m_workerPool(workerPool) {
+#if defined(__SSE2__)
+  m_simd = useSimd;
+#endif
+  Setup(setup);
+}
+
+void NtscFilter::Setup(const NtscSetup &setup) {
+  constexpr float PI = 3.14159265358979f;
+  auto hue = BASE_HUE + setup.hue * SAMPLES_PER_CYCLE / 360.0f;
+  auto chroma = CHROMA_GAIN * setup.saturation;
+
+  // 像素 p 覆盖采样 [8p, 8p+8)，输出像素 j 的窗口为 [4j-4, 4j+8)，
+  // 和像素 p 重叠的输出像素为 2p-1 到 2p+2
+  std::vector<Kernel> raw(PHASE_COUNT * COLOR_COUNT);
+  for (uint32_t phaseIndex = 0; phaseIndex < PHASE_COUNT; phaseIndex++) {
+    int pixelPhase = static_cast<int>(phaseIndex) * 4;
+    for (uint32_t index = 0; index < COLOR_COUNT; index++) {
+      auto &kernel = raw[phaseIndex * COLOR_COUNT + index];
+      for (int output = 0; output < 4; output++) {
+        int windowBegin = (output - 1) * SAMPLES_PER_OUTPUT - 4;
+        int windowEnd = windowBegin + SAMPLES_PER_CYCLE;
+
+        float y = 0.0f, i = 0.0f, q = 0.0f;
+        for (int sample = std::max(0, windowBegin);
+             sample < std::min(SAMPLES_PER_PIXEL, windowEnd); sample++) {
+          auto phase = (pixelPhase + sample) % SAMPLES_PER_CYCLE;
+          auto level = Signal(index, phase) / SAMPLES_PER_CYCLE;
+          auto angle = PI * (static_cast<float>(phase) + hue) / 6.0f;
+          y += level;
+          i += level * std::cos(angle) * chroma;
+          q += level * std::sin(angle) * chroma;
+        }
+
+        // YIQ 到 RGB，提前乘上 255
+        kernel.values[output][0] = (y + 0.956f * i + 0.621f * q) * 255.0f;
+        kernel.values[output][1] = (y - 0.272f * i - 0.647f * q) * 255.0f;
+        kernel.values[output][2] = (y - 1.106f * i + 1.703f * q) * 255.0f;
+        //两个 kernel 相加后 alpha 为 255
+        kernel.values[output][3] = 127.5f;
+      }
+    }
+  }
+
+  //奇数帧跳过一个点，相位多前进 8，取两帧的平均
+  m_kernels.resize(raw.size());
+  for (uint32_t phaseIndex = 0; phaseIndex < PHASE_COUNT; phaseIndex++) {
+    auto otherPhase = (phaseIndex + 2) % PHASE_COUNT;
+    for (uint32_t index = 0; index < COLOR_COUNT; index++) {
+      const auto &a = raw[phaseIndex * COLOR_COUNT + index];
+      const auto &b = raw[otherPhase * COLOR_COUNT + index];
+      auto &merged = m_kernels[phaseIndex * COLOR_COUNT + index];
+      for (int output = 0; output < 4; output++) {
+        for (int channel = 0; channel < 4; channel++) {
+          merged.values[output][channel] =
+              (a.values[output][channel] + b.values[output][channel]) * 0.5f;
+        }
+      }
+    }
+  }
+}
+
+void NtscFilter::Filter(const Frame &frame, std::span<const LineRange> ranges,
+                        uint32_t *rgba) {
+  m_lines.clear();
+  for (auto range : ranges) {
+    for (uint32_t line = range.first; line < range.first + range.count; line++) {
+      m_lines.push_back(line);
+    }
+  }
+
+  m_workerPool.ParallelFor(
+      static_cast<uint32_t>(m_lines.size()),
+      [this, &frame, rgba](uint32_t begin, uint32_t end) {
+        for (auto i = begin; i < end; i++) {
+          FilterLine(frame, m_lines[i], rgba);
+        }
+      },
+      8);
+}
+
+void NtscFilter::FilterLine(const Frame &frame, uint32_t line,
+                            uint32_t *rgba) const {
+  const auto *pixels = &frame.pixels[line * NES_FRAME_WIDTH];
+  auto *output = rgba + line * NTSC_OUTPUT_WIDTH;
+
+  //每行前进 4 个采样，像素 p 的相位为 (4 * line + 8 * p) % 12
+  auto linePhase = line % PHASE_COUNT;
+  auto kernelAt = [this, pixels, linePhase](uint32_t p) -> const Kernel & {
+    auto phaseIndex = (linePhase + 2 * p) % PHASE_COUNT;
+    return m_kernels[phaseIndex * COLOR_COUNT + (pixels[p] & 0x1FF)];
+  };
+
+  //左右边界外按黑色处理，黑色的 kernel 只有 alpha
+  static const Kernel ZERO = [] {
+    Kernel kernel{};
+    for (auto &value : kernel.values) {
+      value[3] = 127.5f;
+    }
+    return kernel;
+  }();
+
+  //输出 2p = 像素 p 的第 1 个 + 像素 p-1 的第 3 个
+  //输出 2p+1 = 像素 p 的第 2 个 + 像素 p+1 的第 0 个
+#if defined(__SSE2__)
+  if (m_simd) {
+    const Kernel *previous = &ZERO;
+    const Kernel *current = &kernelAt(0);
+    for (uint32_t p = 0; p < NES_FRAME_WIDTH; p += 2) {
+      //一次处理两个输入像素，得到四个输出像素
+      const Kernel *next = &kernelAt(p + 1);
+      const Kernel *after = p + 2 < NES_FRAME_WIDTH ? &kernelAt(p + 2) : &ZERO;
+
+      auto out0 = _mm_add_ps(_mm_load_ps(current->values[1]),
+                             _mm_load_ps(previous->values[3]));
+      auto out1 = _mm_add_ps(_mm_load_ps(current->values[2]),
+                             _mm_load_ps(next->values[0]));
+      auto out2 = _mm_add_ps(_mm_load_ps(next->values[1]),
+                             _mm_load_ps(current->values[3]));
+      auto out3 = _mm_add_ps(_mm_load_ps(next->values[2]),
+                             _mm_load_ps(after->values[0]));
+
+      //有符号饱和再无符号饱和，相当于 clamp 到 0-255
+      auto low = _mm_packs_epi32(_mm_cvtps_epi32(out0), _mm_cvtps_epi32(out1));
+      auto high = _mm_packs_epi32(_mm_cvtps_epi32(out2), _mm_cvtps_epi32(out3));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(output + 2 * p),
+                       _mm_packus_epi16(low, high));
+
+      previous = next;
+      current = after;
+    }
+    return;
+  }
+#endif
+
+  auto store = [](const float *a, const float *b) {
+    uint32_t result = 0;
+    for (int channel = 0; channel < 4; channel++) {
+      //和 _mm_cvtps_epi32 一样按默认的舍入模式取整，0.5 舍入到偶数
+      auto value =
+          std::clamp(std::nearbyint(a[channel] + b[channel]), 0.0f, 255.0f);
+      result |= static_cast<uint32_t>(value) << (channel * 8);
+    }
+    return result;
+  };
+  for (uint32_t p = 0; p < NES_FRAME_WIDTH; p++) {
+    const auto &current = kernelAt(p);
+    const auto &previous = p > 0 ? kernelAt(p - 1) : ZERO;
+    const auto &next = p + 1 < NES_FRAME_WIDTH ? kernelAt(p + 1) : ZERO;
+    output[2 * p] = store(current.values[1], previous.values[3]);
+    output[2 * p + 1] = store(current.values[2], next.values[0]);
+  }
+}
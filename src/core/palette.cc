@@ -0,0 +1,15 @@
+#include <palette.hh>
+
+void ConvertFrame(const Frame &frame, uint32_t *rgba) {
+  for (size_t i = 0; i < frame.pixels.size(); i++) {
+    rgba[i] = NES_PALETTE_RGBA[frame.pixels[i] & 0x1FF];
+  }
+}
+
+void ConvertLines(const Frame &frame, LineRange range, uint32_t *rgba) {
+  auto begin = range.first * NES_FRAME_WIDTH;
+  auto end = (range.first + range.count) * NES_FRAME_WIDTH;
+  for (auto i = begin; i < end; i++) {
+    rgba[i] = NES_PALETTE_RGBA[frame.pixels[i] & 0x1FF];
+  }
+}
@@ -0,0 +1,764 @@
+#include <algorithm>
+#include <ppu.hh>
+#include <workerpool.hh>
+
+namespace {
+
+// PPUCTRL
+constexpr uint8_t CTRL_INCREMENT_32 = 0x04;
+constexpr uint8_t CTRL_SPRITE_TABLE = 0x08;
+constexpr uint8_t CTRL_BACKGROUND_TABLE = 0x10;
+constexpr uint8_t CTRL_SPRITE_16 = 0x20;
+constexpr uint8_t CTRL_NMI = 0x80;
+
+// PPUMASK
+constexpr uint8_t MASK_GRAYSCALE = 0x01;
+constexpr uint8_t MASK_BACKGROUND_LEFT = 0x02;
+constexpr uint8_t MASK_SPRITES_LEFT = 0x04;
+constexpr uint8_t MASK_BACKGROUND = 0x08;
+constexpr uint8_t MASK_SPRITES = 0x10;
+
+// PPUSTATUS
+constexpr uint8_t STATUS_OVERFLOW = 0x20;
+constexpr uint8_t STATUS_SPRITE_ZERO = 0x40;
+constexpr uint8_t STATUS_VBLANK = 0x80;
+
+// OAM 属性
+constexpr uint8_t SPRITE_BEHIND = 0x20;
+constexpr uint8_t SPRITE_FLIP_X = 0x40;
+constexpr uint8_t SPRITE_FLIP_Y = 0x80;
+
+//背景缓存为 2x2 个 nametable
+constexpr uint32_t CACHE_WIDTH = NES_FRAME_WIDTH * 2;
+constexpr uint32_t CACHE_HEIGHT = NES_FRAME_HEIGHT * 2;
+constexpr uint32_t CACHE_TILES_X = CACHE_WIDTH / 8;
+constexpr uint32_t CACHE_TILES_Y = CACHE_HEIGHT / 8;
+constexpr uint16_t INVALID_TILE = 0xFFFF;
+
+} // namespace
+
+PPU::PPU()
+    : m_backgroundCache(CACHE_WIDTH * CACHE_HEIGHT),
+      m_cacheTiles(CACHE_TILES_X * CACHE_TILES_Y, INVALID_TILE) {}
+
+void PPU::LoadChr(std::span<const uint8_t> chr) {
+  // mapper 可能在帧中间切换 CHR bank，和镜像一样按扫描线重放
+  if (m_workerPool != nullptr) {
+    LogAccess(RegisterAccess::Kind::Chr, 0, 0);
+    if (m_chrLogCount == m_chrLog.size()) {
+      m_chrLog.emplace_back();
+    }
+    m_chrLog[m_chrLogCount++].assign(chr.begin(), chr.end());
+  }
+  m_patterns.fill(0);
+  m_chrRam = chr.empty();
+  std::copy_n(chr.begin(), std::min(chr.size(), m_patterns.size()),
+              m_patterns.begin());
+  InvalidateCache();
+  m_eventsPredicted = false;
+}
+
+void PPU::SetMirroring(Mirroring mirroring) {
+  //mapper 可能在帧中间切换镜像
+  LogAccess(RegisterAccess::Kind::Mirroring, 0,
+            static_cast<uint8_t>(mirroring));
+  m_mirroring = mirroring;
+  InvalidateCache();
+  m_eventsPredicted = false;
+}
+
+void PPU::SetBackgroundCache(bool enabled) {
+  m_cacheEnabled = enabled;
+  InvalidateCache();
+  for (auto &replica : m_replicas) {
+    replica.SetBackgroundCache(enabled);
+  }
+}
+
+void PPU::SetParallelRendering(WorkerPool *workerPool) {
+  m_workerPool = nullptr;
+  m_replicas.clear();
+  m_accessLog.clear();
+  m_chrLogCount = 0;
+  if (workerPool == nullptr) {
+    return;
+  }
+
+  //每个线程一段，副本从当前状态开始
+  auto bands = workerPool->ThreadCount();
+  auto bandHeight = (NES_FRAME_HEIGHT + bands - 1) / bands;
+  m_replicas.assign(bands, *this);
+  for (uint32_t i = 0; i < bands; i++) {
+    auto &replica = m_replicas[i];
+    replica.m_bandFirst = std::min(i * bandHeight, NES_FRAME_HEIGHT);
+    replica.m_bandEnd = std::min(replica.m_bandFirst + bandHeight,
+                                 NES_FRAME_HEIGHT);
+  }
+  m_workerPool = workerPool;
+}
+
+void PPU::LogAccess(RegisterAccess::Kind kind, uint8_t address,
+                    uint8_t value) {
+  if (m_workerPool != nullptr) {
+    m_accessLog.push_back({.line = static_cast<uint16_t>(m_scanline),
+                           .kind = kind,
+                           .address = address,
+                           .value = value});
+  }
+}
+
+uint8_t PPU::ReadRegister(uint16_t address) {
+  address &= 0x07;
+  if (address == 2 || address == 7) {
+    LogAccess(RegisterAccess::Kind::Read, static_cast<uint8_t>(address), 0);
+  }
+  //读取 PPUDATA 会移动 v
+  if (address == 7) {
+    m_eventsPredicted = false;
+  }
+  switch (address) {
+  case 2: {
+    //低 5 位是总线上残留的值，这里用 PPUDATA 的缓冲代替
+    uint8_t result = (m_status & 0xE0) | (m_readBuffer & 0x1F);
+    m_status &= ~STATUS_VBLANK;
+    m_writeToggle = false;
+    return result;
+  }
+  case 4:
+    return m_oam[m_oamAddress];
+  case 7: {
+    auto vramAddress = static_cast<uint16_t>(m_v & 0x3FFF);
+    uint8_t result;
+    //调色板直接返回，缓冲中放入调色板下面的 nametable 数据
+    if (vramAddress < 0x3F00) {
+      result = m_readBuffer;
+      m_readBuffer = ReadVram(vramAddress);
+    } else {
+      result = ReadVram(vramAddress);
+      m_readBuffer = ReadVram(vramAddress - 0x1000);
+    }
+    m_v += (m_ctrl & CTRL_INCREMENT_32) ? 32 : 1;
+    return result;
+  }
+  default:
+    return 0;
+  }
+}
+
+void PPU::WriteRegister(uint16_t address, uint8_t value) {
+  address &= 0x07;
+  LogAccess(RegisterAccess::Kind::Write, static_cast<uint8_t>(address), value);
+  m_eventsPredicted = false;
+  switch (address) {
+  case 0: {
+    auto previous = m_ctrl;
+    m_ctrl = value;
+    m_t = (m_t & 0xF3FF) | ((value & 0x03) << 10);
+    if ((previous ^ value) & CTRL_SPRITE_16) {
+      m_spriteListsDirty = true;
+    }
+    //帧中途切换时不让缓存失效，这一帧剩下的扫描线直接解码
+    if (!MidFrame()) {
+      SyncCachePatternTable();
+    }
+    // vblank 期间打开 NMI 会立即产生一次
+    if ((value & CTRL_NMI) && !(previous & CTRL_NMI) &&
+        (m_status & STATUS_VBLANK)) {
+      m_nmi = true;
+    }
+    break;
+  }
+  case 1:
+    m_mask = value;
+    break;
+  case 3:
+    m_oamAddress = value;
+    break;
+  case 4:
+    m_oam[m_oamAddress++] = value;
+    m_spriteListsDirty = true;
+    break;
+  case 5:
+    if (!m_writeToggle) {
+      m_t = (m_t & 0xFFE0) | (value >> 3);
+      m_fineX = value & 0x07;
+    } else {
+      m_t = (m_t & 0x8C1F) | ((value & 0x07) << 12) | ((value & 0xF8) << 2);
+    }
+    m_writeToggle = !m_writeToggle;
+    break;
+  case 6:
+    if (!m_writeToggle) {
+      m_t = (m_t & 0x00FF) | ((value & 0x3F) << 8);
+    } else {
+      m_t = (m_t & 0xFF00) | value;
+      m_v = m_t;
+    }
+    m_writeToggle = !m_writeToggle;
+    break;
+  case 7:
+    WriteVram(m_v & 0x3FFF, value);
+    m_v += (m_ctrl & CTRL_INCREMENT_32) ? 32 : 1;
+    break;
+  default:
+    break;
+  }
+}
+
+void PPU::WriteOamDma(std::span<const uint8_t, 256> page) {
+  //从 OAMADDR 开始写入，超过 255 回绕，和写入 256 次 $2004 相同
+  for (auto value : page) {
+    LogAccess(RegisterAccess::Kind::Write, 4, value);
+    m_oam[m_oamAddress++] = value;
+  }
+  m_spriteListsDirty = true;
+  m_eventsPredicted = false;
+}
+
+bool PPU::TakeNmi() {
+  auto nmi = m_nmi;
+  m_nmi = false;
+  return nmi;
+}
+
+uint16_t PPU::NametableIndex(uint16_t address) const {
+  uint16_t table = (address >> 10) & 0x03;
+  uint16_t offset = address & 0x03FF;
+  switch (m_mirroring) {
+  case Mirroring::Horizontal:
+    table >>= 1;
+    break;
+  case Mirroring::Vertical:
+    table &= 0x01;
+    break;
+  case Mirroring::SingleScreenLow:
+    table = 0;
+    break;
+  case Mirroring::SingleScreenHigh:
+    table = 1;
+    break;
+  case Mirroring::FourScreen:
+    break;
+  }
+  return static_cast<uint16_t>(table * 0x0400 + offset);
+}
+
+uint8_t PPU::PaletteIndex(uint16_t address) {
+  uint8_t index = address & 0x1F;
+  //精灵调色板的第 0 个颜色是背景调色板对应颜色的镜像
+  if ((index & 0x13) == 0x10) {
+    index &= ~0x10;
+  }
+  return index;
+}
+
+uint8_t PPU::ReadVram(uint16_t address) const {
+  address &= 0x3FFF;
+  if (address < 0x2000) {
+    return m_patterns[address];
+  }
+  if (address < 0x3F00) {
+    return m_nametables[NametableIndex(address)];
+  }
+  return m_palette[PaletteIndex(address)];
+}
+
+void PPU::WriteVram(uint16_t address, uint8_t value) {
+  address &= 0x3FFF;
+  if (address < 0x2000) {
+    if (m_chrRam && m_patterns[address] != value) {
+      m_patterns[address] = value;
+      m_dirtyPatterns.set(address >> 4);
+      m_patternsDirty = true;
+    }
+  } else if (address < 0x3F00) {
+    auto index = NametableIndex(address);
+    if (m_nametables[index] != value) {
+      m_nametables[index] = value;
+      InvalidateNametable(address);
+    }
+  } else {
+    m_palette[PaletteIndex(address)] = value & 0x3F;
+  }
+}
+
+void PPU::RunScanline(uint32_t line, Frame &frame) {
+  m_scanline = line;
+  if (line < NES_FRAME_HEIGHT) {
+    //这条扫描线上 CPU 还没有运行到的事件
+    RunEvents(line * PPU_DOTS_PER_SCANLINE + PPU_DOTS_PER_SCANLINE - 1);
+    if (ShouldRender(line)) {
+      RenderScanline(line, frame.pixels.data() + line * NES_FRAME_WIDTH);
+    }
+    //第 256 dot 纵向加一，第 257 dot 恢复横向滚动
+    if (RenderingEnabled()) {
+      IncrementY(m_v);
+      CopyHorizontal(m_v);
+    }
+  } else if (line == PPU_VBLANK_SCANLINE) {
+    m_status |= STATUS_VBLANK;
+    if (m_ctrl & CTRL_NMI) {
+      m_nmi = true;
+    }
+  } else if (line == PPU_PRERENDER_SCANLINE) {
+    m_status &= ~(STATUS_VBLANK | STATUS_SPRITE_ZERO | STATUS_OVERFLOW);
+    //可见扫描线上 v 的变化是确定的，预测在下一帧开始前一直有效
+    m_eventsPredicted = false;
+    SyncCachePatternTable();
+    if (RenderingEnabled()) {
+      CopyHorizontal(m_v);
+      CopyVertical(m_v);
+    }
+    if (m_workerPool != nullptr) {
+      RenderBands(frame);
+    }
+  }
+  m_scanline = (line + 1) % PPU_SCANLINES_PER_FRAME;
+}
+
+uint32_t PPU::NextEventDot() {
+  if (!m_eventsPredicted) {
+    PredictEvents();
+  }
+  return std::min(m_spriteZeroHitDot, m_overflowDot);
+}
+
+void PPU::RunEvents(uint32_t dot) {
+  if (NextEventDot() > dot) {
+    return;
+  }
+  if (m_spriteZeroHitDot <= dot) {
+    m_status |= STATUS_SPRITE_ZERO;
+  }
+  if (m_overflowDot <= dot) {
+    m_status |= STATUS_OVERFLOW;
+  }
+  m_eventsPredicted = false;
+}
+
+void PPU::PredictEvents() {
+  m_spriteZeroHitDot = PPU_NO_EVENT;
+  m_overflowDot = PPU_NO_EVENT;
+  m_eventsPredicted = true;
+  if (!RenderingEnabled()) {
+    return;
+  }
+
+  //假设之后没有寄存器访问，按照每条扫描线结束时对 v 的更新向后推算
+  bool spriteZeroHit = (m_status & STATUS_SPRITE_ZERO) != 0;
+  bool overflow = (m_status & STATUS_OVERFLOW) != 0;
+  auto v = m_v;
+  for (auto line = m_scanline; line < NES_FRAME_HEIGHT; line++) {
+    if (spriteZeroHit && overflow) {
+      break;
+    }
+    auto lineDot = line * PPU_DOTS_PER_SCANLINE;
+    if (!spriteZeroHit) {
+      auto x = SpriteZeroHitX(line, v);
+      if (x < NES_FRAME_WIDTH) {
+        //像素 x 在第 x + 1 个 dot 输出
+        m_spriteZeroHitDot = lineDot + x + 1;
+        spriteZeroHit = true;
+      }
+    }
+    //这条扫描线上评估的是下一条线的精灵
+    if (!overflow && line + 1 < NES_FRAME_HEIGHT) {
+      const auto &sprites = SpritesOnLine(line + 1);
+      if (sprites.overflow) {
+        m_overflowDot = lineDot + sprites.overflowDot;
+        overflow = true;
+      }
+    }
+    IncrementY(v);
+    CopyHorizontal(v);
+  }
+}
+
+uint32_t PPU::SpriteZeroHitX(uint32_t line, uint16_t v) {
+  if ((m_mask & (MASK_BACKGROUND | MASK_SPRITES)) !=
+      (MASK_BACKGROUND | MASK_SPRITES)) {
+    return NES_FRAME_WIDTH;
+  }
+  //精灵按照 OAM 顺序排列，sprite 0 在这条线上时一定是第一个
+  const auto &sprites = SpritesOnLine(line);
+  if (sprites.count == 0 || sprites.indices[0] != 0) {
+    return NES_FRAME_WIDTH;
+  }
+
+  std::array<uint8_t, 8> row;
+  DecodeSpriteRow(0, line, row);
+  std::array<uint8_t, NES_FRAME_WIDTH> background;
+  RenderBackground(v, background);
+  uint32_t left = (m_mask & MASK_SPRITES_LEFT) ? 0 : 8;
+  // x 为 255 时不会 hit
+  for (uint32_t bit = 0; bit < 8; bit++) {
+    uint32_t x = m_oam[3] + bit;
+    if (x >= NES_FRAME_WIDTH - 1) {
+      break;
+    }
+    if (row[bit] != 0 && x >= left && background[x] != 0) {
+      return x;
+    }
+  }
+  return NES_FRAME_WIDTH;
+}
+
+bool PPU::ShouldRender(uint32_t line) const {
+  // sprite 0 hit 和 overflow 由预测得到，并行渲染时不需要在这里渲染
+  return m_workerPool == nullptr && line >= m_bandFirst && line < m_bandEnd;
+}
+
+void PPU::RenderBands(Frame &frame) {
+  m_workerPool->ParallelFor(
+      static_cast<uint32_t>(m_replicas.size()),
+      [this, &frame](uint32_t begin, uint32_t end) {
+        std::span<const std::vector<uint8_t>> chrLoads(m_chrLog.data(),
+                                                       m_chrLogCount);
+        for (auto i = begin; i < end; i++) {
+          m_replicas[i].Replay(m_accessLog, chrLoads, frame);
+        }
+      });
+  m_accessLog.clear();
+  m_chrLogCount = 0;
+}
+
+void PPU::Replay(const std::vector<RegisterAccess> &accesses,
+                 std::span<const std::vector<uint8_t>> chrLoads, Frame &frame) {
+  //访问记录从第 0 条扫描线开始，按扫描线排列
+  auto access = accesses.begin();
+  auto chr = chrLoads.begin();
+  for (uint32_t line = 0; line < PPU_SCANLINES_PER_FRAME; line++) {
+    for (; access != accesses.end() && access->line == line; ++access) {
+      switch (access->kind) {
+      case RegisterAccess::Kind::Read:
+        ReadRegister(access->address);
+        break;
+      case RegisterAccess::Kind::Write:
+        WriteRegister(access->address, access->value);
+        break;
+      case RegisterAccess::Kind::Mirroring:
+        SetMirroring(static_cast<Mirroring>(access->value));
+        break;
+      case RegisterAccess::Kind::Chr:
+        LoadChr(*chr++);
+        break;
+      }
+    }
+    RunScanline(line, frame);
+  }
+}
+
+const ScanlineSprites &PPU::SpritesOnLine(uint32_t line) {
+  if (m_spriteListsDirty) {
+    BuildSpriteLists();
+  }
+  return m_scanlineSprites[line];
+}
+
+void PPU::BuildSpriteLists() {
+  m_scanlineSprites.fill({});
+  auto height = SpriteHeight();
+
+  // OAM 的 Y 是精灵上一条扫描线，第 0 条扫描线上不会有精灵
+  for (uint32_t index = 0; index < OAM_SPRITE_COUNT; index++) {
+    uint32_t first = m_oam[index * 4] + 1;
+    auto end = std::min(first + height, NES_FRAME_HEIGHT);
+    for (auto line = first; line < end; line++) {
+      auto &sprites = m_scanlineSprites[line];
+      if (sprites.count < SPRITES_PER_SCANLINE) {
+        sprites.indices[sprites.count++] = static_cast<uint8_t>(index);
+      }
+    }
+  }
+
+  //只有满 8 个的扫描线需要检查 overflow。硬件找到 8 个精灵后继续检查
+  //剩下的精灵，但换到下一个精灵时读取的字节偏移也会加一，
+  //所以会把 tile、属性或者 X 当作 Y 比较
+  for (uint32_t line = 1; line < NES_FRAME_HEIGHT; line++) {
+    auto &sprites = m_scanlineSprites[line];
+    if (sprites.count < SPRITES_PER_SCANLINE) {
+      continue;
+    }
+    uint32_t last = sprites.indices[SPRITES_PER_SCANLINE - 1];
+    uint32_t index = last + 1;
+    uint32_t byte = 0;
+    while (index < OAM_SPRITE_COUNT) {
+      uint32_t y = m_oam[index * 4 + byte];
+      if (line - 1 - y < height) {
+        sprites.overflow = true;
+        //评估从第 65 个 dot 开始，每次读取 2 个 dot，范围内的精灵复制
+        // 4 个字节共 8 个 dot
+        sprites.overflowDot = static_cast<uint16_t>(
+            65 + SPRITES_PER_SCANLINE * 8 +
+            (last + 1 - SPRITES_PER_SCANLINE) * 2 + (index - last) * 2);
+        break;
+      }
+      index++;
+      byte = (byte + 1) & 0x03;
+    }
+  }
+  m_spriteListsDirty = false;
+}
+
+uint8_t PPU::BackgroundPalette(uint16_t v) const {
+  auto attribute = ReadVram(0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) |
+                            ((v >> 2) & 0x07));
+  // coarse x 和 coarse y 的 bit 1 选择 2x2 tile 的象限
+  auto shift = ((v >> 4) & 0x04) | (v & 0x02);
+  return static_cast<uint8_t>(((attribute >> shift) & 0x03) << 2);
+}
+
+void PPU::DecodeTileRow(uint16_t pattern, uint16_t fineY, uint8_t palette,
+                        uint8_t *pixels) const {
+  auto low = m_patterns[pattern * 16 + fineY];
+  auto high = m_patterns[pattern * 16 + fineY + 8];
+  for (int bit = 0; bit < 8; bit++) {
+    uint8_t value =
+        ((low >> (7 - bit)) & 0x01) | (((high >> (7 - bit)) & 0x01) << 1);
+    pixels[bit] = value != 0 ? palette | value : 0;
+  }
+}
+
+void PPU::RenderBackground(uint16_t v,
+                           std::array<uint8_t, NES_FRAME_WIDTH> &background) {
+  // coarse y 为 30、31 时读取的是属性表，缓存中没有这些行
+  if (m_cacheEnabled && BackgroundPatternTable() == m_cachePatternTable &&
+      ((v >> 5) & 0x1F) < 30) {
+    ComposeBackground(v, background);
+  } else {
+    DecodeBackground(v, background);
+  }
+  if (!(m_mask & MASK_BACKGROUND_LEFT)) {
+    std::fill_n(background.begin(), 8, 0);
+  }
+}
+
+void PPU::DecodeBackground(
+    uint16_t v, std::array<uint8_t, NES_FRAME_WIDTH> &background) const {
+  auto patternBase = BackgroundPatternTable();
+  uint16_t fineY = (v >> 12) & 0x07;
+
+  //fine x 不为 0 时第 33 个 tile 的一部分可见
+  std::array<uint8_t, 33 * 8> row;
+  for (uint32_t tile = 0; tile < 33; tile++) {
+    auto tileIndex = ReadVram(0x2000 | (v & 0x0FFF));
+    DecodeTileRow(patternBase | tileIndex, fineY, BackgroundPalette(v),
+                  &row[tile * 8]);
+
+    //coarse x 加一，超过 31 时切换到横向相邻的 nametable
+    if ((v & 0x001F) == 31) {
+      v = (v & ~0x001F) ^ 0x0400;
+    } else {
+      v++;
+    }
+  }
+  std::copy_n(row.begin() + m_fineX, NES_FRAME_WIDTH, background.begin());
+}
+
+void PPU::ComposeBackground(uint16_t v,
+                            std::array<uint8_t, NES_FRAME_WIDTH> &background) {
+  if (m_patternsDirty) {
+    for (auto &pattern : m_cacheTiles) {
+      if (pattern != INVALID_TILE && m_dirtyPatterns.test(pattern)) {
+        pattern = INVALID_TILE;
+      }
+    }
+    m_dirtyPatterns.reset();
+    m_patternsDirty = false;
+  }
+
+  // v 在 4 个 nametable 拼成的背景中的位置
+  uint32_t x =
+      ((v >> 10) & 0x01) * NES_FRAME_WIDTH + (v & 0x1F) * 8 + m_fineX;
+  uint32_t y = ((v >> 11) & 0x01) * NES_FRAME_HEIGHT + ((v >> 5) & 0x1F) * 8 +
+               ((v >> 12) & 0x07);
+
+  auto tileY = y / 8;
+  for (uint32_t i = 0; i < 33; i++) {
+    auto tile = tileY * CACHE_TILES_X + (x / 8 + i) % CACHE_TILES_X;
+    if (m_cacheTiles[tile] == INVALID_TILE) {
+      DecodeCacheTile(tile);
+    }
+  }
+
+  //超出右边时回到左边的 nametable
+  const auto *row = &m_backgroundCache[y * CACHE_WIDTH];
+  auto count = std::min(CACHE_WIDTH - x, NES_FRAME_WIDTH);
+  std::copy_n(row + x, count, background.begin());
+  std::copy_n(row, NES_FRAME_WIDTH - count, background.begin() + count);
+}
+
+void PPU::DecodeCacheTile(uint32_t tile) {
+  auto tileX = tile % CACHE_TILES_X;
+  auto tileY = tile / CACHE_TILES_X;
+  // v 的格式，fine y 为 0
+  uint16_t table = (tileX / 32) | ((tileY / 30) << 1);
+  auto v = static_cast<uint16_t>((table << 10) | ((tileY % 30) << 5) |
+                                 (tileX % 32));
+  uint16_t pattern = m_cachePatternTable | ReadVram(0x2000 | v);
+  auto palette = BackgroundPalette(v);
+
+  auto *pixels = &m_backgroundCache[tileY * 8 * CACHE_WIDTH + tileX * 8];
+  for (uint16_t fineY = 0; fineY < 8; fineY++) {
+    DecodeTileRow(pattern, fineY, palette, pixels + fineY * CACHE_WIDTH);
+  }
+  m_cacheTiles[tile] = pattern;
+}
+
+void PPU::InvalidateNametable(uint16_t address) {
+  auto physical = NametableIndex(address) >> 10;
+  uint32_t offset = address & 0x03FF;
+
+  //属性表的一个字节对应 4x4 个 tile
+  uint32_t firstX = offset & 0x1F, firstY = offset >> 5;
+  uint32_t width = 1, height = 1;
+  if (offset >= 0x03C0) {
+    firstX = (offset & 0x07) * 4;
+    firstY = ((offset - 0x03C0) >> 3) * 4;
+    width = 4;
+    height = std::min(4U, 30 - firstY);
+  }
+
+  for (uint16_t table = 0; table < 4; table++) {
+    if ((NametableIndex(0x2000 | (table << 10)) >> 10) != physical) {
+      continue;
+    }
+    auto tileX = (table & 0x01) * 32 + firstX;
+    auto tileY = (table >> 1) * 30 + firstY;
+    for (uint32_t dy = 0; dy < height; dy++) {
+      std::fill_n(&m_cacheTiles[(tileY + dy) * CACHE_TILES_X + tileX], width,
+                  INVALID_TILE);
+    }
+  }
+}
+
+void PPU::InvalidateCache() {
+  std::fill(m_cacheTiles.begin(), m_cacheTiles.end(), INVALID_TILE);
+  m_dirtyPatterns.reset();
+  m_patternsDirty = false;
+}
+
+uint16_t PPU::BackgroundPatternTable() const {
+  return (m_ctrl & CTRL_BACKGROUND_TABLE) ? 0x100 : 0x000;
+}
+
+void PPU::SyncCachePatternTable() {
+  if (m_cachePatternTable != BackgroundPatternTable()) {
+    m_cachePatternTable = BackgroundPatternTable();
+    InvalidateCache();
+  }
+}
+
+bool PPU::MidFrame() const {
+  return RenderingEnabled() && m_scanline > 0 && m_scanline < NES_FRAME_HEIGHT;
+}
+
+void PPU::DecodeSpriteRow(uint32_t index, uint32_t line,
+                          std::array<uint8_t, 8> &pixels) const {
+  const auto *sprite = &m_oam[index * 4];
+  auto attribute = sprite[2];
+  auto height = SpriteHeight();
+  uint32_t row = line - 1 - sprite[0];
+  if (attribute & SPRITE_FLIP_Y) {
+    row = height - 1 - row;
+  }
+
+  uint16_t address;
+  if (height == 16) {
+    address = ((sprite[1] & 0x01) << 12) | ((sprite[1] & 0xFE) << 4) |
+              ((row & 0x08) << 1) | (row & 0x07);
+  } else {
+    address = ((m_ctrl & CTRL_SPRITE_TABLE) ? 0x1000 : 0x0000) |
+              (sprite[1] << 4) | row;
+  }
+  auto low = m_patterns[address];
+  auto high = m_patterns[address + 8];
+  for (uint32_t bit = 0; bit < 8; bit++) {
+    auto column = (attribute & SPRITE_FLIP_X) ? bit : 7 - bit;
+    pixels[bit] = ((low >> column) & 0x01) | (((high >> column) & 0x01) << 1);
+  }
+}
+
+void PPU::RenderSprites(uint32_t line,
+                        const std::array<uint8_t, NES_FRAME_WIDTH> &background,
+                        uint16_t *pixels) {
+  // 0 为透明，否则为 0x10-0x1F 的调色板序号，SPRITE_BEHIND 表示在背景之后
+  std::array<uint8_t, NES_FRAME_WIDTH> sprites{};
+  if (m_mask & MASK_SPRITES) {
+    uint32_t left = (m_mask & MASK_SPRITES_LEFT) ? 0 : 8;
+    const auto &lineSprites = SpritesOnLine(line);
+
+    for (uint32_t i = 0; i < lineSprites.count; i++) {
+      auto index = lineSprites.indices[i];
+      auto attribute = m_oam[index * 4 + 2];
+      std::array<uint8_t, 8> row;
+      DecodeSpriteRow(index, line, row);
+
+      for (uint32_t bit = 0; bit < 8; bit++) {
+        uint32_t x = m_oam[index * 4 + 3] + bit;
+        if (x >= NES_FRAME_WIDTH) {
+          break;
+        }
+        //序号小的精灵优先，即使它在背景之后也会挡住后面的精灵
+        if (row[bit] == 0 || x < left || sprites[x] != 0) {
+          continue;
+        }
+        sprites[x] = 0x10 | ((attribute & 0x03) << 2) | row[bit] |
+                     (attribute & SPRITE_BEHIND);
+      }
+    }
+  }
+
+  uint8_t grayscale = (m_mask & MASK_GRAYSCALE) ? 0x30 : 0x3F;
+  uint16_t emphasis = static_cast<uint16_t>((m_mask >> 5) << 6);
+  for (uint32_t x = 0; x < NES_FRAME_WIDTH; x++) {
+    auto sprite = sprites[x];
+    uint8_t index = background[x];
+    if (sprite != 0 && (!(sprite & SPRITE_BEHIND) || index == 0)) {
+      index = sprite & 0x1F;
+    }
+    pixels[x] = (m_palette[PaletteIndex(index)] & grayscale) | emphasis;
+  }
+}
+
+void PPU::RenderScanline(uint32_t line, uint16_t *pixels) {
+  if (!RenderingEnabled()) {
+    //渲染关闭时显示背景色
+    uint16_t emphasis = static_cast<uint16_t>((m_mask >> 5) << 6);
+    std::fill_n(pixels, NES_FRAME_WIDTH, m_palette[0] | emphasis);
+    return;
+  }
+
+  std::array<uint8_t, NES_FRAME_WIDTH> background{};
+  if (m_mask & MASK_BACKGROUND) {
+    RenderBackground(m_v, background);
+  }
+  RenderSprites(line, background, pixels);
+}
+
+void PPU::IncrementY(uint16_t &v) {
+  if ((v & 0x7000) != 0x7000) {
+    v += 0x1000;
+    return;
+  }
+  // fine y 溢出到 coarse y，第 29 行之后切换到纵向相邻的 nametable
+  v &= ~0x7000;
+  uint16_t y = (v & 0x03E0) >> 5;
+  if (y == 29) {
+    y = 0;
+    v ^= 0x0800;
+  } else if (y == 31) {
+    y = 0;
+  } else {
+    y++;
+  }
+  v = (v & ~0x03E0) | (y << 5);
+}
+
+void PPU::CopyHorizontal(uint16_t &v) const {
+  v = (v & ~0x041F) | (m_t & 0x041F);
+}
+
+void PPU::CopyVertical(uint16_t &v) const {
+  v = (v & ~0x7BE0) | (m_t & 0x7BE0);
+}
@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+#include <resampler.hh>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RESAMPLER_HAS_X86 1
+#endif
+
+namespace {
+
+//系数按这么多个 float 对齐，AVX2 一次处理 8 个
+constexpr uint32_t TAP_ALIGNMENT = 8;
+
+struct QualityParameters {
+  uint32_t zeroCrossings;
+  double bandwidth;
+};
+
+QualityParameters Parameters(ResamplerQuality quality) {
+  switch (quality) {
+  case ResamplerQuality::Low:
+    return {8, 0.80};
+  case ResamplerQuality::Medium:
+    return {16, 0.85};
+  default:
+    return {32, 0.90};
+  }
+}
+
+uint64_t FixedStep(double inputRate, double outputRate) {
+  return static_cast<uint64_t>(std::llround(inputRate / outputRate * 4294967296.0));
+}
+
+//逐个输出计算点积，Dot 处理 taps 个输入和系数
+template <typename Dot>
+[[gnu::always_inline]] inline uint32_t
+ProcessWith(Dot dot, const float *input, uint32_t count,
+            const float *coefficients, uint32_t taps, uint32_t phaseBits,
+            uint64_t &position, uint64_t step, float *output) {
+  uint32_t produced = 0;
+  while ((position >> 32) + taps <= count) {
+    auto start = static_cast<uint32_t>(position >> 32);
+    auto phase = static_cast<uint32_t>(position >> (32 - phaseBits)) &
+                 ((1U << phaseBits) - 1);
+    output[produced++] = dot(input + start, coefficients + phase * taps, taps);
+    position += step;
+  }
+  return produced;
+}
+
+constexpr uint32_t KERNEL_PHASE_BITS = 7;
+
+uint32_t ProcessPortable(const float *input, uint32_t count,
+                         const float *coefficients, uint32_t taps,
+                         uint64_t &position, uint64_t step, float *output) {
+  auto dot = [](const float *samples, const float *weights, uint32_t taps) {
+    //4 路累加，减少浮点加法的依赖链
+    float sums[4] = {};
+    for (uint32_t i = 0; i < taps; i += 4) {
+      for (uint32_t lane = 0; lane < 4; lane++) {
+        sums[lane] += samples[i + lane] * weights[i + lane];
+      }
+    }
+    return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+  };
+  return ProcessWith(dot, input, count, coefficients, taps, KERNEL_PHASE_BITS,
+                     position, step, output);
+}
+
+#ifdef RESAMPLER_HAS_X86
+__attribute__((target("avx2,fma"))) uint32_t
+ProcessAvx2(const float *input, uint32_t count, const float *coefficients,
+            uint32_t taps, uint64_t &position, uint64_t step, float *output) {
+  auto dot = [](const float *samples, const float *weights,
+                uint32_t taps) __attribute__((target("avx2,fma"))) {
+    //两路累加器隐藏 FMA 的延迟，系数按 8 对齐，最后可能剩下 8 个
+    auto sum0 = _mm256_setzero_ps();
+    auto sum1 = _mm256_setzero_ps();
+    uint32_t i = 0;
+    for (; i + 16 <= taps; i += 16) {
+      sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(samples + i),
+                             _mm256_loadu_ps(weights + i), sum0);
+      sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(samples + i + 8),
+                             _mm256_loadu_ps(weights + i + 8), sum1);
+    }
+    if (i < taps) {
+      sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(samples + i),
+                             _mm256_loadu_ps(weights + i), sum0);
+    }
+    auto sum = _mm256_add_ps(sum0, sum1);
+    auto half = _mm_add_ps(_mm256_castps256_ps128(sum),
+                           _mm256_extractf128_ps(sum, 1));
+    half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+    half = _mm_add_ss(half, _mm_movehdup_ps(half));
+    return _mm_cvtss_f32(half);
+  };
+  return ProcessWith(dot, input, count, coefficients, taps, KERNEL_PHASE_BITS,
+                     position, step, output);
+}
+#endif
+
+} // namespace
+
+Resampler::Resampler(double inputRate, double outputRate,
+                     ResamplerQuality quality, bool useSimd) {
+  static_assert(PHASE_BITS == KERNEL_PHASE_BITS);
+  SetRates(inputRate, outputRate);
+
+  //截止频率以输入采样率为单位，sinc 每 1/(2 * cutoff) 个输入过零一次
+  auto [zeroCrossings, bandwidth] = Parameters(quality);
+  auto cutoff = 0.5 * bandwidth * std::min(1.0, outputRate / inputRate);
+  auto halfWidth = zeroCrossings / 2 / (2 * cutoff);
+  m_taps = static_cast<uint32_t>(std::ceil(halfWidth * 2));
+  m_taps = (m_taps + TAP_ALIGNMENT - 1) / TAP_ALIGNMENT * TAP_ALIGNMENT;
+
+  //第 k 个系数对应的输入和输出位置的距离为 k - 相位 - 中心
+  auto center = m_taps / 2.0;
+  m_coefficients.resize(static_cast<size_t>(PHASE_COUNT) * m_taps);
+  for (uint32_t phase = 0; phase < PHASE_COUNT; phase++) {
+    auto *weights = &m_coefficients[static_cast<size_t>(phase) * m_taps];
+    double sum = 0;
+    for (uint32_t k = 0; k < m_taps; k++) {
+      double x = k - static_cast<double>(phase) / PHASE_COUNT - center;
+      if (std::abs(x) >= halfWidth) {
+        weights[k] = 0;
+        continue;
+      }
+      double t = 2 * cutoff * x;
+      double sinc = t == 0 ? 1.0 : std::sin(std::numbers::pi * t) /
+                                       (std::numbers::pi * t);
+      double window = 0.42 + 0.5 * std::cos(std::numbers::pi * x / halfWidth) +
+                      0.08 * std::cos(2 * std::numbers::pi * x / halfWidth);
+      weights[k] = static_cast<float>(sinc * window);
+      sum += weights[k];
+    }
+    //每个相位的直流增益为 1
+    for (uint32_t k = 0; k < m_taps; k++) {
+      weights[k] = static_cast<float>(weights[k] / sum);
+    }
+  }
+
+  m_kernel = ProcessPortable;
+#ifdef RESAMPLER_HAS_X86
+  if (useSimd && __builtin_cpu_supports("avx2") &&
+      __builtin_cpu_supports("fma")) {
+    m_kernel = ProcessAvx2;
+    m_simd = true;
+  }
+#endif
+}
+
+void Resampler::SetRates(double inputRate, double outputRate) {
+  m_step = FixedStep(inputRate, outputRate);
+}
+
+uint32_t Resampler::MaxOutput(uint32_t count) const {
+  auto total = static_cast<uint64_t>(m_buffer.size()) + count;
+  return static_cast<uint32_t>((total << 32) / m_step) + 1;
+}
+
+uint32_t Resampler::Process(const float *input, uint32_t count, float *output) {
+  m_buffer.insert(m_buffer.end(), input, input + count);
+  auto produced =
+      m_kernel(m_buffer.data(), static_cast<uint32_t>(m_buffer.size()),
+               m_coefficients.data(), m_taps, m_position, m_step, output);
+
+  //已经不会再用到的输入移出缓冲，只保留位置的小数部分
+  auto consumed = std::min<uint64_t>(m_position >> 32, m_buffer.size());
+  m_buffer.erase(m_buffer.begin(), m_buffer.begin() + consumed);
+  m_position -= consumed << 32;
+  return produced;
+}
+
+void Resampler::Clear() {
+  m_buffer.clear();
+  m_position = 0;
+}
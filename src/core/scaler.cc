@@ -0,0 +1,519 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <scaler.hh>
+#include <spdlog/spdlog.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCALER_HAS_X86 1
+#endif
+
+//向量参数只出现在强制内联的函数中，最终都内联进带 target 的入口函数，
+//不存在跨函数传递向量的 ABI 问题
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+namespace {
+
+//扩展缓冲区四周的像素数，xBR 需要 5x5 的邻居
+constexpr int PADDING = 2;
+constexpr ptrdiff_t STRIDE = NES_FRAME_WIDTH + PADDING * 2;
+constexpr uint32_t PADDED_HEIGHT = NES_FRAME_HEIGHT + PADDING * 2;
+
+// xBR 中 YUV 距离小于这个值认为是相同的颜色
+constexpr int32_t XBR_EQUAL_THRESHOLD = 155;
+
+using Kernel = void (*)(const uint32_t *source, const uint32_t *yuv,
+                        uint32_t *output);
+
+uint32_t *PaddedLine(uint32_t *buffer, int line) {
+  return buffer + (line + PADDING) * STRIDE + PADDING;
+}
+
+//打包为 0x00YYUUVV
+uint32_t ToYuv(uint32_t rgba) {
+  int red = rgba & 0xFF;
+  int green = (rgba >> 8) & 0xFF;
+  int blue = (rgba >> 16) & 0xFF;
+  int y = (299 * red + 587 * green + 114 * blue) / 1000;
+  int u = (-169 * red - 331 * green + 500 * blue) / 1000 + 128;
+  int v = (500 * red - 419 * green - 81 * blue) / 1000 + 128;
+  return static_cast<uint32_t>((y << 16) | (u << 8) | v);
+}
+
+/*
+ * GCC 向量扩展，N 个 32 位像素
+ * 算法只写一次，在不同 target 的入口函数中按 8 或 4 个像素实例化，
+ * 由编译器生成 AVX2、SSE4.1 或者平台默认的指令。
+ */
+template <uint32_t N> struct Lanes {
+  typedef uint32_t Vec __attribute__((vector_size(N * 4)));
+  typedef int32_t Mask __attribute__((vector_size(N * 4)));
+  typedef uint8_t Bytes __attribute__((vector_size(N * 4)));
+};
+template <uint32_t N> using Vec = typename Lanes<N>::Vec;
+template <uint32_t N> using Mask = typename Lanes<N>::Mask;
+template <uint32_t N> using Bytes = typename Lanes<N>::Bytes;
+
+template <uint32_t N>
+[[gnu::always_inline]] inline Vec<N> Load(const uint32_t *pixels) {
+  Vec<N> result;
+  std::memcpy(&result, pixels, sizeof(result));
+  return result;
+}
+
+template <uint32_t N>
+[[gnu::always_inline]] inline Vec<N> Splat(uint32_t value) {
+  return Vec<N>{} + value;
+}
+
+//交错写入 a0 b0 a1 b1 ...
+template <uint32_t N>
+[[gnu::always_inline]] inline void Store2(uint32_t *output, const Vec<N> &a,
+                                          const Vec<N> &b) {
+  static_assert(N == 4 || N == 8);
+  Vec<N> low, high;
+  if constexpr (N == 8) {
+    low = __builtin_shuffle(a, b, Mask<N>{0, 8, 1, 9, 2, 10, 3, 11});
+    high = __builtin_shuffle(a, b, Mask<N>{4, 12, 5, 13, 6, 14, 7, 15});
+  } else {
+    low = __builtin_shuffle(a, b, Mask<N>{0, 4, 1, 5});
+    high = __builtin_shuffle(a, b, Mask<N>{2, 6, 3, 7});
+  }
+  std::memcpy(output, &low, sizeof(low));
+  std::memcpy(output + N, &high, sizeof(high));
+}
+
+//交错写入 a0 b0 c0 a1 b1 c1 ...，先交错 a 和 b，再填入 c
+template <uint32_t N>
+[[gnu::always_inline]] inline void Store3(uint32_t *output, const Vec<N> &a,
+                                          const Vec<N> &b, const Vec<N> &c) {
+  static_assert(N == 4 || N == 8);
+  Vec<N> out[3];
+  if constexpr (N == 8) {
+    out[0] = __builtin_shuffle(
+        __builtin_shuffle(a, b, Mask<N>{0, 8, 0, 1, 9, 0, 2, 10}), c,
+        Mask<N>{0, 1, 8, 3, 4, 9, 6, 7});
+    out[1] = __builtin_shuffle(
+        __builtin_shuffle(a, b, Mask<N>{0, 3, 11, 0, 4, 12, 0, 5}), c,
+        Mask<N>{10, 1, 2, 11, 4, 5, 12, 7});
+    out[2] = __builtin_shuffle(
+        __builtin_shuffle(a, b, Mask<N>{13, 0, 6, 14, 0, 7, 15, 0}), c,
+        Mask<N>{0, 13, 2, 3, 14, 5, 6, 15});
+  } else {
+    out[0] = __builtin_shuffle(__builtin_shuffle(a, b, Mask<N>{0, 4, 0, 1}),
+                               c, Mask<N>{0, 1, 4, 3});
+    out[1] = __builtin_shuffle(__builtin_shuffle(a, b, Mask<N>{5, 0, 2, 6}),
+                               c, Mask<N>{0, 5, 2, 3});
+    out[2] = __builtin_shuffle(__builtin_shuffle(a, b, Mask<N>{0, 3, 7, 0}),
+                               c, Mask<N>{6, 1, 2, 7});
+  }
+  std::memcpy(output, out, sizeof(out));
+}
+
+template <uint32_t N>
+[[gnu::always_inline]] inline void
+CopyLine(const uint32_t *source, const uint32_t *, uint32_t *output) {
+  std::memcpy(output, source, NES_FRAME_WIDTH * sizeof(uint32_t));
+}
+
+// AdvMAME2x
+template <uint32_t N>
+[[gnu::always_inline]] inline void Scale2xLine(const uint32_t *source,
+                                               const uint32_t *,
+                                               uint32_t *output) {
+  auto *output1 = output + NES_FRAME_WIDTH * 2;
+  for (uint32_t x = 0; x < NES_FRAME_WIDTH; x += N) {
+    auto *center = source + x;
+    auto b = Load<N>(center - STRIDE);
+    auto d = Load<N>(center - 1);
+    auto e = Load<N>(center);
+    auto f = Load<N>(center + 1);
+    auto h = Load<N>(center + STRIDE);
+
+    auto active = (b != h) & (d != f);
+    Vec<N> e0 = (active & (d == b)) ? d : e;
+    Vec<N> e1 = (active & (b == f)) ? f : e;
+    Vec<N> e2 = (active & (d == h)) ? d : e;
+    Vec<N> e3 = (active & (h == f)) ? f : e;
+
+    Store2<N>(output + x * 2, e0, e1);
+    Store2<N>(output1 + x * 2, e2, e3);
+  }
+}
+
+// AdvMAME3x
+template <uint32_t N>
+[[gnu::always_inline]] inline void Scale3xLine(const uint32_t *source,
+                                               const uint32_t *,
+                                               uint32_t *output) {
+  auto *output1 = output + NES_FRAME_WIDTH * 3;
+  auto *output2 = output1 + NES_FRAME_WIDTH * 3;
+  for (uint32_t x = 0; x < NES_FRAME_WIDTH; x += N) {
+    auto *center = source + x;
+    auto a = Load<N>(center - STRIDE - 1);
+    auto b = Load<N>(center - STRIDE);
+    auto c = Load<N>(center - STRIDE + 1);
+    auto d = Load<N>(center - 1);
+    auto e = Load<N>(center);
+    auto f = Load<N>(center + 1);
+    auto g = Load<N>(center + STRIDE - 1);
+    auto h = Load<N>(center + STRIDE);
+    auto i = Load<N>(center + STRIDE + 1);
+
+    auto active = (b != h) & (d != f);
+    auto db = active & (d == b);
+    auto bf = active & (b == f);
+    auto dh = active & (d == h);
+    auto hf = active & (h == f);
+
+    Vec<N> e0 = db ? d : e;
+    Vec<N> e1 = ((db & (e != c)) | (bf & (e != a))) ? b : e;
+    Vec<N> e2 = bf ? f : e;
+    Vec<N> e3 = ((db & (e != g)) | (dh & (e != a))) ? d : e;
+    Vec<N> e5 = ((bf & (e != i)) | (hf & (e != c))) ? f : e;
+    Vec<N> e6 = dh ? d : e;
+    Vec<N> e7 = ((dh & (e != i)) | (hf & (e != g))) ? h : e;
+    Vec<N> e8 = hf ? f : e;
+
+    Store3<N>(output + x * 3, e0, e1, e2);
+    Store3<N>(output1 + x * 3, e3, e, e5);
+    Store3<N>(output2 + x * 3, e6, e7, e8);
+  }
+}
+
+constexpr ptrdiff_t Offset(ptrdiff_t dx, ptrdiff_t dy) {
+  return dy * STRIDE + dx;
+}
+
+template <uint32_t N> struct XbrPixel {
+  Vec<N> rgba;
+  Vec<N> yuv;
+};
+
+template <uint32_t N>
+[[gnu::always_inline]] inline XbrPixel<N>
+LoadXbrPixel(const uint32_t *source, const uint32_t *yuv, ptrdiff_t offset) {
+  return {Load<N>(source + offset), Load<N>(yuv + offset)};
+}
+
+// YUV 三个分量差的绝对值之和，先按字节求差再把三个字节相加
+template <uint32_t N>
+[[gnu::always_inline]] inline Mask<N> Distance(const XbrPixel<N> &a,
+                                               const XbrPixel<N> &b) {
+  auto x = reinterpret_cast<Bytes<N>>(a.yuv);
+  auto y = reinterpret_cast<Bytes<N>>(b.yuv);
+  Bytes<N> high = x > y ? x : y;
+  Bytes<N> low = x > y ? y : x;
+  auto delta = reinterpret_cast<Mask<N>>(high - low);
+  return (delta & 0xFF) + ((delta >> 8) & 0xFF) + (delta >> 16);
+}
+
+template <uint32_t N>
+[[gnu::always_inline]] inline Mask<N> Similar(const XbrPixel<N> &a,
+                                              const XbrPixel<N> &b) {
+  return Distance<N>(a, b) < XBR_EQUAL_THRESHOLD;
+}
+
+// dst 向 src 混合 weight/8，R G B A 四个通道分两组计算
+template <uint32_t N>
+[[gnu::always_inline]] inline Vec<N> Blend(const Vec<N> &dst, const Vec<N> &src,
+                                           const Vec<N> &weight) {
+  auto inverse = 8 - weight;
+  Vec<N> low =
+      ((dst & 0x00FF00FF) * inverse + (src & 0x00FF00FF) * weight) >> 3;
+  Vec<N> high = (((dst >> 8) & 0x00FF00FF) * inverse +
+                 ((src >> 8) & 0x00FF00FF) * weight) >>
+                3;
+  return (low & 0x00FF00FF) | ((high & 0x00FF00FF) << 8);
+}
+
+/*
+ * xBR 处理输出 2x2 中的一个角，参数按 pi 所在的角旋转
+ *      .  .  .
+ *   .  pa pb pc .
+ *   .  pd pe pf f4
+ *   .  pg ph pi i4
+ *      .  h5 i5
+ * n3 为 pi 方向的输出像素，n1 n2 为和它相邻的两个。
+ * 每个条件算出一个掩码，最后按掩码得到每个输出像素的混合比例，
+ * 不需要混合的像素比例为 0，不会改变。
+ */
+template <uint32_t N>
+[[gnu::always_inline]] inline void
+XbrCorner(const XbrPixel<N> &pe, const XbrPixel<N> &pi, const XbrPixel<N> &ph,
+          const XbrPixel<N> &pf, const XbrPixel<N> &pg, const XbrPixel<N> &pc,
+          const XbrPixel<N> &pd, const XbrPixel<N> &pb, const XbrPixel<N> &f4,
+          const XbrPixel<N> &i4, const XbrPixel<N> &h5, const XbrPixel<N> &i5,
+          Vec<N> &n1, Vec<N> &n2, Vec<N> &n3) {
+  auto edge = (pe.rgba != ph.rgba) & (pe.rgba != pf.rgba);
+
+  //沿 e-i 方向和垂直方向的梯度，e 小于 i 时存在穿过 pe pi 之间的边缘
+  auto distanceEI = Distance<N>(pe, pi);
+  auto weightE = Distance<N>(pe, pc) + Distance<N>(pe, pg) +
+                 Distance<N>(pi, h5) + Distance<N>(pi, f4) +
+                 (Distance<N>(ph, pf) << 2);
+  auto weightI = Distance<N>(ph, pd) + Distance<N>(ph, i5) +
+                 Distance<N>(pf, i4) + Distance<N>(pf, pb) + (distanceEI << 2);
+  auto blend = edge & (weightE <= weightI);
+
+  Vec<N> px = (Distance<N>(pe, pf) <= Distance<N>(pe, ph)) ? pf.rgba : ph.rgba;
+
+  auto similarEI = distanceEI < XBR_EQUAL_THRESHOLD;
+  auto sharp = blend & (weightE < weightI) &
+               ((~Similar<N>(pf, pb) & ~Similar<N>(ph, pd)) |
+                (similarEI & (~Similar<N>(pf, i4) | ~Similar<N>(ph, i5))) |
+                Similar<N>(pe, pg) | Similar<N>(pe, pc));
+
+  //边缘接近水平或垂直时，把混合扩展到相邻的输出像素
+  auto ke = Distance<N>(pf, pg);
+  auto ki = Distance<N>(ph, pc);
+  auto left = sharp & ((ke << 1) <= ki) & (pe.rgba != pg.rgba) &
+              (pd.rgba != pg.rgba);
+  auto up = sharp & (ke >= (ki << 1)) & (pe.rgba != pc.rgba) &
+            (pb.rgba != pc.rgba);
+
+  Vec<N> none{};
+  Vec<N> sideWeight = (left | up) ? Splat<N>(6) : Splat<N>(4);
+  Vec<N> weight3 = blend ? ((left & up) ? Splat<N>(7) : sideWeight) : none;
+  Vec<N> weight2 = left ? Splat<N>(2) : none;
+  Vec<N> weight1 = up ? Splat<N>(2) : none;
+
+  //两个方向同时成立时 n1 取 n2 混合后的结果
+  Vec<N> base1 = (left & up) ? n2 : n1;
+  n3 = Blend<N>(n3, px, weight3);
+  n1 = Blend<N>(base1, px, weight1);
+  n2 = Blend<N>(n2, px, weight2);
+}
+
+// Hyllian 的 xBR 2x，比较和混合规则与 ffmpeg 的 xbr 滤镜相同
+template <uint32_t N>
+[[gnu::always_inline]] inline void Xbr2xLine(const uint32_t *source,
+                                             const uint32_t *yuv,
+                                             uint32_t *output) {
+  auto *output1 = output + NES_FRAME_WIDTH * 2;
+  for (uint32_t x = 0; x < NES_FRAME_WIDTH; x += N) {
+    auto *center = source + x;
+    auto *centerYuv = yuv + x;
+    //不用 lambda，避免没有内联时按默认指令集的 ABI 传递向量
+    auto a1 = LoadXbrPixel<N>(center, centerYuv, Offset(-1, -2));
+    auto b1 = LoadXbrPixel<N>(center, centerYuv, Offset(0, -2));
+    auto c1 = LoadXbrPixel<N>(center, centerYuv, Offset(1, -2));
+    auto a0 = LoadXbrPixel<N>(center, centerYuv, Offset(-2, -1));
+    auto pa = LoadXbrPixel<N>(center, centerYuv, Offset(-1, -1));
+    auto pb = LoadXbrPixel<N>(center, centerYuv, Offset(0, -1));
+    auto pc = LoadXbrPixel<N>(center, centerYuv, Offset(1, -1));
+    auto c4 = LoadXbrPixel<N>(center, centerYuv, Offset(2, -1));
+    auto d0 = LoadXbrPixel<N>(center, centerYuv, Offset(-2, 0));
+    auto pd = LoadXbrPixel<N>(center, centerYuv, Offset(-1, 0));
+    auto pe = LoadXbrPixel<N>(center, centerYuv, Offset(0, 0));
+    auto pf = LoadXbrPixel<N>(center, centerYuv, Offset(1, 0));
+    auto f4 = LoadXbrPixel<N>(center, centerYuv, Offset(2, 0));
+    auto g0 = LoadXbrPixel<N>(center, centerYuv, Offset(-2, 1));
+    auto pg = LoadXbrPixel<N>(center, centerYuv, Offset(-1, 1));
+    auto ph = LoadXbrPixel<N>(center, centerYuv, Offset(0, 1));
+    auto pi = LoadXbrPixel<N>(center, centerYuv, Offset(1, 1));
+    auto i4 = LoadXbrPixel<N>(center, centerYuv, Offset(2, 1));
+    auto g5 = LoadXbrPixel<N>(center, centerYuv, Offset(-1, 2));
+    auto h5 = LoadXbrPixel<N>(center, centerYuv, Offset(0, 2));
+    auto i5 = LoadXbrPixel<N>(center, centerYuv, Offset(1, 2));
+
+    // e0 e1 为上面一行的两个输出像素，e2 e3 为下面一行
+    Vec<N> e0 = pe.rgba, e1 = pe.rgba, e2 = pe.rgba, e3 = pe.rgba;
+    XbrCorner<N>(pe, pi, ph, pf, pg, pc, pd, pb, f4, i4, h5, i5, e1, e2, e3);
+    XbrCorner<N>(pe, pc, pf, pb, pi, pa, ph, pd, b1, c1, f4, c4, e0, e3, e1);
+    XbrCorner<N>(pe, pa, pb, pd, pc, pg, pf, ph, d0, a0, b1, a1, e2, e1, e0);
+    XbrCorner<N>(pe, pg, pd, ph, pa, pi, pb, pf, h5, g5, d0, g0, e3, e0, e2);
+
+    Store2<N>(output + x * 2, e0, e1);
+    Store2<N>(output1 + x * 2, e2, e3);
+  }
+}
+
+//每种算法在不同指令集下的入口
+struct KernelSet {
+  Kernel avx2;
+  Kernel sse41;
+  Kernel portable;
+};
+
+#ifdef SCALER_HAS_X86
+#define SCALER_KERNELS(name)                                                   \
+  __attribute__((target("avx2"))) void name##Avx2(                             \
+      const uint32_t *source, const uint32_t *yuv, uint32_t *output) {         \
+    name##Line<8>(source, yuv, output);                                        \
+  }                                                                            \
+  __attribute__((target("sse4.1"))) void name##Sse41(                          \
+      const uint32_t *source, const uint32_t *yuv, uint32_t *output) {         \
+    name##Line<4>(source, yuv, output);                                        \
+  }                                                                            \
+  void name##Portable(const uint32_t *source, const uint32_t *yuv,             \
+                      uint32_t *output) {                                      \
+    name##Line<4>(source, yuv, output);                                        \
+  }                                                                            \
+  constexpr KernelSet name##Kernels = {name##Avx2, name##Sse41, name##Portable};
+#else
+#define SCALER_KERNELS(name)                                                   \
+  void name##Portable(const uint32_t *source, const uint32_t *yuv,             \
+                      uint32_t *output) {                                      \
+    name##Line<4>(source, yuv, output);                                        \
+  }                                                                            \
+  constexpr KernelSet name##Kernels = {nullptr, nullptr, name##Portable};
+#endif
+
+SCALER_KERNELS(Copy)
+SCALER_KERNELS(Scale2x)
+SCALER_KERNELS(Scale3x)
+SCALER_KERNELS(Xbr2x)
+
+#undef SCALER_KERNELS
+
+const KernelSet &Kernels(ScaleFilter filter) {
+  switch (filter) {
+  case ScaleFilter::Scale2x:
+    return Scale2xKernels;
+  case ScaleFilter::Scale3x:
+    return Scale3xKernels;
+  case ScaleFilter::Xbr2x:
+    return Xbr2xKernels;
+  default:
+    return CopyKernels;
+  }
+}
+
+//输出像素依赖的源画面半径
+uint32_t Radius(ScaleFilter filter) {
+  switch (filter) {
+  case ScaleFilter::Scale2x:
+  case ScaleFilter::Scale3x:
+    return 1;
+  case ScaleFilter::Xbr2x:
+    return 2;
+  default:
+    return 0;
+  }
+}
+
+} // namespace
+
+uint32_t ScaleFactor(ScaleFilter filter) {
+  switch (filter) {
+  case ScaleFilter::Scale2x:
+  case ScaleFilter::Xbr2x:
+    return 2;
+  case ScaleFilter::Scale3x:
+    return 3;
+  default:
+    return 1;
+  }
+}
+
+PixelScaler::PixelScaler(WorkerPool &workerPool, ScaleFilter filter)
+    : m_workerPool(workerPool), m_filter(filter),
+      m_source(STRIDE * PADDED_HEIGHT) {
+  if (m_filter == ScaleFilter::Xbr2x) {
+    m_yuv.resize(STRIDE * PADDED_HEIGHT);
+  }
+
+  const auto &kernels = Kernels(m_filter);
+  const char *isa = "portable";
+  m_kernel = kernels.portable;
+#ifdef SCALER_HAS_X86
+  if (__builtin_cpu_supports("avx2")) {
+    m_kernel = kernels.avx2;
+    isa = "avx2";
+  } else if (__builtin_cpu_supports("sse4.1")) {
+    m_kernel = kernels.sse41;
+    isa = "sse4.1";
+  }
+#endif
+  spdlog::info("pixel scaler {}x using {} on {} threads", Factor(), isa,
+               m_workerPool.ThreadCount());
+}
+
+void PixelScaler::UpdateSource(const uint32_t *source,
+                               std::span<const LineRange> ranges) {
+  //把扩展后的一整行复制到上下扩展的行
+  auto copyRow = [](std::vector<uint32_t> &buffer, int from, int to) {
+    std::memcpy(PaddedLine(buffer.data(), to) - PADDING,
+                PaddedLine(buffer.data(), from) - PADDING,
+                STRIDE * sizeof(uint32_t));
+  };
+
+  for (auto range : ranges) {
+    for (auto line = range.first; line < range.first + range.count; line++) {
+      auto row = static_cast<int>(line);
+      auto *pixels = PaddedLine(m_source.data(), row);
+      std::memcpy(pixels, source + line * NES_FRAME_WIDTH,
+                  NES_FRAME_WIDTH * sizeof(uint32_t));
+      for (int i = 1; i <= PADDING; i++) {
+        pixels[-i] = pixels[0];
+        pixels[NES_FRAME_WIDTH - 1 + i] = pixels[NES_FRAME_WIDTH - 1];
+      }
+
+      if (!m_yuv.empty()) {
+        auto *yuv = PaddedLine(m_yuv.data(), row) - PADDING;
+        for (ptrdiff_t x = 0; x < STRIDE; x++) {
+          yuv[x] = ToYuv(pixels[x - PADDING]);
+        }
+      }
+
+      for (int i = 1; i <= PADDING; i++) {
+        int to = -1;
+        if (line == 0) {
+          to = -i;
+        } else if (line == NES_FRAME_HEIGHT - 1) {
+          to = NES_FRAME_HEIGHT - 1 + i;
+        }
+        if (to != -1) {
+          copyRow(m_source, row, to);
+          if (!m_yuv.empty()) {
+            copyRow(m_yuv, row, to);
+          }
+        }
+      }
+    }
+  }
+}
+
+void PixelScaler::Scale(const uint32_t *source, std::vector<LineRange> &ranges,
+                        uint32_t *output) {
+  UpdateSource(source, ranges);
+
+  //变化的行向两边扩展 radius 后就是需要重新计算的行，ranges 按顺序排列
+  auto radius = Radius(m_filter);
+  m_lines.clear();
+  uint32_t next = 0;
+  for (auto range : ranges) {
+    auto first = range.first > radius ? range.first - radius : 0;
+    auto end = std::min(range.first + range.count + radius, NES_FRAME_HEIGHT);
+    for (auto line = std::max(first, next); line < end; line++) {
+      m_lines.push_back(line);
+    }
+    next = std::max(next, end);
+  }
+
+  auto factor = Factor();
+  ranges.clear();
+  for (auto line : m_lines) {
+    if (!ranges.empty() &&
+        ranges.back().first + ranges.back().count == line * factor) {
+      ranges.back().count += factor;
+    } else {
+      ranges.push_back(LineRange{.first = line * factor, .count = factor});
+    }
+  }
+
+  auto outputLine = static_cast<size_t>(OutputWidth()) * factor;
+  m_workerPool.ParallelFor(
+      static_cast<uint32_t>(m_lines.size()),
+      [this, output, outputLine](uint32_t begin, uint32_t end) {
+        for (auto i = begin; i < end; i++) {
+          auto line = static_cast<int>(m_lines[i]);
+          const uint32_t *yuv =
+              m_yuv.empty() ? nullptr : PaddedLine(m_yuv.data(), line);
+          m_kernel(PaddedLine(m_source.data(), line), yuv,
+                   output + m_lines[i] * outputLine);
+        }
+      },
+      8);
+}
@@ -0,0 +1,170 @@
+#include <algorithm>
+#include <capture.hh>
+#include <cmath>
+#include <system.hh>
+
+void System::Start(std::chrono::steady_clock::time_point startTime) {
+  if (m_running.exchange(true)) {
+    return;
+  }
+  m_thread = std::thread(&System::EmulationLoop, this, startTime);
+}
+
+void System::Stop() {
+  {
+    std::lock_guard lock(m_pauseMutex);
+    m_running = false;
+  }
+  m_pauseCondition.notify_all();
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+}
+
+void System::StepFrame() {
+  RunFrame(m_frames.WriteBuffer());
+  m_frames.Publish();
+}
+
+void System::SetPpuThreads(uint32_t threads) {
+  m_ppu.SetParallelRendering(nullptr);
+  m_ppuWorkerPool.reset();
+  if (threads < 2) {
+    return;
+  }
+  m_ppuWorkerPool = std::make_unique<WorkerPool>(threads);
+  m_ppu.SetParallelRendering(m_ppuWorkerPool.get());
+}
+
+void System::SetPaused(bool paused) {
+  {
+    std::lock_guard lock(m_pauseMutex);
+    m_paused = paused;
+  }
+  m_pauseCondition.notify_all();
+}
+
+bool System::Paused() {
+  std::lock_guard lock(m_pauseMutex);
+  return m_paused;
+}
+
+bool System::WaitWhilePaused() {
+  std::unique_lock lock(m_pauseMutex);
+  if (!m_paused) {
+    return false;
+  }
+  m_pauseCondition.wait(lock, [this] { return !m_paused || !m_running; });
+  return true;
+}
+
+void System::EmulationLoop(std::chrono::steady_clock::time_point startTime) {
+  using Duration = std::chrono::steady_clock::duration;
+  const std::chrono::duration<double> nesFramePeriod{1.0 / NES_FRAME_RATE};
+  const auto maxBehind = nesFramePeriod * MAX_FRAMES_BEHIND;
+  auto framePeriod = nesFramePeriod;
+  uint64_t frames = 0;
+
+  while (m_running) {
+    if (WaitWhilePaused()) {
+      startTime = std::chrono::steady_clock::now();
+      frames = 0;
+      if (!m_running) {
+        break;
+      }
+    }
+
+    RunFrame(m_frames.WriteBuffer());
+    m_frames.Publish();
+    if (m_frameCallback && m_displayVisible) {
+      m_frameCallback();
+    }
+    AdjustAudioRate();
+
+    frames++;
+    auto deadline =
+        startTime + std::chrono::duration_cast<Duration>(framePeriod * frames);
+    if (auto vsync = DisplayVsync()) {
+      //从最近一次显示的时间按测得的周期数到离原定时间最近的 vblank，
+      //每帧都重新对齐，刷新率的误差和唤醒的延迟不会累积
+      auto vsyncs = std::llround((deadline - vsync->time) / vsync->period);
+      startTime = vsync->time;
+      frames = static_cast<uint64_t>(std::max(1LL, vsyncs));
+      framePeriod = vsync->period;
+      deadline =
+          startTime + std::chrono::duration_cast<Duration>(framePeriod * frames);
+    } else if (framePeriod != nesFramePeriod) {
+      //测量结果不能用时从这一帧开始按 NES 的帧率继续
+      startTime = deadline;
+      frames = 0;
+      framePeriod = nesFramePeriod;
+    }
+
+    //被调试器暂停或者系统繁忙时不追赶，避免之后连续快进
+    auto now = std::chrono::steady_clock::now();
+    if (now - deadline > maxBehind) {
+      startTime = now;
+      frames = 0;
+      continue;
+    }
+    //画面经过三缓冲，声音经过环形缓冲，唤醒的误差不影响输出，不需要自旋
+    std::this_thread::sleep_until(deadline);
+  }
+}
+
+void System::RunFrame(Frame &frame) {
+  uint32_t cycles = 0;
+  for (uint32_t line = 0; line < PPU_SCANLINES_PER_FRAME; line++) {
+    auto lineEnd = static_cast<int>((line + 1) * PPU_DOTS_PER_SCANLINE);
+    m_dotBudget += PPU_DOTS_PER_SCANLINE;
+    while (m_dotBudget > 0) {
+      auto instructionCycles = m_cpu.Step();
+      cycles += instructionCycles;
+      m_dotBudget -= instructionCycles * 3;
+      // sprite 0 hit 和 overflow 在预测的 dot 设置，CPU 轮询 $2002 时
+      //不需要让 PPU 追赶
+      auto dot = static_cast<uint32_t>(lineEnd - m_dotBudget);
+      if (dot >= m_ppu.NextEventDot()) {
+        m_ppu.RunEvents(dot);
+      }
+    }
+    m_ppu.RunScanline(line, frame);
+  }
+  m_apu.EndFrame(cycles);
+  DrainAudio();
+  frame.number = ++m_frameNumber;
+  frame.UpdateHashes();
+  if (m_capture != nullptr) {
+    m_capture->Submit(frame);
+  }
+}
+
+void System::DrainAudio() {
+  std::array<int16_t, 1024> samples;
+  while (m_apu.SamplesAvailable() > 0) {
+    auto count = m_apu.ReadSamples(samples.data(), samples.size());
+    m_audio.Write(samples.data(), count);
+  }
+}
+
+void System::AdjustAudioRate() {
+  //缓冲低于目标时多产生采样，高于目标时少产生
+  auto fill = static_cast<double>(m_audio.Size());
+  auto error = std::clamp((AUDIO_TARGET_SAMPLES - fill) / AUDIO_TARGET_SAMPLES,
+                          -1.0, 1.0);
+  m_apu.SetSampleRateScale(1 + error * MAX_AUDIO_RATE_ADJUST);
+}
+
+std::optional<System::VsyncTiming> System::DisplayVsync() {
+  if (!m_vsyncSource) {
+    return std::nullopt;
+  }
+  auto vsync = m_vsyncSource();
+  //刷新率和 NES 相差太大时，动态采样率补偿不了，按 NES 的帧率运行
+  if (!vsync ||
+      std::abs(vsync->period.count() * NES_FRAME_RATE - 1) >=
+          MAX_AUDIO_RATE_ADJUST) {
+    return std::nullopt;
+  }
+  return vsync;
+}
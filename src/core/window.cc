@@ -1,3 +1,4 @@
+#include <shaders.hh>
 #include <window.hh>
 
 // void VulkanWindow::run() {
@@ -13,20 +14,78 @@
 //   glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
 //   m_window = glfwCreateWindow(m_WIDTH, m_HEIGHT, "Vulkan", nullptr, nullptr);
 // }
+void VulkanWindow::setRenderConfig(const RenderConfig &config) {
+  m_config = config;
+  m_config.framesInFlight =
+      std::clamp<uint32_t>(m_config.framesInFlight, 1, MAX_FRAMES_IN_FLIGHT);
+  spdlog::info("render config: present mode {}, {} frames in flight",
+               vk::to_string(m_config.presentMode), m_config.framesInFlight);
+
+  if (m_config.ntsc || m_config.scaler != ScaleFilter::None) {
+    m_workerPool = std::make_unique<WorkerPool>();
+  }
+  if (m_config.ntsc) {
+    m_ntscFilter = std::make_unique<NtscFilter>(*m_workerPool);
+    spdlog::info("ntsc filter on {} threads", m_workerPool->ThreadCount());
+    if (m_config.scaler != ScaleFilter::None) {
+      spdlog::warn("pixel scaler is ignored when the ntsc filter is on");
+    }
+  } else if (m_config.scaler != ScaleFilter::None) {
+    m_pixelScaler = std::make_unique<PixelScaler>(*m_workerPool, m_config.scaler);
+    m_scalerSource.resize(NES_FRAME_WIDTH * NES_FRAME_HEIGHT);
+  }
+}
+
 void VulkanWindow::initVulkanOther(const VkSurfaceKHR &surface) {
+  m_initStartTime = std::chrono::steady_clock::now();
   setupDebugMessenger();
   createSurface(surface);
   pickPhysicalDevice();
   createLogicalDevice();
+  createAllocator();
+  createPipelineCache();
   createSwapChain();
   createImageViews();
   createRenderPass();
+  createDescriptorSetLayout();
+  createGraphicsPipeline();
+  createFramebuffers();
+  createCommandPool();
+  createFrameImage();
+  createSamplers();
+  createDescriptorSet();
+  createFrameStagingBuffers();
+  createCommandBuffers();
+  createSyncObjects();
+}
+
+void VulkanWindow::initOffscreen(uint32_t width, uint32_t height) {
+  m_initStartTime = std::chrono::steady_clock::now();
+  m_offscreen = true;
+  //每帧同步等待读回，不需要多个 frame in flight
+  m_config.framesInFlight = 1;
+  m_swapChainExtent = vk::Extent2D{width, height};
+  m_swapChainImageFormat = vk::Format::eR8G8B8A8Unorm;
+
+  setupDebugMessenger();
+  pickPhysicalDevice();
+  createLogicalDevice();
+  createAllocator();
+  createPipelineCache();
+  createOffscreenTarget();
+  createRenderPass();
+  createDescriptorSetLayout();
   createGraphicsPipeline();
   createFramebuffers();
   createCommandPool();
-  createVertexBuffer();
+  createFrameImage();
+  createSamplers();
+  createDescriptorSet();
+  createFrameStagingBuffers();
   createCommandBuffers();
   createSyncObjects();
+  spdlog::info("offscreen {}x{} on {}", width, height,
+               m_deviceProperties.deviceName);
 }
 
 void VulkanWindow::createInstance() {
@@ -39,7 +98,7 @@ void VulkanWindow::createInstance() {
                               .applicationVersion = VK_MAKE_VERSION(1, 1, 0),
                               .pEngineName = "No Engine",
                               .engineVersion = VK_MAKE_VERSION(1, 1, 0),
-                              .apiVersion = VK_API_VERSION_1_1};
+                              .apiVersion = VK_API_VERSION_1_2};
 
   vk::InstanceCreateInfo createInfo{.pApplicationInfo = &appInfo};
 
@@ -50,6 +109,14 @@ void VulkanWindow::createInstance() {
     extensions.push_back(deviceExtensions.c_str());
   }
 
+  //离屏模式没有 Qt 提供的扩展列表，debug messenger 需要的扩展自己加上
+  if (m_enableValidationLayers &&
+      std::find(m_instanceExtensions.begin(), m_instanceExtensions.end(),
+                VK_EXT_DEBUG_UTILS_EXTENSION_NAME) ==
+          m_instanceExtensions.end()) {
+    extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+  }
+
   createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
   createInfo.ppEnabledExtensionNames = extensions.data();
 
@@ -112,11 +179,30 @@ void VulkanWindow::pickPhysicalDevice() {
     throw std::runtime_error("failed to find GPUs with Vulkan support!");
   }
 
-  for (auto &device : devices) {
-    if (isDeviceSuitable(*device)) {
+  //独显优先，其次是集显，lavapipe 之类的 CPU 实现只作为最后的选择
+  auto rank = [](vk::PhysicalDeviceType type) {
+    switch (type) {
+    case vk::PhysicalDeviceType::eDiscreteGpu:
+      return 4;
+    case vk::PhysicalDeviceType::eIntegratedGpu:
+      return 3;
+    case vk::PhysicalDeviceType::eVirtualGpu:
+      return 2;
+    case vk::PhysicalDeviceType::eCpu:
+      return 1;
+    default:
+      return 0;
+    }
+  };
 
+  int bestRank = 0;
+  for (auto &device : devices) {
+    auto properties = device.getProperties();
+    auto deviceRank = rank(properties.deviceType);
+    if (deviceRank > bestRank && isDeviceSuitable(*device)) {
+      bestRank = deviceRank;
+      m_deviceProperties = properties;
       m_physicalDevice = std::move(device);
-      break;
     }
   }
 
@@ -143,14 +229,54 @@ void VulkanWindow::createLogicalDevice() {
 
   vk::PhysicalDeviceFeatures deviceFeatures{};
 
+  //离屏模式不需要 swapchain
+  std::vector<const char *> extensions;
+  if (!m_offscreen) {
+    extensions = m_deviceExtensions;
+  }
+
+  //present id/wait 只用于统计延迟，不支持时跳过
+  auto availableExtensions = m_physicalDevice.enumerateDeviceExtensionProperties();
+  auto hasExtension = [&availableExtensions](const char *name) {
+    return std::any_of(availableExtensions.begin(), availableExtensions.end(),
+                       [name](const vk::ExtensionProperties &extension) {
+                         return strcmp(extension.extensionName, name) == 0;
+                       });
+  };
+  m_presentWaitSupported =
+      !m_offscreen && std::all_of(m_presentWaitExtensions.begin(),
+                                  m_presentWaitExtensions.end(), hasExtension);
+  if (m_presentWaitSupported) {
+    auto features = m_physicalDevice.getFeatures2<
+        vk::PhysicalDeviceFeatures2, vk::PhysicalDevicePresentIdFeaturesKHR,
+        vk::PhysicalDevicePresentWaitFeaturesKHR>();
+    m_presentWaitSupported =
+        features.get<vk::PhysicalDevicePresentIdFeaturesKHR>().presentId &&
+        features.get<vk::PhysicalDevicePresentWaitFeaturesKHR>().presentWait;
+  }
+
+  vk::PhysicalDevicePresentIdFeaturesKHR presentIdFeatures{};
+  presentIdFeatures.presentId = VK_TRUE;
+  vk::PhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{};
+  presentWaitFeatures.presentWait = VK_TRUE;
+  if (m_presentWaitSupported) {
+    extensions.insert(extensions.end(), m_presentWaitExtensions.begin(),
+                      m_presentWaitExtensions.end());
+    presentIdFeatures.pNext = &presentWaitFeatures;
+  }
+  spdlog::info("present wait {}", m_presentWaitSupported ? "enabled"
+                                                         : "not supported");
+
   vk::DeviceCreateInfo createInfo{};
+  if (m_presentWaitSupported) {
+    createInfo.pNext = &presentIdFeatures;
+  }
   createInfo.pQueueCreateInfos = queueCreateInfos.data();
   createInfo.queueCreateInfoCount =
       static_cast<uint32_t>(queueCreateInfos.size());
   createInfo.pEnabledFeatures = &deviceFeatures;
-  createInfo.enabledExtensionCount =
-      static_cast<uint32_t>(m_deviceExtensions.size());
-  createInfo.ppEnabledExtensionNames = m_deviceExtensions.data();
+  createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+  createInfo.ppEnabledExtensionNames = extensions.data();
 
   if (m_enableValidationLayers) {
     createInfo.enabledLayerCount =
@@ -161,11 +287,19 @@ void VulkanWindow::createLogicalDevice() {
   }
 
   m_device = m_physicalDevice.createDevice(createInfo);
+  if (m_presentWaitSupported) {
+    m_latencyMonitor = std::make_unique<PresentLatencyMonitor>(m_device);
+  }
 
   m_graphicsQueue = m_device.getQueue(indices.graphicsFamily.value(), 0);
   m_presentQueue = m_device.getQueue(indices.presentFamily.value(), 0);
 }
 
+void VulkanWindow::createAllocator() {
+  m_allocator = std::make_unique<DeviceAllocator>(
+      m_device, m_physicalDevice.getMemoryProperties());
+}
+
 void VulkanWindow::createSwapChain() {
 
   SwapChainSupportDetails swapChainSupport =
@@ -209,7 +343,15 @@ void VulkanWindow::createSwapChain() {
   createInfo.clipped = VK_TRUE;
   createInfo.oldSwapchain = *m_swapChain;
 
+  //监控线程可能正在等待旧 swapchain 上的 present
+  if (m_latencyMonitor) {
+    m_latencyMonitor->stop();
+  }
+
   m_swapChain = m_device.createSwapchainKHR(createInfo);
+  if (m_latencyMonitor) {
+    m_latencyMonitor->start(*m_swapChain, vk::to_string(presentMode));
+  }
   m_swapChainImages = (*m_device).getSwapchainImagesKHR(*m_swapChain);
 
   m_swapChainImageFormat = surfaceFormat.format;
@@ -247,7 +389,10 @@ void VulkanWindow::createRenderPass() {
   colorAttachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
   colorAttachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
   colorAttachment.initialLayout = vk::ImageLayout::eUndefined;
-  colorAttachment.finalLayout = vk::ImageLayout::ePresentSrcKHR;
+  //离屏模式在 render pass 之后把结果拷贝到读回 buffer
+  colorAttachment.finalLayout = m_offscreen
+                                    ? vk::ImageLayout::eTransferSrcOptimal
+                                    : vk::ImageLayout::ePresentSrcKHR;
 
   vk::AttachmentReference colorAttachmentRef{};
   colorAttachmentRef.attachment = 0;
@@ -259,6 +404,17 @@ void VulkanWindow::createRenderPass() {
   dependency.dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
   dependency.dstAccessMask = vk::AccessFlagBits::eColorAttachmentWrite;
 
+  //读回的拷贝需要等待颜色写入和 layout 转换完成
+  vk::SubpassDependency readbackDependency{};
+  readbackDependency.srcSubpass = 0;
+  readbackDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+  readbackDependency.srcStageMask =
+      vk::PipelineStageFlagBits::eColorAttachmentOutput;
+  readbackDependency.srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite;
+  readbackDependency.dstStageMask = vk::PipelineStageFlagBits::eTransfer;
+  readbackDependency.dstAccessMask = vk::AccessFlagBits::eTransferRead;
+  vk::SubpassDependency dependencies[] = {dependency, readbackDependency};
+
   vk::SubpassDescription subpass{};
   subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
   subpass.colorAttachmentCount = 1;
@@ -269,19 +425,15 @@ void VulkanWindow::createRenderPass() {
   renderPassInfo.pAttachments = &colorAttachment;
   renderPassInfo.subpassCount = 1;
   renderPassInfo.pSubpasses = &subpass;
-  renderPassInfo.dependencyCount = 1;
-  renderPassInfo.pDependencies = &dependency;
+  renderPassInfo.dependencyCount = m_offscreen ? 2 : 1;
+  renderPassInfo.pDependencies = dependencies;
 
   m_renderPass = m_device.createRenderPass(renderPassInfo);
 }
 
 void VulkanWindow::createGraphicsPipeline() {
-  std::string homePath = std::getenv("HOME");
-
-  auto vertShaderCode = readFile(homePath + "/test/vert.spv");
-  auto fragShaderCode = readFile(homePath + "/test/frag.spv");
-  auto vertShaderModule = createShaderModule(vertShaderCode);
-  auto fragShaderModule = createShaderModule(fragShaderCode);
+  auto vertShaderModule = createShaderModule(shaders::presentVert);
+  auto fragShaderModule = createShaderModule(shaders::presentFrag);
 
   vk::PipelineShaderStageCreateInfo vertShaderStageInfo{};
   vertShaderStageInfo.stage = vk::ShaderStageFlagBits::eVertex;
@@ -296,37 +448,24 @@ void VulkanWindow::createGraphicsPipeline() {
   vk::PipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo,
                                                       fragShaderStageInfo};
 
+  //顶点在 shader 中由 gl_VertexIndex 生成
   vk::PipelineVertexInputStateCreateInfo vertexInputInfo{};
-  auto bindingDescription = Vertex::getBindingDescription();
-  auto attributeDescription = Vertex::getAttributeDescriptions();
-  vertexInputInfo.setVertexBindingDescriptions(bindingDescription);
-  vertexInputInfo.setVertexAttributeDescriptions(attributeDescription);
 
   vk::PipelineInputAssemblyStateCreateInfo inputAssembly{};
   inputAssembly.topology = vk::PrimitiveTopology::eTriangleList;
   inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-  vk::Viewport viewport{};
-  viewport.x = 0.0f;
-  viewport.y = 0.0f;
-  viewport.width = (float)m_swapChainExtent.width;
-  viewport.height = (float)m_swapChainExtent.height;
-  viewport.minDepth = 0.0f;
-  viewport.maxDepth = 1.0f;
-
-  vk::Rect2D scissor{.offset = {0, 0}, .extent = m_swapChainExtent};
+  // viewport 和 scissor 在 recordCommandBuffer 中设置，这里只需要数量
   vk::PipelineViewportStateCreateInfo viewportState{};
   viewportState.viewportCount = 1;
-  viewportState.pViewports = &viewport;
   viewportState.scissorCount = 1;
-  viewportState.pScissors = &scissor;
 
   vk::PipelineRasterizationStateCreateInfo rasterizer{};
   rasterizer.depthClampEnable = VK_FALSE;
   rasterizer.rasterizerDiscardEnable = VK_FALSE;
   rasterizer.polygonMode = vk::PolygonMode::eFill;
   rasterizer.lineWidth = 1.0f;
-  rasterizer.cullMode = vk::CullModeFlagBits::eBack;
+  rasterizer.cullMode = vk::CullModeFlagBits::eNone;
   rasterizer.frontFace = vk::FrontFace::eClockwise;
   rasterizer.depthBiasEnable = VK_FALSE;
   rasterizer.depthBiasConstantFactor = 0.0f; // Optional
@@ -365,10 +504,13 @@ void VulkanWindow::createGraphicsPipeline() {
 
   std::vector<vk::DynamicState> dynamicStates = {
       vk::DynamicState::eViewport,
-      vk::DynamicState::eLineWidth,
+      vk::DynamicState::eScissor,
   };
+  vk::PipelineDynamicStateCreateInfo dynamicState{};
+  dynamicState.setDynamicStates(dynamicStates);
 
   vk::PipelineLayoutCreateInfo pipelineLayoutInfo{};
+  pipelineLayoutInfo.setSetLayouts(*m_descriptorSetLayout);
 
   m_pipelineLayout = m_device.createPipelineLayout(pipelineLayoutInfo);
 
@@ -382,7 +524,7 @@ void VulkanWindow::createGraphicsPipeline() {
   pipelineInfo.pMultisampleState = &multisampling;
   pipelineInfo.pDepthStencilState = nullptr; // Optional
   pipelineInfo.pColorBlendState = &colorBlending;
-  pipelineInfo.pDynamicState = nullptr; // Optional
+  pipelineInfo.pDynamicState = &dynamicState;
   pipelineInfo.layout = *m_pipelineLayout;
 
   pipelineInfo.renderPass = *m_renderPass;
@@ -391,7 +533,95 @@ void VulkanWindow::createGraphicsPipeline() {
   pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
   pipelineInfo.basePipelineIndex = -1;
 
-  m_graphicsPipeline = m_device.createGraphicsPipeline(nullptr, pipelineInfo);
+  auto pipelineStart = std::chrono::steady_clock::now();
+  m_graphicsPipeline =
+      m_device.createGraphicsPipeline(m_pipelineCache, pipelineInfo);
+  auto pipelineTime = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - pipelineStart);
+  spdlog::info("create graphics pipeline {} us", pipelineTime.count());
+}
+
+std::filesystem::path VulkanWindow::pipelineCachePath() const {
+  std::filesystem::path cacheHome;
+  if (auto *xdgCache = std::getenv("XDG_CACHE_HOME");
+      xdgCache != nullptr && *xdgCache != '\0') {
+    cacheHome = xdgCache;
+  } else if (auto *home = std::getenv("HOME"); home != nullptr) {
+    cacheHome = std::filesystem::path(home) / ".cache";
+  } else {
+    cacheHome = std::filesystem::temp_directory_path();
+  }
+
+  auto fileName = fmt::format("pipeline-{:04x}-{:04x}-{:08x}.bin",
+                              m_deviceProperties.vendorID,
+                              m_deviceProperties.deviceID,
+                              m_deviceProperties.driverVersion);
+  return cacheHome / "alpha-emu" / fileName;
+}
+
+void VulkanWindow::createPipelineCache() {
+  auto path = pipelineCachePath();
+
+  std::vector<char> cacheData;
+  std::error_code error;
+  if (std::filesystem::exists(path, error)) {
+    cacheData = readFile(path.string());
+  }
+
+  //驱动也会校验，这里提前丢弃其他设备或者损坏的数据
+  vk::PipelineCacheHeaderVersionOne header{};
+  if (cacheData.size() >= sizeof(header)) {
+    std::memcpy(&header, cacheData.data(), sizeof(header));
+  }
+  bool valid = cacheData.size() >= sizeof(header) &&
+               header.headerVersion == vk::PipelineCacheHeaderVersion::eOne &&
+               header.vendorID == m_deviceProperties.vendorID &&
+               header.deviceID == m_deviceProperties.deviceID &&
+               header.pipelineCacheUUID ==
+                   m_deviceProperties.pipelineCacheUUID;
+  if (!valid) {
+    cacheData.clear();
+  }
+  spdlog::info("pipeline cache {} ({} bytes)", path.string(), cacheData.size());
+
+  vk::PipelineCacheCreateInfo createInfo{};
+  createInfo.initialDataSize = cacheData.size();
+  createInfo.pInitialData = cacheData.data();
+  m_pipelineCache = m_device.createPipelineCache(createInfo);
+}
+
+void VulkanWindow::savePipelineCache() {
+  if (*m_pipelineCache == vk::PipelineCache(nullptr)) {
+    return;
+  }
+
+  auto path = pipelineCachePath();
+  std::error_code error;
+  std::filesystem::create_directories(path.parent_path(), error);
+  if (error) {
+    spdlog::warn("failed to create pipeline cache directory: {}",
+                 error.message());
+    return;
+  }
+
+  auto data = m_pipelineCache.getData();
+
+  //先写临时文件再改名，避免中途退出留下不完整的 cache
+  auto tempPath = path;
+  tempPath += ".tmp";
+  {
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(data.data()),
+               static_cast<std::streamsize>(data.size()));
+    if (!file) {
+      spdlog::warn("failed to write pipeline cache {}", tempPath.string());
+      return;
+    }
+  }
+  std::filesystem::rename(tempPath, path, error);
+  if (error) {
+    spdlog::warn("failed to save pipeline cache: {}", error.message());
+  }
 }
 
 void VulkanWindow::createFramebuffers() {
@@ -426,29 +656,55 @@ void VulkanWindow::createCommandPool() {
 
 void VulkanWindow::createCommandBuffers() {
 
+  m_uploadCommandBuffers.clear();
+
+  vk::CommandBufferAllocateInfo allocInfo{};
+  allocInfo.commandPool = *m_commandPool;
+  allocInfo.level = vk::CommandBufferLevel::ePrimary;
+  allocInfo.commandBufferCount = m_config.framesInFlight;
+
+  //只上传变化的行，拷贝区域每次不同，在 uploadFrame 中记录
+  m_uploadCommandBuffers = m_device.allocateCommandBuffers(allocInfo);
+
+  recordCommandBuffers();
+}
+
+void VulkanWindow::recordCommandBuffers() {
   m_commandBuffers.clear();
 
-  m_commandBuffers.reserve(MAX_FRAMES_IN_FLIGHT);
-  auto bufferSize = MAX_FRAMES_IN_FLIGHT;
   vk::CommandBufferAllocateInfo allocInfo{};
   allocInfo.commandPool = *m_commandPool;
   allocInfo.level = vk::CommandBufferLevel::ePrimary;
-  allocInfo.commandBufferCount = static_cast<uint32_t>(bufferSize);
+  allocInfo.commandBufferCount =
+      static_cast<uint32_t>(m_swapChainFramebuffers.size());
 
   m_commandBuffers = m_device.allocateCommandBuffers(allocInfo);
+  m_imagesInFlight.assign(m_commandBuffers.size(), nullptr);
+
+  //每帧重新记录的开销，预先记录后每帧省下的 CPU 时间
+  auto startTime = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < m_commandBuffers.size(); i++) {
+    recordCommandBuffer(m_commandBuffers[i], i);
+  }
+  auto recordTime = std::chrono::duration<double, std::micro>(
+      std::chrono::steady_clock::now() - startTime);
+  spdlog::info("pre-recorded {} command buffers in {:.1f} us, saves {:.1f} us "
+               "of recording per frame",
+               m_commandBuffers.size(), recordTime.count(),
+               recordTime.count() / m_commandBuffers.size());
 }
 
 void VulkanWindow::createSyncObjects() {
 
-  m_imageAvailableSemaphores.reserve(MAX_FRAMES_IN_FLIGHT);
-  m_renderFinishedSemaphores.reserve(MAX_FRAMES_IN_FLIGHT);
-  m_inFlightFences.reserve(MAX_FRAMES_IN_FLIGHT);
+  m_imageAvailableSemaphores.reserve(m_config.framesInFlight);
+  m_renderFinishedSemaphores.reserve(m_config.framesInFlight);
+  m_inFlightFences.reserve(m_config.framesInFlight);
 
   vk::SemaphoreCreateInfo semaphoreInfo{};
   vk::FenceCreateInfo fenceInfo{};
   fenceInfo.flags = vk::FenceCreateFlagBits::eSignaled;
 
-  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+  for (size_t i = 0; i < m_config.framesInFlight; i++) {
     m_imageAvailableSemaphores.emplace_back(
         m_device.createSemaphore(semaphoreInfo));
     m_renderFinishedSemaphores.emplace_back(
@@ -463,6 +719,12 @@ void VulkanWindow::drawFrame() {
 
   vk::FenceGetFdInfoKHR getInfo{};
 
+  //画面和已经显示的内容相同，swapchain 也不需要重绘时，不 acquire 也不 present
+  pollFrameSource();
+  if (m_frameSource != nullptr && !m_frameDirty && !m_redrawRequired) {
+    return;
+  }
+
   auto result = m_device.waitForFences(*m_inFlightFences[m_currentFrame],
                                        VK_TRUE, seconds);
 
@@ -470,8 +732,6 @@ void VulkanWindow::drawFrame() {
     spdlog::warn(" wait fences time out");
   }
 
-  m_device.resetFences(*m_inFlightFences[m_currentFrame]);
-
   vk::AcquireNextImageInfoKHR acquireInfo{};
 
   // acquireInfo.swapchain = *m_swapChain;
@@ -479,20 +739,48 @@ void VulkanWindow::drawFrame() {
   // acquireInfo.semaphore = *m_imageAvailableSemaphores[m_currentFrame];
   // acquireInfo.deviceMask = UINT32_MAX;
 
-  auto [acquireResult, imageIndex] = (*m_device).acquireNextImageKHR(
-      *m_swapChain, seconds, *m_imageAvailableSemaphores[m_currentFrame]);
-
-  if (acquireResult == vk::Result::eErrorOutOfDateKHR) {
+  uint32_t imageIndex = 0;
+  try {
+    auto [acquireResult, index] = (*m_device).acquireNextImageKHR(
+        *m_swapChain, seconds, *m_imageAvailableSemaphores[m_currentFrame]);
+    imageIndex = index;
+
+    if (acquireResult == vk::Result::eTimeout ||
+        acquireResult == vk::Result::eNotReady) {
+      spdlog::warn("acquire swap chain image time out");
+      return;
+    } else if (acquireResult == vk::Result::eSuboptimalKHR) {
+      // image 依然可用，present 之后再重建
+      m_framebufferResized = true;
+    }
+  } catch (const vk::OutOfDateKHRError &) {
     recreateSwapChain();
     return;
-  } else if (acquireResult != vk::Result::eSuccess &&
-             acquireResult != vk::Result::eSuboptimalKHR) {
-    spdlog::error("failed to acquire swap chain image");
   }
 
-  m_commandBuffers[m_currentFrame].reset();
+  //image 的 command buffer 可能还在被其他 frame 使用
+  if (m_imagesInFlight[imageIndex]) {
+    result = m_device.waitForFences(m_imagesInFlight[imageIndex], VK_TRUE,
+                                    seconds);
+    if (result == vk::Result::eTimeout) {
+      spdlog::warn(" wait image fences time out");
+    }
+  }
+  m_imagesInFlight[imageIndex] = *m_inFlightFences[m_currentFrame];
+
+  //拿到 image 之后才重置 fence，提前返回时 fence 保持 signaled
+  m_device.resetFences(*m_inFlightFences[m_currentFrame]);
 
-  recordCommandBuffer(m_commandBuffers[m_currentFrame], imageIndex);
+  //fence 已经等待过，当前 frame 的 staging buffer 不再被 GPU 使用，可以直接写入
+  //画面没有变化时不提交上传命令，image 保持上一帧的内容
+  //命令都是预先记录的，每帧变化的只有 staging buffer 中的数据
+  uint32_t commandBufferCount = 0;
+  vk::CommandBuffer commandBuffers[2];
+  if (uploadFrame(m_currentFrame)) {
+    commandBuffers[commandBufferCount++] =
+        *m_uploadCommandBuffers[m_currentFrame];
+  }
+  commandBuffers[commandBufferCount++] = *m_commandBuffers[imageIndex];
 
   vk::SubmitInfo submitInfo{};
 
@@ -500,12 +788,12 @@ void VulkanWindow::drawFrame() {
       *m_imageAvailableSemaphores[m_currentFrame]};
   vk::PipelineStageFlags waitStages[] = {
       vk::PipelineStageFlagBits::eColorAttachmentOutput};
-  vk::CommandBuffer commandBuffers[] = {*m_commandBuffers[m_currentFrame]};
+
   submitInfo.waitSemaphoreCount = 1;
   submitInfo.pWaitSemaphores = waitSemaphores;
   submitInfo.pWaitDstStageMask = waitStages;
 
-  submitInfo.commandBufferCount = 1;
+  submitInfo.commandBufferCount = commandBufferCount;
   submitInfo.pCommandBuffers = commandBuffers;
 
   vk::Semaphore signalSemaphores[] = {
@@ -513,7 +801,9 @@ void VulkanWindow::drawFrame() {
   submitInfo.signalSemaphoreCount = 1;
   submitInfo.pSignalSemaphores = signalSemaphores;
 
+  auto submitTime = std::chrono::steady_clock::now();
   m_graphicsQueue.submit(submitInfo, *m_inFlightFences[m_currentFrame]);
+  m_redrawRequired = false;
 
   vk::PresentInfoKHR presentInfo{};
   presentInfo.waitSemaphoreCount = 1;
@@ -525,8 +815,31 @@ void VulkanWindow::drawFrame() {
 
   presentInfo.pResults = nullptr;
 
+  //附带 present id，监控线程据此等待图像真正显示
+  auto presentIdValue = ++m_presentId;
+  vk::PresentIdKHR presentId{};
+  presentId.swapchainCount = 1;
+  presentId.pPresentIds = &presentIdValue;
+  if (m_latencyMonitor) {
+    presentInfo.pNext = &presentId;
+  }
+
   try {
     auto presentQueueResult = m_presentQueue.presentKHR(presentInfo);
+    if (presentQueueResult == vk::Result::eSuboptimalKHR) {
+      m_framebufferResized = true;
+    }
+    if (m_latencyMonitor) {
+      m_latencyMonitor->presented(presentIdValue, submitTime);
+    }
+
+    if (!m_firstFramePresented) {
+      m_firstFramePresented = true;
+      auto firstFrameTime =
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::steady_clock::now() - m_initStartTime);
+      spdlog::info("time to first frame {} ms", firstFrameTime.count());
+    }
 
   } catch (const std::system_error &system) {
     auto code = system.code();
@@ -537,10 +850,192 @@ void VulkanWindow::drawFrame() {
     } else if (errorCode != vk::Result::eSuccess) {
       spdlog::error("failed to acquire swap chain image");
     }
+  }
 
-    m_currentFrame = (m_currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+  m_currentFrame = (m_currentFrame + 1) % m_config.framesInFlight;
+
+  //多次 resize 事件合并到一次重建
+  if (m_framebufferResized) {
+    m_framebufferResized = false;
+    recreateSwapChain();
   }
 }
+
+std::chrono::steady_clock::time_point VulkanWindow::waitPresentComplete() {
+  if (m_latencyMonitor) {
+    auto presentTime = m_latencyMonitor->waitPresented(
+        m_presentId, std::chrono::milliseconds(100));
+    if (presentTime) {
+      return *presentTime;
+    }
+  }
+  m_presentQueue.waitIdle();
+  return std::chrono::steady_clock::now();
+}
+
+void VulkanWindow::pollFrameSource() {
+  if (m_frameSource == nullptr || !m_frameSource->Update()) {
+    return;
+  }
+
+  //新画面替换了还没上传的旧画面，是否需要上传只取决于新画面
+  auto hash = m_frameSource->ReadBuffer().hash;
+  m_frameDirty = m_uploadedFrameHash != hash;
+
+  m_receivedFrames++;
+  if (!m_frameDirty) {
+    m_unchangedFrames++;
+  }
+  if (m_receivedFrames == FRAME_STATS_INTERVAL) {
+    spdlog::info("{} of {} frames unchanged, upload and redraw skipped, "
+                 "{} bytes uploaded per frame in {} regions per upload",
+                 m_unchangedFrames, m_receivedFrames,
+                 m_uploadedBytes / m_receivedFrames,
+                 m_uploadCount > 0 ? m_uploadRegions / m_uploadCount : 0);
+    m_receivedFrames = 0;
+    m_unchangedFrames = 0;
+    m_uploadedBytes = 0;
+    m_uploadRegions = 0;
+    m_uploadCount = 0;
+  }
+}
+
+bool VulkanWindow::uploadFrame(uint32_t slot) {
+  if (!m_frameDirty) {
+    return false;
+  }
+  const auto &frame = m_frameSource->ReadBuffer();
+
+  //和 image 中已有的内容比较，而不是和上一帧比较，三缓冲丢掉的帧不影响结果
+  DirtyLineRanges(frame, m_uploadedFrameHash ? &m_uploadedLineHashes : nullptr,
+                  m_dirtyRanges);
+
+  auto *rgba = static_cast<uint32_t *>(m_frameStagingMemories[slot].mapped());
+  if (m_ntscFilter) {
+    m_ntscFilter->Filter(frame, m_dirtyRanges, rgba);
+  } else if (m_pixelScaler) {
+    for (auto range : m_dirtyRanges) {
+      ConvertLines(frame, range, m_scalerSource.data());
+    }
+    //之后 m_dirtyRanges 为放大后画面中需要上传的行
+    m_pixelScaler->Scale(m_scalerSource.data(), m_dirtyRanges, rgba);
+  } else {
+    for (auto range : m_dirtyRanges) {
+      ConvertLines(frame, range, rgba);
+    }
+  }
+  for (auto range : m_dirtyRanges) {
+    m_uploadedBytes += static_cast<uint64_t>(range.count) * frameWidth() *
+                       sizeof(uint32_t);
+  }
+  m_uploadRegions += m_dirtyRanges.size();
+  m_uploadCount++;
+
+  //fence 已经等待过，上一次提交的上传命令已经执行完
+  auto &commandBuffer = m_uploadCommandBuffers[slot];
+  commandBuffer.reset();
+  vk::CommandBufferBeginInfo beginInfo{};
+  beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+  commandBuffer.begin(beginInfo);
+  recordFrameUpload(commandBuffer, slot, m_dirtyRanges);
+  commandBuffer.end();
+
+  m_uploadedLineHashes = frame.lineHashes;
+  m_uploadedFrameHash = frame.hash;
+  m_frameDirty = false;
+  return true;
+}
+
+void VulkanWindow::renderOffscreen(std::span<uint32_t> pixels) {
+  auto pixelCount =
+      static_cast<size_t>(m_swapChainExtent.width) * m_swapChainExtent.height;
+  if (pixels.size() < pixelCount) {
+    throw std::runtime_error("offscreen readback buffer too small!");
+  }
+
+  //上一帧已经同步等待过，fence 一定是 signaled
+  m_device.resetFences(*m_inFlightFences[0]);
+
+  //读回需要完整的画面，没有变化时只跳过上传
+  pollFrameSource();
+  uint32_t commandBufferCount = 0;
+  vk::CommandBuffer commandBuffers[2];
+  if (uploadFrame(0)) {
+    commandBuffers[commandBufferCount++] = *m_uploadCommandBuffers[0];
+  }
+  commandBuffers[commandBufferCount++] = *m_commandBuffers[0];
+
+  vk::SubmitInfo submitInfo{};
+  submitInfo.commandBufferCount = commandBufferCount;
+  submitInfo.pCommandBuffers = commandBuffers;
+  m_graphicsQueue.submit(submitInfo, *m_inFlightFences[0]);
+
+  auto result = m_device.waitForFences(*m_inFlightFences[0], VK_TRUE,
+                                       static_cast<uint64_t>(10e9));
+  if (result == vk::Result::eTimeout) {
+    throw std::runtime_error("offscreen render time out!");
+  }
+
+  std::memcpy(pixels.data(), m_readbackMemory.mapped(),
+              pixelCount * sizeof(uint32_t));
+
+  if (!m_firstFramePresented) {
+    m_firstFramePresented = true;
+    auto firstFrameTime = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - m_initStartTime);
+    spdlog::info("time to first frame {} ms", firstFrameTime.count());
+  }
+}
+
+void VulkanWindow::createOffscreenTarget() {
+  createImage(m_swapChainExtent.width, m_swapChainExtent.height,
+              m_swapChainImageFormat,
+              vk::ImageUsageFlagBits::eColorAttachment |
+                  vk::ImageUsageFlagBits::eTransferSrc,
+              vk::MemoryPropertyFlagBits::eDeviceLocal, m_offscreenImage,
+              m_offscreenImageMemory);
+
+  //之后的 image view、framebuffer 和 command buffer 与 swapchain 的流程相同
+  m_swapChainImages = {*m_offscreenImage};
+  createImageViews();
+
+  auto size = static_cast<vk::DeviceSize>(m_swapChainExtent.width) *
+              m_swapChainExtent.height * sizeof(uint32_t);
+  createBuffer(size, vk::BufferUsageFlagBits::eTransferDst,
+               vk::MemoryPropertyFlagBits::eHostVisible |
+                   vk::MemoryPropertyFlagBits::eHostCoherent,
+               m_readbackBuffer, m_readbackMemory);
+}
+
+void VulkanWindow::recreateSwapChain() {
+  //窗口最小化时 extent 为 0，无法创建 swapchain，等恢复后再重建
+  auto capabilities = m_physicalDevice.getSurfaceCapabilitiesKHR(m_surface);
+  if (capabilities.currentExtent.width == 0 ||
+      capabilities.currentExtent.height == 0) {
+    return;
+  }
+
+  m_device.waitIdle();
+
+  auto oldFormat = m_swapChainImageFormat;
+
+  //旧 swapchain 的 image 在新 swapchain 创建后销毁，先释放引用它们的对象
+  m_swapChainFramebuffers.clear();
+  m_swapChainImageViews.clear();
+
+  createSwapChain();
+  createImageViews();
+
+  // viewport 和 scissor 是动态状态，只有格式变化时才需要重建 render pass
+  if (m_swapChainImageFormat != oldFormat) {
+    spdlog::info("swap chain format changed, recreate render pass");
+    createRenderPass();
+    createGraphicsPipeline();
+  }
+  createFramebuffers();
+  recordCommandBuffers();
+  m_redrawRequired = true;
+}
 bool VulkanWindow::isDeviceSuitable(const vk::PhysicalDevice &device) {
   auto deviceProperties = device.getProperties();
 
@@ -549,19 +1044,17 @@ bool VulkanWindow::isDeviceSuitable(const vk::PhysicalDevice &device) {
 
   QueueFamilyIndices indices = findQueueFamilies(device);
 
-  bool extensionsSupported = checkDeviceExtensionSupport(device);
+  bool extensionsSupported = m_offscreen || checkDeviceExtensionSupport(device);
 
-  bool swapChainAdequate = false;
-  if (extensionsSupported) {
+  bool swapChainAdequate = m_offscreen;
+  if (extensionsSupported && !m_offscreen) {
     SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
     swapChainAdequate = !swapChainSupport.formats.empty() &&
                         !swapChainSupport.presentModes.empty();
   }
 
-  return indices.isComplete() && extensionsSupported && swapChainAdequate &&
-         (deviceProperties.deviceType == vk::PhysicalDeviceType::eDiscreteGpu ||
-          deviceProperties.deviceType ==
-              vk::PhysicalDeviceType::eIntegratedGpu);
+  //设备类型的优先级在 pickPhysicalDevice 中处理，CPU 实现也可以使用
+  return indices.isComplete() && extensionsSupported && swapChainAdequate;
 }
 
 bool VulkanWindow::checkDeviceExtensionSupport(
@@ -638,13 +1131,50 @@ void VulkanWindow::recordCommandBuffer(const raii::CommandBuffer &commandBuffer,
   commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics,
                              *m_graphicsPipeline);
 
-  vk::Buffer vertexBuffers[] = {*m_vertexBuffer};
-  vk::DeviceSize offsets[] = {0};
-  commandBuffer.bindVertexBuffers(0, vertexBuffers, offsets);
-  commandBuffer.draw(static_cast<uint32_t>(m_vertices.size()), 1, 0, 0);
+  //缩放通过 viewport 完成，viewport 以外的部分保持 clear 的黑色
+  auto presentRect = computePresentRect(m_swapChainExtent, m_config.integerScale);
+
+  vk::Viewport viewport{};
+  viewport.x = static_cast<float>(presentRect.offset.x);
+  viewport.y = static_cast<float>(presentRect.offset.y);
+  viewport.width = static_cast<float>(presentRect.extent.width);
+  viewport.height = static_cast<float>(presentRect.extent.height);
+  viewport.minDepth = 0.0f;
+  viewport.maxDepth = 1.0f;
+  commandBuffer.setViewport(0, viewport);
+  commandBuffer.setScissor(0, presentRect);
+
+  commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
+                                   *m_pipelineLayout, 0, *m_descriptorSet,
+                                   nullptr);
+  commandBuffer.draw(3, 1, 0, 0);
 
   commandBuffer.endRenderPass();
 
+  if (m_offscreen) {
+    vk::BufferImageCopy region{};
+    region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent =
+        vk::Extent3D{m_swapChainExtent.width, m_swapChainExtent.height, 1};
+    commandBuffer.copyImageToBuffer(*m_offscreenImage,
+                                    vk::ImageLayout::eTransferSrcOptimal,
+                                    *m_readbackBuffer, region);
+
+    //等待 fence 之后 CPU 读取
+    vk::BufferMemoryBarrier toHost{};
+    toHost.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    toHost.dstAccessMask = vk::AccessFlagBits::eHostRead;
+    toHost.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toHost.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toHost.buffer = *m_readbackBuffer;
+    toHost.offset = 0;
+    toHost.size = VK_WHOLE_SIZE;
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                  vk::PipelineStageFlagBits::eHost, {}, nullptr,
+                                  toHost, nullptr);
+  }
+
   commandBuffer.end();
 }
 
@@ -661,14 +1191,15 @@ VulkanWindow::findQueueFamilies(const vk::PhysicalDevice &device) {
       indices.graphicsFamily = i;
     }
 
-    auto presentSupport = device.getSurfaceSupportKHR(i, m_surface);
-
-    spdlog::info("after get queue family{}", i);
-    if (presentSupport) {
+    //离屏模式没有 surface，不需要 present
+    if (!m_offscreen && device.getSurfaceSupportKHR(i, m_surface)) {
       indices.presentFamily = i;
     }
     i++;
   }
+  if (m_offscreen) {
+    indices.presentFamily = indices.graphicsFamily;
+  }
   return indices;
 }
 
@@ -697,10 +1228,13 @@ vk::SurfaceFormatKHR VulkanWindow::chooseSwapSurfaceFormat(
 vk::PresentModeKHR VulkanWindow::chooseSwapPresentMode(
     const std::vector<vk::PresentModeKHR> &availablePresentModes) {
   for (const auto &availablePresentMode : availablePresentModes) {
-    if (availablePresentMode == vk::PresentModeKHR::eMailbox) {
+    if (availablePresentMode == m_config.presentMode) {
       return availablePresentMode;
     }
   }
+  // FIFO 是所有设备都必须支持的
+  spdlog::warn("present mode {} not supported, fall back to FIFO",
+               vk::to_string(m_config.presentMode));
   return vk::PresentModeKHR::eFifo;
 }
 
@@ -729,10 +1263,10 @@ VulkanWindow::chooseSwapExtent(const vk::SurfaceCapabilitiesKHR &capabilities) {
 }
 
 raii::ShaderModule
-VulkanWindow::createShaderModule(const std::vector<char> &code) {
+VulkanWindow::createShaderModule(std::span<const uint32_t> code) {
   vk::ShaderModuleCreateInfo createInfo{};
-  createInfo.codeSize = code.size();
-  createInfo.pCode = reinterpret_cast<const uint32_t *>(code.data());
+  createInfo.codeSize = code.size_bytes();
+  createInfo.pCode = code.data();
   auto shaderModule = m_device.createShaderModule(createInfo);
   return shaderModule;
 }
@@ -744,61 +1278,39 @@ void VulkanWindow::cleanup() {
   m_inFlightFences.clear();
 
   m_commandBuffers.clear();
+  m_uploadCommandBuffers.clear();
+  m_imagesInFlight.clear();
 
   m_commandPool.clear();
+  m_descriptorSet.clear();
+  m_descriptorPool.clear();
+  m_descriptorSetLayout.clear();
+  m_nearestSampler.clear();
+  m_linearSampler.clear();
+  m_frameImageView.clear();
   m_swapChainFramebuffers.clear();
   m_graphicsPipeline.clear();
+  savePipelineCache();
+  m_pipelineCache.clear();
   m_pipelineLayout.clear();
   m_renderPass.clear();
   m_swapChainImageViews.clear();
+  m_readbackBuffer.clear();
+  m_readbackMemory.release();
+  m_offscreenImage.clear();
+  m_offscreenImageMemory.release();
+  m_latencyMonitor.reset();
   m_swapChain.clear();
+  m_allocator->logStats();
   // m_device.clear();
   // m_debugMessenger.clear();
 }
 
-void VulkanWindow::createVertexBuffer() {
-  auto size =
-      static_cast<vk::DeviceSize>(sizeof(m_vertices[0]) * m_vertices.size());
-
-  raii::Buffer stagingBuffer{nullptr};
-  raii::DeviceMemory stagingBufferMemory{nullptr};
-
-  createBuffer(size, vk::BufferUsageFlagBits::eTransferSrc,
-               vk::MemoryPropertyFlagBits::eHostVisible |
-                   vk::MemoryPropertyFlagBits::eHostCoherent,
-               stagingBuffer, stagingBufferMemory);
-
-  //填充buffer数据
-  auto data = (*m_device).mapMemory(*stagingBufferMemory, 0, size);
-  std::memcpy(data, m_vertices.data(), static_cast<size_t>(size));
-  (*m_device).unmapMemory(*stagingBufferMemory);
-
-  createBuffer(size, vk::BufferUsageFlagBits::eTransferDst|vk::BufferUsageFlagBits::eVertexBuffer,
-              vk::MemoryPropertyFlagBits::eDeviceLocal,
-               m_vertexBuffer, m_vertexBufferMemory);
-
-  copyBuffer(*stagingBuffer, *m_vertexBuffer, size);
-}
-
-uint32_t
-VulkanWindow::findMemoryType(uint32_t typeFilter,
-                             const vk::MemoryPropertyFlags &properties) {
-  auto memProperties = m_physicalDevice.getMemoryProperties();
-
-  for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-    if ((typeFilter & (i << i)) && (memProperties.memoryTypes[i].propertyFlags &
-                                    properties) == properties) {
-      return i;
-    }
-  }
-  return 0;
-  spdlog::error("failed to find suitable memory type!");
-}
-
 void VulkanWindow::createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage,
                                 vk::MemoryPropertyFlags properties,
                                 raii::Buffer &buffer,
-                                raii::DeviceMemory &bufferMemory) {
+                                DeviceAllocation &bufferMemory,
+                                MemoryPool pool) {
   vk::BufferCreateInfo bufferInfo{};
   bufferInfo.size = size;
   bufferInfo.usage = usage;
@@ -806,50 +1318,273 @@ void VulkanWindow::createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage,
 
   buffer = m_device.createBuffer(bufferInfo);
 
-  //获取buffer 需要的类型;
-  vk::DeviceBufferMemoryRequirements info{};
-  info.setPCreateInfo(&bufferInfo);
-  auto memRequirements =
-      (*m_device).getBufferMemoryRequirements(*buffer);
-
-  vk::MemoryAllocateInfo allocInfo{};
-  allocInfo.setAllocationSize(memRequirements.size);
-  allocInfo.memoryTypeIndex =
-      findMemoryType(memRequirements.memoryTypeBits,
-                     properties);
-
-  //分配设备内存
-  bufferMemory = m_device.allocateMemory(allocInfo);
-
-  vk::BindBufferMemoryInfo bindInfo{};
+  //获取buffer 需要的类型，从子分配器中分配
+  auto memRequirements = (*m_device).getBufferMemoryRequirements(*buffer);
+  bufferMemory = m_allocator->allocate(memRequirements, properties, false, pool);
 
-  bindInfo.buffer = *buffer;
-  bindInfo.memory = *bufferMemory;
-  bindInfo.setMemoryOffset(0);
-
-  m_device.bindBufferMemory2(bindInfo);
+  buffer.bindMemory(bufferMemory.memory(), bufferMemory.offset());
 }
 
+void VulkanWindow::createImage(uint32_t width, uint32_t height,
+                               vk::Format format, vk::ImageUsageFlags usage,
+                               vk::MemoryPropertyFlags properties,
+                               raii::Image &image,
+                               DeviceAllocation &imageMemory) {
+  vk::ImageCreateInfo imageInfo{};
+  imageInfo.imageType = vk::ImageType::e2D;
+  imageInfo.extent = vk::Extent3D{width, height, 1};
+  imageInfo.mipLevels = 1;
+  imageInfo.arrayLayers = 1;
+  imageInfo.format = format;
+  imageInfo.tiling = vk::ImageTiling::eOptimal;
+  imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+  imageInfo.usage = usage;
+  imageInfo.samples = vk::SampleCountFlagBits::e1;
+  imageInfo.sharingMode = vk::SharingMode::eExclusive;
+
+  image = m_device.createImage(imageInfo);
+
+  auto memRequirements = (*m_device).getImageMemoryRequirements(*image);
+  imageMemory = m_allocator->allocate(memRequirements, properties, true);
+
+  image.bindMemory(imageMemory.memory(), imageMemory.offset());
+}
 
-void VulkanWindow::copyBuffer(vk::Buffer srcBuffer,vk::Buffer dstBuffer,vk::DeviceSize size){
+void VulkanWindow::createFrameImage() {
+  createImage(frameWidth(), frameHeight(), vk::Format::eR8G8B8A8Unorm,
+              vk::ImageUsageFlagBits::eTransferDst |
+                  vk::ImageUsageFlagBits::eSampled,
+              vk::MemoryPropertyFlagBits::eDeviceLocal, m_frameImage,
+              m_frameImageMemory);
+
+  vk::ImageViewCreateInfo viewInfo{};
+  viewInfo.image = *m_frameImage;
+  viewInfo.viewType = vk::ImageViewType::e2D;
+  viewInfo.format = vk::Format::eR8G8B8A8Unorm;
+  viewInfo.subresourceRange = {.aspectMask = vk::ImageAspectFlagBits::eColor,
+                               .baseMipLevel = 0,
+                               .levelCount = 1,
+                               .baseArrayLayer = 0,
+                               .layerCount = 1};
+  m_frameImageView = m_device.createImageView(viewInfo);
+
+  //先转换到 shader 读取的 layout，预先记录的上传命令总是从这个 layout 开始
   vk::CommandBufferAllocateInfo allocInfo{};
+  allocInfo.commandPool = *m_commandPool;
   allocInfo.level = vk::CommandBufferLevel::ePrimary;
-  allocInfo.commandPool=*m_commandPool;
-  allocInfo.commandBufferCount=1;
-  auto commandBuffers= m_device.allocateCommandBuffers(allocInfo);
+  allocInfo.commandBufferCount = 1;
+  auto commandBuffers = m_device.allocateCommandBuffers(allocInfo);
+  auto &commandBuffer = commandBuffers.front();
 
   vk::CommandBufferBeginInfo beginInfo{};
-  beginInfo.flags=vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+  beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+  commandBuffer.begin(beginInfo);
 
-  commandBuffers[0].begin(beginInfo);
-  vk::BufferCopy copyRegion{};
-  copyRegion.size=size;
-  commandBuffers[0].copyBuffer(srcBuffer, dstBuffer, copyRegion);
-  commandBuffers[0].end();
+  vk::ImageMemoryBarrier barrier{};
+  barrier.oldLayout = vk::ImageLayout::eUndefined;
+  barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = *m_frameImage;
+  barrier.subresourceRange = {.aspectMask = vk::ImageAspectFlagBits::eColor,
+                              .baseMipLevel = 0,
+                              .levelCount = 1,
+                              .baseArrayLayer = 0,
+                              .layerCount = 1};
+  barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+  commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe,
+                                vk::PipelineStageFlagBits::eFragmentShader, {},
+                                nullptr, nullptr, barrier);
+  commandBuffer.end();
 
   vk::SubmitInfo submitInfo{};
-  submitInfo.setCommandBuffers(*commandBuffers[0]);
+  submitInfo.setCommandBuffers(*commandBuffer);
   m_graphicsQueue.submit(submitInfo);
+  //只在初始化时执行一次
   m_graphicsQueue.waitIdle();
+}
+
+void VulkanWindow::createDescriptorSetLayout() {
+  vk::DescriptorSetLayoutBinding samplerBinding{};
+  samplerBinding.binding = 0;
+  samplerBinding.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+  samplerBinding.descriptorCount = 1;
+  samplerBinding.stageFlags = vk::ShaderStageFlagBits::eFragment;
+
+  vk::DescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.setBindings(samplerBinding);
+  m_descriptorSetLayout = m_device.createDescriptorSetLayout(layoutInfo);
+}
+
+void VulkanWindow::createSamplers() {
+  vk::SamplerCreateInfo samplerInfo{};
+  samplerInfo.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+  samplerInfo.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+  samplerInfo.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+  samplerInfo.mipmapMode = vk::SamplerMipmapMode::eNearest;
+  samplerInfo.anisotropyEnable = VK_FALSE;
+  samplerInfo.unnormalizedCoordinates = VK_FALSE;
+
+  samplerInfo.magFilter = vk::Filter::eNearest;
+  samplerInfo.minFilter = vk::Filter::eNearest;
+  m_nearestSampler = m_device.createSampler(samplerInfo);
+
+  samplerInfo.magFilter = vk::Filter::eLinear;
+  samplerInfo.minFilter = vk::Filter::eLinear;
+  m_linearSampler = m_device.createSampler(samplerInfo);
+}
+
+void VulkanWindow::createDescriptorSet() {
+  vk::DescriptorPoolSize poolSize{};
+  poolSize.type = vk::DescriptorType::eCombinedImageSampler;
+  poolSize.descriptorCount = 1;
+
+  // raii::DescriptorSet 析构时单独释放，需要 eFreeDescriptorSet
+  vk::DescriptorPoolCreateInfo poolInfo{};
+  poolInfo.flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet;
+  poolInfo.maxSets = 1;
+  poolInfo.setPoolSizes(poolSize);
+  m_descriptorPool = m_device.createDescriptorPool(poolInfo);
+
+  vk::DescriptorSetAllocateInfo allocInfo{};
+  allocInfo.descriptorPool = *m_descriptorPool;
+  allocInfo.setSetLayouts(*m_descriptorSetLayout);
+  auto descriptorSets = m_device.allocateDescriptorSets(allocInfo);
+  m_descriptorSet = std::move(descriptorSets.front());
+
+  updateDescriptorSet();
+}
+
+void VulkanWindow::updateDescriptorSet() {
+  vk::DescriptorImageInfo imageInfo{};
+  imageInfo.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+  imageInfo.imageView = *m_frameImageView;
+  imageInfo.sampler = m_config.filter == vk::Filter::eLinear
+                          ? *m_linearSampler
+                          : *m_nearestSampler;
+
+  vk::WriteDescriptorSet write{};
+  write.dstSet = *m_descriptorSet;
+  write.dstBinding = 0;
+  write.dstArrayElement = 0;
+  write.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+  write.setImageInfo(imageInfo);
+  m_device.updateDescriptorSets(write, nullptr);
+}
+
+void VulkanWindow::setFilter(vk::Filter filter) {
+  m_config.filter = filter;
+  if (*m_descriptorSet) {
+    //descriptor set 不能在使用中更新，更新之后绑定了它的 command buffer
+    //都变为 invalid(pool 没有 UPDATE_AFTER_BIND)，需要重新记录
+    m_device.waitIdle();
+    updateDescriptorSet();
+    recordCommandBuffers();
+    m_redrawRequired = true;
+  }
+}
+
+vk::Rect2D computePresentRect(vk::Extent2D target, bool integerScale) {
+  auto scale = std::min(static_cast<double>(target.width) / NES_FRAME_WIDTH,
+                        static_cast<double>(target.height) / NES_FRAME_HEIGHT);
+  if (integerScale && scale >= 1.0) {
+    scale = std::floor(scale);
+  }
+
+  auto width = std::max<uint32_t>(
+      1, static_cast<uint32_t>(std::lround(NES_FRAME_WIDTH * scale)));
+  auto height = std::max<uint32_t>(
+      1, static_cast<uint32_t>(std::lround(NES_FRAME_HEIGHT * scale)));
+  width = std::min(width, target.width);
+  height = std::min(height, target.height);
+
+  return vk::Rect2D{
+      .offset = {static_cast<int32_t>((target.width - width) / 2),
+                 static_cast<int32_t>((target.height - height) / 2)},
+      .extent = {width, height}};
+}
+
+void VulkanWindow::createFrameStagingBuffers() {
+  auto size = static_cast<vk::DeviceSize>(frameWidth() * frameHeight() *
+                                          sizeof(uint32_t));
+
+  m_frameStagingBuffers.clear();
+  m_frameStagingMemories.clear();
+  m_frameStagingBuffers.reserve(m_config.framesInFlight);
+  m_frameStagingMemories.reserve(m_config.framesInFlight);
+
+  for (size_t i = 0; i < m_config.framesInFlight; i++) {
+    raii::Buffer buffer{nullptr};
+    DeviceAllocation memory;
+    //子分配器中 host visible 的块是常驻映射的
+    createBuffer(size, vk::BufferUsageFlagBits::eTransferSrc,
+                 vk::MemoryPropertyFlagBits::eHostVisible |
+                     vk::MemoryPropertyFlagBits::eHostCoherent,
+                 buffer, memory);
+
+    m_frameStagingBuffers.emplace_back(std::move(buffer));
+    m_frameStagingMemories.emplace_back(std::move(memory));
+  }
+}
+
+void VulkanWindow::recordFrameUpload(const raii::CommandBuffer &commandBuffer,
+                                     uint32_t slot,
+                                     std::span<const LineRange> ranges) {
+
+  vk::ImageSubresourceRange range{.aspectMask = vk::ImageAspectFlagBits::eColor,
+                                  .baseMipLevel = 0,
+                                  .levelCount = 1,
+                                  .baseArrayLayer = 0,
+                                  .layerCount = 1};
+
+  //等待上一帧对 image 的读取完成后再写入
+  vk::ImageMemoryBarrier toTransfer{};
+  toTransfer.oldLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+  toTransfer.newLayout = vk::ImageLayout::eTransferDstOptimal;
+  toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toTransfer.image = *m_frameImage;
+  toTransfer.subresourceRange = range;
+  toTransfer.srcAccessMask = vk::AccessFlagBits::eShaderRead;
+  toTransfer.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+
+  commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eFragmentShader,
+                                vk::PipelineStageFlagBits::eTransfer, {},
+                                nullptr, nullptr, toTransfer);
+
+  //staging buffer 和 image 的行一一对应，每个区间一个 region
+  m_copyRegions.clear();
+  for (auto range : ranges) {
+    vk::BufferImageCopy region{};
+    region.bufferOffset = static_cast<vk::DeviceSize>(range.first) *
+                          frameWidth() * sizeof(uint32_t);
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = vk::Offset3D{0, static_cast<int32_t>(range.first), 0};
+    region.imageExtent = vk::Extent3D{frameWidth(), range.count, 1};
+    m_copyRegions.push_back(region);
+  }
 
+  commandBuffer.copyBufferToImage(*m_frameStagingBuffers[slot],
+                                  *m_frameImage,
+                                  vk::ImageLayout::eTransferDstOptimal,
+                                  m_copyRegions);
+
+  vk::ImageMemoryBarrier toShader{};
+  toShader.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+  toShader.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+  toShader.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toShader.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toShader.image = *m_frameImage;
+  toShader.subresourceRange = range;
+  toShader.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+  toShader.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+  commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                vk::PipelineStageFlagBits::eFragmentShader, {},
+                                nullptr, nullptr, toShader);
 }
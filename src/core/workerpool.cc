@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <workerpool.hh>
+
+WorkerPool::WorkerPool(uint32_t threadCount) {
+  if (threadCount == 0) {
+    threadCount = std::max(1U, std::thread::hardware_concurrency());
+  }
+  m_threads.reserve(threadCount - 1);
+  for (uint32_t i = 1; i < threadCount; i++) {
+    m_threads.emplace_back(&WorkerPool::WorkerLoop, this);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard lock(m_mutex);
+    m_running = false;
+  }
+  m_startCondition.notify_all();
+  for (auto &thread : m_threads) {
+    thread.join();
+  }
+}
+
+void WorkerPool::ParallelFor(
+    uint32_t count, const std::function<void(uint32_t, uint32_t)> &task,
+    uint32_t minBand) {
+  if (count == 0) {
+    return;
+  }
+
+  //每个线程分到一段，数据太少时不值得唤醒其他线程
+  auto bandSize = std::max(minBand, (count + ThreadCount() - 1) / ThreadCount());
+  if (m_threads.empty() || bandSize >= count) {
+    task(0, count);
+    return;
+  }
+
+  {
+    std::lock_guard lock(m_mutex);
+    m_task = &task;
+    m_count = count;
+    m_bandSize = bandSize;
+    m_nextBand = 0;
+    m_activeWorkers = static_cast<uint32_t>(m_threads.size());
+    m_generation++;
+  }
+  m_startCondition.notify_all();
+
+  RunBands();
+
+  std::unique_lock lock(m_mutex);
+  m_doneCondition.wait(lock, [this] { return m_activeWorkers == 0; });
+  m_task = nullptr;
+}
+
+void WorkerPool::RunBands() {
+  while (true) {
+    auto begin = m_nextBand.fetch_add(m_bandSize, std::memory_order_relaxed);
+    if (begin >= m_count) {
+      return;
+    }
+    (*m_task)(begin, std::min(begin + m_bandSize, m_count));
+  }
+}
+
+void WorkerPool::WorkerLoop() {
+  uint64_t generation = 0;
+  while (true) {
+    {
+      std::unique_lock lock(m_mutex);
+      m_startCondition.wait(lock, [this, generation] {
+        return !m_running || m_generation != generation;
+      });
+      if (!m_running) {
+        return;
+      }
+      generation = m_generation;
+    }
+
+    RunBands();
+
+    {
+      std::lock_guard lock(m_mutex);
+      m_activeWorkers--;
+    }
+    m_doneCondition.notify_one();
+  }
+}
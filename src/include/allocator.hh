@@ -0,0 +1,134 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#define VULKAN_HPP_NO_CONSTRUCTORS
+#include <map>
+#include <memory>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_raii.hpp>
+
+namespace raii = vk::raii;
+
+//子分配使用的内存池
+enum class MemoryPool {
+  //通用池，按 offset 维护空闲区间，释放时合并相邻区间
+  FreeList,
+  //只向后分配，块内分配全部释放后整体重置，适合 staging 之类的临时数据
+  Linear
+};
+
+struct MemoryStats {
+  //从驱动分配的 VkDeviceMemory 总大小
+  vk::DeviceSize allocatedBytes = 0;
+  //实际交给资源使用的大小
+  vk::DeviceSize usedBytes = 0;
+  uint32_t blockCount = 0;
+  uint32_t allocationCount = 0;
+};
+
+//一次 vkAllocateMemory 得到的大块内存
+struct MemoryBlock {
+  raii::DeviceMemory memory{nullptr};
+  vk::DeviceSize size = 0;
+  uint32_t memoryTypeIndex = 0;
+  MemoryPool pool = MemoryPool::FreeList;
+  // optimal tiling 的 image 和 buffer 分开存放，避免 bufferImageGranularity
+  bool optimalImage = false;
+  //超过块大小的单独分配，清空后立即释放
+  bool dedicated = false;
+  //host visible 的块创建时映射，之后不再 unmap
+  std::byte *mapped = nullptr;
+
+  // FreeList 使用: offset -> size
+  std::map<vk::DeviceSize, vk::DeviceSize> freeRanges;
+  // Linear 使用: 下一次分配的起始位置
+  vk::DeviceSize head = 0;
+
+  vk::DeviceSize usedBytes = 0;
+  uint32_t allocationCount = 0;
+};
+
+class DeviceAllocator;
+
+/*
+ * 子分配的结果，只能移动
+ * 析构时归还给 DeviceAllocator，所以 DeviceAllocator 需要比它活得久
+ */
+class DeviceAllocation {
+public:
+  DeviceAllocation() = default;
+  DeviceAllocation(std::nullptr_t) {}
+  DeviceAllocation(DeviceAllocation &&other) noexcept { *this = std::move(other); }
+  DeviceAllocation &operator=(DeviceAllocation &&other) noexcept;
+  DeviceAllocation(const DeviceAllocation &) = delete;
+  DeviceAllocation &operator=(const DeviceAllocation &) = delete;
+  ~DeviceAllocation() { release(); }
+
+  vk::DeviceMemory memory() const { return *m_block->memory; }
+  vk::DeviceSize offset() const { return m_offset; }
+  vk::DeviceSize size() const { return m_size; }
+
+  //常驻映射的地址，不是 host visible 时为 nullptr
+  void *mapped() const {
+    return m_block->mapped != nullptr ? m_block->mapped + m_offset : nullptr;
+  }
+
+  explicit operator bool() const { return m_block != nullptr; }
+
+  void release();
+
+private:
+  friend class DeviceAllocator;
+
+  DeviceAllocator *m_allocator = nullptr;
+  MemoryBlock *m_block = nullptr;
+  vk::DeviceSize m_offset = 0;
+  vk::DeviceSize m_size = 0;
+};
+
+/*
+ * 设备内存子分配器
+ * 每种内存类型按块向驱动申请大块 VkDeviceMemory，buffer 和 image 从块中
+ * 切分，减少 vkAllocateMemory 的次数，避免超过 maxMemoryAllocationCount。
+ */
+class DeviceAllocator {
+public:
+  static constexpr vk::DeviceSize DEFAULT_BLOCK_SIZE = 64 * 1024 * 1024;
+
+  DeviceAllocator(const raii::Device &device,
+                  const vk::PhysicalDeviceMemoryProperties &memoryProperties,
+                  vk::DeviceSize blockSize = DEFAULT_BLOCK_SIZE);
+
+  //按照 getBufferMemoryRequirements/getImageMemoryRequirements 的结果分配
+  DeviceAllocation allocate(const vk::MemoryRequirements &requirements,
+                            vk::MemoryPropertyFlags properties,
+                            bool optimalImage,
+                            MemoryPool pool = MemoryPool::FreeList);
+
+  uint32_t findMemoryType(uint32_t typeFilter,
+                          vk::MemoryPropertyFlags properties) const;
+
+  MemoryStats stats() const;
+  void logStats() const;
+
+private:
+  friend class DeviceAllocation;
+
+  MemoryBlock &createBlock(uint32_t memoryTypeIndex, vk::DeviceSize size,
+                           MemoryPool pool, bool optimalImage, bool dedicated);
+
+  //在块中寻找合适的位置，失败返回 false
+  static bool allocateFromBlock(MemoryBlock &block,
+                                const vk::MemoryRequirements &requirements,
+                                vk::DeviceSize &offset);
+
+  void free(MemoryBlock *block, vk::DeviceSize offset, vk::DeviceSize size);
+
+private:
+  const raii::Device &m_device;
+  vk::PhysicalDeviceMemoryProperties m_memoryProperties;
+  vk::DeviceSize m_blockSize;
+
+  std::vector<std::unique_ptr<MemoryBlock>> m_blocks;
+};
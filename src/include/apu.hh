@@ -0,0 +1,316 @@
+#pragma once
+#include <array>
+#include <blip.hh>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <resampler.hh>
+#include <vector>
+
+// NTSC CPU 时钟，APU 的时间以 CPU cycle 计
+constexpr double NES_CPU_CLOCK_RATE = 1789773.0;
+//音频输出的采样率
+constexpr uint32_t AUDIO_SAMPLE_RATE = 48000;
+
+//没有安排的时间
+constexpr uint64_t APU_NO_STEP = UINT64_MAX;
+
+//混音结果 0 到 1 对应的振幅
+constexpr double APU_MIX_SCALE = 32767.0;
+
+/*
+ * 非线性混音的查找表，编译时生成
+ * pulse 的下标为 pulse1 + pulse2，tnd 的下标为 3 * triangle + 2 * noise + dmc，
+ * tnd 是 nesdev 上对公式的线性近似，和公式的差别不超过满幅的 2%，
+ * 混音只需要两次查表和一次加法，不需要除法。
+ */
+constexpr double ApuPulseCurve(uint32_t index) {
+  return index == 0 ? 0 : 95.52 / (8128.0 / index + 100);
+}
+constexpr double ApuTndCurve(uint32_t index) {
+  return index == 0 ? 0 : 163.67 / (24329.0 / index + 100);
+}
+
+template <size_t Size>
+constexpr std::array<int32_t, Size> MakeApuMixTable(double (*curve)(uint32_t)) {
+  std::array<int32_t, Size> table{};
+  for (uint32_t i = 0; i < Size; i++) {
+    table[i] = static_cast<int32_t>(curve(i) * APU_MIX_SCALE + 0.5);
+  }
+  return table;
+}
+
+constexpr auto APU_PULSE_TABLE = MakeApuMixTable<31>(ApuPulseCurve);
+constexpr auto APU_TND_TABLE = MakeApuMixTable<203>(ApuTndCurve);
+
+//各声道的输出为 DAC 的数值，pulse 和 noise 0-15，triangle 0-15，dmc 0-127
+inline int32_t MixApuOutputs(uint8_t pulse1, uint8_t pulse2, uint8_t triangle,
+                             uint8_t noise, uint8_t dmc) {
+  return APU_PULSE_TABLE[pulse1 + pulse2] +
+         APU_TND_TABLE[3 * triangle + 2 * noise + dmc];
+}
+
+//原始的浮点公式，每次混音有三次除法，用于对照查找表
+int32_t MixApuOutputsFormula(uint8_t pulse1, uint8_t pulse2, uint8_t triangle,
+                             uint8_t noise, uint8_t dmc);
+
+/*
+ * 包络，pulse 和 noise 使用，每个 quarter frame 更新一次
+ */
+struct ApuEnvelope {
+  bool start = false;
+  bool loop = false;
+  bool constantVolume = false;
+  uint8_t period = 0;
+  uint8_t divider = 0;
+  uint8_t decay = 0;
+
+  void Write(uint8_t value);
+  void Clock();
+  uint8_t Volume() const { return constantVolume ? period : decay; }
+};
+
+/*
+ * 每个声道的计时器都以 CPU cycle 计，NextStep 为下一次序列前进的时间。
+ * 输出不会变化的声道(长度计数为 0 等)不安排时间，避免频率很高但听不到的
+ * 计时器产生大量事件，寄存器写入或者 frame counter 之后由 Resume 重新安排。
+ */
+class PulseChannel {
+public:
+  //pulse 2 的 sweep 取反时使用二进制补码，pulse 1 使用反码
+  explicit PulseChannel(bool onesComplement) : m_onesComplement(onesComplement) {}
+
+  void WriteControl(uint8_t value);
+  void WriteSweep(uint8_t value);
+  void WriteTimerLow(uint8_t value);
+  //同时装载长度计数，声道关闭时不装载
+  void WriteTimerHigh(uint8_t value, bool enabled);
+
+  void ClockQuarterFrame() { m_envelope.Clock(); }
+  void ClockHalfFrame();
+
+  uint64_t NextStep() const { return Active() ? m_nextStep : APU_NO_STEP; }
+  void Step();
+  void Resume(uint64_t now);
+
+  uint8_t Output() const;
+  uint8_t length = 0;
+
+private:
+  bool Active() const { return length > 0 && m_timer >= 8; }
+  uint16_t SweepTarget() const;
+  bool SweepMuted() const;
+  uint64_t Period() const { return (m_timer + 1) * 2; }
+
+  bool m_onesComplement;
+  ApuEnvelope m_envelope;
+  bool m_lengthHalt = false;
+  uint8_t m_duty = 0;
+  uint8_t m_sequence = 0;
+  uint16_t m_timer = 0;
+  uint64_t m_nextStep = 0;
+
+  bool m_sweepEnabled = false;
+  bool m_sweepNegate = false;
+  bool m_sweepReload = false;
+  uint8_t m_sweepPeriod = 0;
+  uint8_t m_sweepShift = 0;
+  uint8_t m_sweepDivider = 0;
+};
+
+class TriangleChannel {
+public:
+  void WriteControl(uint8_t value);
+  void WriteTimerLow(uint8_t value);
+  void WriteTimerHigh(uint8_t value, bool enabled);
+
+  void ClockQuarterFrame();
+  void ClockHalfFrame();
+
+  uint64_t NextStep() const { return Active() ? m_nextStep : APU_NO_STEP; }
+  void Step() {
+    m_sequence = (m_sequence + 1) & 0x1F;
+    m_nextStep += Period();
+  }
+  void Resume(uint64_t now);
+
+  uint8_t Output() const;
+  uint8_t length = 0;
+
+private:
+  //计时器小于 2 时频率超出听觉范围，停在当前的输出
+  bool Active() const { return length > 0 && m_linearCounter > 0 && m_timer >= 2; }
+  uint64_t Period() const { return m_timer + 1; }
+
+  bool m_control = false;
+  bool m_linearReload = false;
+  uint8_t m_linearPeriod = 0;
+  uint8_t m_linearCounter = 0;
+  uint8_t m_sequence = 0;
+  uint16_t m_timer = 0;
+  uint64_t m_nextStep = 0;
+};
+
+class NoiseChannel {
+public:
+  void WriteControl(uint8_t value);
+  void WritePeriod(uint8_t value);
+  void WriteLength(uint8_t value, bool enabled);
+
+  void ClockQuarterFrame() { m_envelope.Clock(); }
+  void ClockHalfFrame();
+
+  uint64_t NextStep() const { return length > 0 ? m_nextStep : APU_NO_STEP; }
+  void Step();
+  void Resume(uint64_t now);
+
+  uint8_t Output() const;
+  uint8_t length = 0;
+
+private:
+  ApuEnvelope m_envelope;
+  bool m_lengthHalt = false;
+  bool m_shortMode = false;
+  uint16_t m_period = 4;
+  uint16_t m_shiftRegister = 1;
+  uint64_t m_nextStep = 0;
+};
+
+class DmcChannel {
+public:
+  void WriteControl(uint8_t value);
+  void WriteLevel(uint8_t value) { m_level = value & 0x7F; }
+  void WriteAddress(uint8_t value) { m_sampleAddress = 0xC000 | (value << 6); }
+  void WriteLength(uint8_t value) { m_sampleLength = (value << 4) | 1; }
+  //$4015 的 bit 4
+  void SetEnabled(bool enabled);
+
+  uint64_t NextStep() const { return m_nextStep; }
+  void Step();
+  void Resume(uint64_t now);
+
+  uint8_t Output() const { return m_level; }
+  bool Playing() const { return m_bytesRemaining > 0; }
+
+  bool irq = false;
+  //读取采样数据，没有设置时读到 0
+  std::function<uint8_t(uint16_t)> readMemory;
+
+private:
+  void FillBuffer();
+
+  bool m_irqEnabled = false;
+  bool m_loop = false;
+  uint16_t m_period = 428;
+  uint8_t m_level = 0;
+  uint16_t m_sampleAddress = 0xC000;
+  uint16_t m_sampleLength = 1;
+
+  uint16_t m_address = 0;
+  uint16_t m_bytesRemaining = 0;
+  uint8_t m_buffer = 0;
+  bool m_bufferFull = false;
+  uint8_t m_shiftRegister = 0;
+  uint8_t m_bitsRemaining = 8;
+  bool m_silence = true;
+  uint64_t m_nextStep = 0;
+};
+
+/*
+ * 2A03 APU
+ * 不按 CPU cycle 逐个生成采样，而是按事件推进：每次找出各个声道的计时器
+ * 和 frame counter 中最早的一个，只在输出可能变化的时刻计算混音，
+ * 把振幅的变化和时间一起交给 BlipBuffer 做带限合成，
+ * 输出采样率为 AUDIO_SAMPLE_RATE。
+ * 寄存器写入之前调用 RunUntil 把 APU 推进到写入的时间。
+ */
+class APU {
+public:
+  APU();
+
+  // $4000-$4013、$4015、$4017，写入发生在这一帧的第 cycle 个 CPU cycle
+  void WriteRegister(uint16_t address, uint8_t value, uint32_t cycle);
+  // $4015
+  uint8_t ReadStatus(uint32_t cycle);
+
+  // frame counter 或 DMC 的 IRQ
+  bool Irq() const { return m_frameIrq || m_dmc.irq; }
+
+  // DMC 读取 CPU 内存
+  void SetMemoryReader(std::function<uint8_t(uint16_t)> reader) {
+    m_dmc.readMemory = std::move(reader);
+  }
+
+  //运行到这一帧的第 cycle 个 CPU cycle
+  void RunUntil(uint32_t cycle);
+
+  //结束 cycles 个 CPU cycle 的一帧，之后可以读取这一帧的采样
+  void EndFrame(uint32_t cycles);
+
+  //输出采样率乘以 scale，用于动态调整音频缓冲的水位，需要在两帧之间调用
+  void SetSampleRateScale(double scale);
+
+  //为空时使用 BlipBuffer，否则每个 APU cycle 采样一次振幅，每帧结束时
+  //由多相 FIR 降到输出采样率，开销更大，需要在开始运行之前设置
+  void SetResampler(std::optional<ResamplerQuality> quality);
+
+  uint32_t SamplesAvailable() const;
+  uint32_t ReadSamples(int16_t *samples, uint32_t count);
+
+private:
+  void ClockFrameCounter();
+  //从现在开始新的序列
+  void ResetFrameCounter();
+  void ClockQuarterFrame();
+  void ClockHalfFrame();
+  void ResumeChannels();
+
+  //混音后的振幅，变化时加入 BlipBuffer
+  int32_t Mix() const;
+  void UpdateOutput();
+
+  //把这一帧的振幅变化展开为每个 APU cycle 的采样，重采样后去掉直流
+  void ResampleFrame(uint32_t cycles);
+
+private:
+  PulseChannel m_pulse1{true};
+  PulseChannel m_pulse2{false};
+  TriangleChannel m_triangle;
+  NoiseChannel m_noise;
+  DmcChannel m_dmc;
+  // $4015 中打开的声道
+  uint8_t m_enabled = 0;
+
+  bool m_fiveStep = false;
+  bool m_irqInhibit = false;
+  bool m_frameIrq = false;
+  uint8_t m_frameStep = 0;
+  //当前序列开始的时间和下一步的时间
+  uint64_t m_frameSequenceStart = 0;
+  uint64_t m_frameCounterNext = 0;
+
+  //上电以来的 CPU cycle 数，和这一帧开始的时间
+  uint64_t m_time = 0;
+  uint64_t m_frameStart = 0;
+
+  BlipBuffer m_blip;
+  int32_t m_amplitude = 0;
+  double m_sampleRateScale = 1.0;
+
+  //使用 Resampler 时，这一帧振幅变化的时间和变化后的振幅
+  struct AmplitudeStep {
+    uint64_t time;
+    int32_t amplitude;
+  };
+  std::unique_ptr<Resampler> m_resampler;
+  std::vector<AmplitudeStep> m_steps;
+  //这一帧开始时的振幅
+  int32_t m_frameAmplitude = 0;
+  std::vector<float> m_resamplerInput;
+  std::vector<float> m_resamplerOutput;
+  float m_dcLevel = 0;
+  //重采样的结果和已经读取的数量
+  std::vector<int16_t> m_samples;
+  uint32_t m_samplesRead = 0;
+};
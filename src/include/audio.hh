@@ -0,0 +1,63 @@
+#pragma once
+#include <QAudioOutput>
+#include <QIODevice>
+#include <audioring.hh>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+
+/*
+ * 16 位 PCM 的 WAV 文件，用于无窗口运行时保存声音
+ * 打开时先写入长度为 0 的文件头，Close 时回填 RIFF 和 data 的长度。
+ */
+class WavWriter {
+public:
+  //打开失败时抛出异常
+  WavWriter(const std::string &path, uint32_t sampleRate, uint16_t channels);
+  WavWriter(const WavWriter &) = delete;
+  WavWriter &operator=(const WavWriter &) = delete;
+  ~WavWriter() { Close(); }
+
+  // count 为采样数，多声道时交错排列
+  void Write(const int16_t *samples, uint32_t count);
+
+  //回填文件头并关闭，之后的写入被忽略
+  void Close();
+
+private:
+  void WriteHeader();
+
+  std::ofstream m_file;
+  uint32_t m_sampleRate;
+  uint16_t m_channels;
+  uint32_t m_dataBytes = 0;
+};
+
+/*
+ * Qt 的音频输出，pull 模式
+ * 音频设备的线程需要数据时从 AudioRing 中读取，缓冲不足时补静音，
+ * 模拟线程不会因为声音而等待。
+ */
+class AudioOutput : public QIODevice {
+public:
+  explicit AudioOutput(AudioRing &ring);
+  ~AudioOutput() override;
+
+  //打开默认的输出设备，设备不支持时只打印警告，不输出声音
+  void start();
+  void stop();
+
+  //补过静音的次数
+  uint64_t underruns() const { return m_underruns; }
+
+protected:
+  qint64 readData(char *data, qint64 maxSize) override;
+  qint64 writeData(const char *, qint64) override { return -1; }
+  qint64 bytesAvailable() const override;
+
+private:
+  AudioRing &m_ring;
+  std::unique_ptr<QAudioOutput> m_output;
+  uint64_t m_underruns = 0;
+};
@@ -0,0 +1,66 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/*
+ * 单生产者单消费者的无锁环形缓冲，保存单声道 16 位采样
+ * 模拟线程每帧写入 APU 的输出，音频设备的线程按需读取。
+ * 容量取 2 的幂，读写位置单调递增，用掩码取下标，满和空不需要额外标记。
+ * 双方都不会等待对方：写满时只写入能放下的部分，读空时返回实际读到的数量。
+ */
+class AudioRing {
+public:
+  //capacity 向上取 2 的幂
+  explicit AudioRing(uint32_t capacity) {
+    uint32_t size = 1;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    m_samples.resize(size);
+    m_mask = size - 1;
+  }
+  AudioRing(const AudioRing &) = delete;
+  AudioRing &operator=(const AudioRing &) = delete;
+
+  uint32_t Capacity() const { return m_mask + 1; }
+
+  //当前缓冲的采样数，双方都可以调用，结果可能立即过时
+  uint32_t Size() const {
+    return m_writePosition.load(std::memory_order_acquire) -
+           m_readPosition.load(std::memory_order_acquire);
+  }
+
+  //生产者线程: 写入 samples，返回实际写入的数量
+  uint32_t Write(const int16_t *samples, uint32_t count) {
+    auto write = m_writePosition.load(std::memory_order_relaxed);
+    auto read = m_readPosition.load(std::memory_order_acquire);
+    count = std::min(count, Capacity() - (write - read));
+    for (uint32_t i = 0; i < count; i++) {
+      m_samples[(write + i) & m_mask] = samples[i];
+    }
+    m_writePosition.store(write + count, std::memory_order_release);
+    return count;
+  }
+
+  //消费者线程: 最多读取 count 个，返回实际读取的数量
+  uint32_t Read(int16_t *samples, uint32_t count) {
+    auto read = m_readPosition.load(std::memory_order_relaxed);
+    auto write = m_writePosition.load(std::memory_order_acquire);
+    count = std::min(count, write - read);
+    for (uint32_t i = 0; i < count; i++) {
+      samples[i] = m_samples[(read + i) & m_mask];
+    }
+    m_readPosition.store(read + count, std::memory_order_release);
+    return count;
+  }
+
+private:
+  std::vector<int16_t> m_samples;
+  uint32_t m_mask = 0;
+
+  //读写位置在不同的 cache line，避免两个线程互相使对方的缓存失效
+  alignas(64) std::atomic<uint32_t> m_writePosition = 0;
+  alignas(64) std::atomic<uint32_t> m_readPosition = 0;
+};
@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+/*
+ * 带限合成缓冲，思路和 blargg 的 blip_buf 相同
+ * 声音的输入是若干时刻的振幅变化(delta)，而不是每个时钟的采样。
+ * 每个 delta 按照它在输出采样之间的位置，加上一段预先计算好的
+ * 带限阶跃的差分(加窗 sinc)，读取时对缓冲做累加得到采样，
+ * 所以输出没有混叠，开销只和振幅变化的次数有关。
+ * 读取时同时做一阶高通，去掉 APU 输出的直流分量。
+ *
+ * 时间以输入时钟计，每帧从 0 开始，EndFrame 之后这一帧的采样才可以读取。
+ */
+class BlipBuffer {
+public:
+  // maxFrameSamples 为一帧最多产生的采样数
+  BlipBuffer(double clockRate, double sampleRate, uint32_t maxFrameSamples);
+
+  //修改输入时钟和输出采样率的比例，之前加入的 delta 不受影响
+  void SetRates(double clockRate, double sampleRate);
+
+  //在这一帧的第 clock 个时钟，振幅变化 delta
+  void AddDelta(uint64_t clock, int32_t delta);
+
+  //结束长度为 clocks 个时钟的一帧
+  void EndFrame(uint64_t clocks);
+
+  //可以读取的采样数
+  uint32_t SamplesAvailable() const { return m_available; }
+
+  //最多读取 count 个采样，返回实际读取的数量
+  uint32_t ReadSamples(int16_t *samples, uint32_t count);
+
+  void Clear();
+
+private:
+  //采样位置的小数部分分成的相位数
+  static constexpr uint32_t PHASE_BITS = 6;
+  static constexpr uint32_t PHASE_COUNT = 1 << PHASE_BITS;
+  //每个阶跃影响的采样数
+  static constexpr uint32_t KERNEL_WIDTH = 16;
+  //缓冲中的 delta 放大 2^DELTA_BITS 倍
+  static constexpr uint32_t DELTA_BITS = 15;
+  //高通的时间常数为 2^BASS_SHIFT 个采样
+  static constexpr uint32_t BASS_SHIFT = 9;
+
+  // 32.32 定点数，每个时钟对应的采样数
+  uint64_t m_factor = 0;
+  //这一帧开始的位置，相对于第 m_available 个采样，只有小数部分
+  uint64_t m_offset = 0;
+  uint32_t m_available = 0;
+  std::vector<int32_t> m_buffer;
+  int64_t m_integrator = 0;
+};
@@ -0,0 +1,90 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <frame.hh>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class CaptureFormat {
+  // path 为目录，每帧一个 PNG，文件名为帧序号
+  Png,
+  // path 为文件，未压缩的 YUV 4:2:0
+  Y4m,
+  // 通过管道交给本地的 ffmpeg 进程，按 path 的扩展名选择容器和编码
+  // ffmpeg 提前退出时写入管道会产生 SIGPIPE，默认会结束整个进程，
+  // FrameCapture 不修改信号处理，使用者需要先忽略 SIGPIPE(见 main.cc)，
+  // 这样写入失败只会停止录制
+  Ffmpeg
+};
+
+struct CaptureConfig {
+  CaptureFormat format = CaptureFormat::Y4m;
+  std::string path;
+  //缓冲池的大小，编码线程最多落后这么多帧
+  uint32_t bufferCount = 16;
+};
+
+/*
+ * 后台录制
+ * 模拟线程把完成的画面复制到预先分配的缓冲中交给编码线程，编码完成后
+ * 缓冲回到空闲列表。模拟线程不分配内存也不等待编码，没有空闲缓冲时
+ * 直接丢弃这一帧并计数。
+ * 缓冲中保存的是 9 位颜色索引，调色板转换和编码都在编码线程中进行。
+ */
+class FrameCapture {
+public:
+  //打开输出并启动编码线程，失败时抛出异常
+  explicit FrameCapture(const CaptureConfig &config);
+  FrameCapture(const FrameCapture &) = delete;
+  FrameCapture &operator=(const FrameCapture &) = delete;
+  ~FrameCapture() { Stop(); }
+
+  //模拟线程调用，复制画面后立即返回
+  void Submit(const Frame &frame);
+
+  //写完已经提交的帧，关闭输出
+  void Stop();
+
+  uint64_t CapturedFrames() const { return m_capturedFrames; }
+  uint64_t DroppedFrames() const { return m_droppedFrames; }
+
+private:
+  void EncoderLoop();
+
+  //以下只在编码线程中调用
+  void Encode(const Frame &frame);
+  void WritePng(const Frame &frame);
+  void WriteY4m();
+
+private:
+  CaptureConfig m_config;
+
+  //所有缓冲，构造时分配
+  std::vector<std::unique_ptr<Frame>> m_buffers;
+
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  std::vector<Frame *> m_freeBuffers;
+  //等待编码的缓冲，容量为缓冲总数的环形队列
+  std::vector<Frame *> m_pendingBuffers;
+  uint32_t m_pendingHead = 0;
+  uint32_t m_pendingCount = 0;
+  bool m_running = true;
+  std::thread m_thread;
+
+  std::atomic<uint64_t> m_capturedFrames = 0;
+  std::atomic<uint64_t> m_droppedFrames = 0;
+
+  //编码线程使用
+  std::vector<uint32_t> m_rgba;
+  std::vector<uint8_t> m_yuv;
+  std::ofstream m_file;
+  FILE *m_pipe = nullptr;
+  bool m_failed = false;
+};
@@ -151,6 +151,9 @@ public:
 
   //开始执行内存中的代码
   void Run();
+
+  //执行一条指令，返回消耗的 cycle 数
+  int Step();
   /*
    * 需要根据寻址模式获取值并且递增当前的program counter
    * 首先获取opertor code 然后根据operator code 判断
@@ -159,7 +162,7 @@ public:
   uint8_t GetValue() { return 0; }
 
 public:
-  CPU() { InitInstructionSet(); };
+  CPU() : m_memory(0x10000) { InitInstructionSet(); };
   void test() {}
 
 private:
@@ -0,0 +1,14 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * CRC32C(Castagnoli)
+ * x86-64 上运行时检测 SSE4.2，支持时使用 crc32 指令，每次处理 8 字节，
+ * 否则使用查表实现，两者结果相同。
+ * 用来判断画面是否变化，不用于校验数据完整性。
+ */
+uint32_t Crc32c(const void *data, size_t size, uint32_t crc = 0);
+
+//查表实现，用于测试和不支持 SSE4.2 的机器
+uint32_t Crc32cPortable(const void *data, size_t size, uint32_t crc = 0);
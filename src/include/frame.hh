@@ -0,0 +1,44 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// NES 输出画面大小
+const uint32_t NES_FRAME_WIDTH = 256;
+const uint32_t NES_FRAME_HEIGHT = 240;
+
+/*
+ * 模拟线程产生的一帧画面
+ * 保存 PPU 输出的 9 位颜色索引，低 6 位为调色板颜色，高 3 位为
+ * emphasis(PPUMASK 的 bit 5-7)，上传时再转换为 RGBA。
+ */
+struct Frame {
+  std::array<uint16_t, NES_FRAME_WIDTH * NES_FRAME_HEIGHT> pixels{};
+
+  //从 1 开始递增的帧序号
+  uint64_t number = 0;
+
+  //每行 pixels 的 CRC32C，渲染线程据此只上传变化的行
+  std::array<uint32_t, NES_FRAME_HEIGHT> lineHashes{};
+
+  // lineHashes 的 CRC32C，代表整帧，渲染线程据此跳过没有变化的帧
+  uint32_t hash = 0;
+
+  //由模拟线程在发布前调用，根据 pixels 计算 lineHashes 和 hash
+  void UpdateHashes();
+};
+
+//连续的若干行
+struct LineRange {
+  uint32_t first;
+  uint32_t count;
+};
+
+/*
+ * 和 previous 相比内容变化的行，相邻的行合并为一个区间，结果写入 ranges
+ * previous 为 nullptr 时整帧作为一个区间
+ */
+void DirtyLineRanges(
+    const Frame &frame,
+    const std::array<uint32_t, NES_FRAME_HEIGHT> *previous,
+    std::vector<LineRange> &ranges);
@@ -0,0 +1,91 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#define VULKAN_HPP_NO_CONSTRUCTORS
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_raii.hpp>
+
+namespace raii = vk::raii;
+
+/*
+ * 统计提交到真正显示的延迟
+ * 依赖 VK_KHR_present_id 和 VK_KHR_present_wait，在单独的线程中对每个
+ * present id 调用 vkWaitForPresentKHR，得到从 queue submit 到图像显示的时间，
+ * 每 REPORT_INTERVAL 帧输出一次平均值和最大最小值。
+ * 同时记录最近一次显示完成的时间，并由相邻两次显示的间隔测量刷新周期，
+ * 模拟线程用它们把每一帧对齐到实际的 vblank。
+ */
+class PresentLatencyMonitor {
+public:
+  static constexpr uint32_t REPORT_INTERVAL = 120;
+  //测量刷新周期需要的间隔数，之前 presentTiming 返回 nullopt
+  static constexpr uint32_t MIN_PERIOD_SAMPLES = 120;
+
+  //最近一次显示完成的时间和测得的刷新周期
+  struct PresentTiming {
+    std::chrono::steady_clock::time_point time;
+    std::chrono::duration<double> refreshPeriod;
+  };
+
+  explicit PresentLatencyMonitor(const raii::Device &device);
+  ~PresentLatencyMonitor() { stop(); }
+
+  //开始等待 swapchain 上的 present，swapchain 重建前需要 stop
+  void start(vk::SwapchainKHR swapchain, std::string presentMode);
+  void stop();
+
+  //记录 present id 和对应的 submit 时间
+  void presented(uint64_t presentId,
+                 std::chrono::steady_clock::time_point submitTime);
+
+  //等待 presentId 对应的图像显示，返回显示完成的时间，超时返回 nullopt
+  std::optional<std::chrono::steady_clock::time_point>
+  waitPresented(uint64_t presentId, std::chrono::milliseconds timeout);
+
+  //样本不够时返回 nullopt
+  std::optional<PresentTiming> presentTiming();
+
+private:
+  struct PendingPresent {
+    uint64_t presentId;
+    std::chrono::steady_clock::time_point submitTime;
+  };
+
+  void run();
+  void record(std::chrono::steady_clock::duration latency);
+  //由相邻两次显示的间隔更新刷新周期，需要持有 m_mutex
+  void measureRefreshPeriod(std::chrono::steady_clock::time_point presentTime);
+
+private:
+  const raii::Device &m_device;
+  std::string m_presentMode;
+  vk::SwapchainKHR m_swapchain{nullptr};
+
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  //m_pending 和 m_running 由 m_mutex 保护
+  std::deque<PendingPresent> m_pending;
+  bool m_running = false;
+  std::thread m_thread;
+
+  //最近一次显示完成的 present id 和时间，由 m_mutex 保护
+  std::condition_variable m_presentedCondition;
+  uint64_t m_lastPresentedId = 0;
+  std::chrono::steady_clock::time_point m_lastPresentTime;
+  //测得的刷新周期和样本数，swapchain 重建时重新测量，由 m_mutex 保护
+  std::chrono::duration<double> m_refreshPeriod{};
+  uint32_t m_periodSamples = 0;
+
+  // 只在监控线程中访问
+  uint32_t m_sampleCount = 0;
+  std::chrono::steady_clock::duration m_total{};
+  std::chrono::steady_clock::duration m_min{};
+  std::chrono::steady_clock::duration m_max{};
+};
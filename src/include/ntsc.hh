@@ -0,0 +1,65 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <frame.hh>
+#include <span>
+#include <vector>
+#include <workerpool.hh>
+
+// NTSC 滤镜输出的宽度，每个 PPU 像素对应两个输出像素
+const uint32_t NTSC_OUTPUT_WIDTH = NES_FRAME_WIDTH * 2;
+
+struct NtscSetup {
+  //色相调整，单位为度
+  float hue = 0.0f;
+  //饱和度倍数
+  float saturation = 1.0f;
+};
+
+/*
+ * NTSC 复合视频滤镜，思路和 blargg 的 nes_ntsc 相同
+ * PPU 每个像素输出 8 个采样，色度副载波一个周期 12 个采样，每行的起始相位
+ * 比上一行前进 4，所以像素的相位只有 0、4、8 三种。对每种相位和每个 9 位
+ * 颜色，预先按照 nesdev 的信号电平生成采样，用 12 个采样的窗口解调为
+ * YIQ 再转换为 RGB，得到它对相邻 4 个输出像素的贡献(kernel)。
+ * 解调是线性的，所以每个输出像素等于两个相邻输入像素 kernel 的和，
+ * 运行时只需要查表和 SIMD 加法。
+ *
+ * 奇偶帧的相位相差 8，这里把两帧的 kernel 取平均(nes_ntsc 的 merge_fields)，
+ * 输出只取决于当前行的像素，不会闪烁，按行上传变化的部分依然有效。
+ * 有 SSE2 时每次处理两个输入像素，否则使用标量实现，两者的结果相同。
+ */
+class NtscFilter {
+public:
+  // useSimd 为 false 时总是使用标量实现，用于测试和对比
+  NtscFilter(WorkerPool &workerPool, const NtscSetup &setup = {},
+             bool useSimd = true);
+
+  //重新生成 kernel 表
+  void Setup(const NtscSetup &setup);
+
+  //处理 ranges 中的行，按行分段交给工作线程
+  //rgba 指向整帧输出的起始位置，每行 NTSC_OUTPUT_WIDTH 个像素
+  void Filter(const Frame &frame, std::span<const LineRange> ranges,
+              uint32_t *rgba);
+
+  //单线程处理一行
+  void FilterLine(const Frame &frame, uint32_t line, uint32_t *rgba) const;
+
+  bool Simd() const { return m_simd; }
+
+private:
+  //一个输入像素对 4 个输出像素的贡献，每个输出像素为 R G B A 四个 float
+  struct alignas(16) Kernel {
+    float values[4][4];
+  };
+
+  static constexpr uint32_t PHASE_COUNT = 3;
+  static constexpr uint32_t COLOR_COUNT = 512;
+
+  WorkerPool &m_workerPool;
+  std::vector<Kernel> m_kernels;
+  bool m_simd = false;
+  //复用的待处理行
+  std::vector<uint32_t> m_lines;
+};
@@ -0,0 +1,60 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <frame.hh>
+
+/*
+ * 2C02 调色板，0xRRGGBB
+ * 索引为 PPU 调色板内存中的 6 位颜色值
+ */
+constexpr std::array<uint32_t, 64> NES_PALETTE_RGB = {
+    0x666666, 0x002A88, 0x1412A7, 0x3B00A4, 0x5C007E, 0x6E0040, 0x6C0600,
+    0x561D00, 0x333500, 0x0B4800, 0x005200, 0x004F08, 0x00404D, 0x000000,
+    0x000000, 0x000000, 0xADADAD, 0x155FD9, 0x4240FF, 0x7527FE, 0xA01ACC,
+    0xB71E7B, 0xB53120, 0x994E00, 0x6B6D00, 0x388700, 0x0C9300, 0x008F32,
+    0x007C8D, 0x000000, 0x000000, 0x000000, 0xFFFEFF, 0x64B0FF, 0x9290FF,
+    0xC676FF, 0xF36AFF, 0xFE6ECC, 0xFE8170, 0xEA9E22, 0xBCBE00, 0x88D800,
+    0x5CE430, 0x45E082, 0x48CDDE, 0x4F4F4F, 0x000000, 0x000000, 0xFFFEFF,
+    0xC0DFFF, 0xD3D2FF, 0xE8C8FF, 0xFBC2FF, 0xFEC4EA, 0xFECCC5, 0xF7D8A5,
+    0xE4E594, 0xCFEF96, 0xBDF4AB, 0xB3F3CC, 0xB5EBF2, 0xB8B8B8, 0x000000,
+    0x000000};
+
+/*
+ * 9 位颜色索引到 RGBA(内存顺序 R G B A，对应 R8G8B8A8) 的转换表
+ * emphasis 位 bit6 强调红色，bit7 强调绿色，bit8 强调蓝色，
+ * 被强调颜色以外的分量衰减为约 0.81 倍。
+ */
+constexpr std::array<uint32_t, 512> MakeRGBAPalette() {
+  std::array<uint32_t, 512> result{};
+  for (uint32_t index = 0; index < result.size(); index++) {
+    auto rgb = NES_PALETTE_RGB[index & 0x3F];
+    uint32_t red = (rgb >> 16) & 0xFF;
+    uint32_t green = (rgb >> 8) & 0xFF;
+    uint32_t blue = rgb & 0xFF;
+
+    auto emphasis = index >> 6;
+    if (emphasis & 0x01) {
+      green = green * 13 / 16;
+      blue = blue * 13 / 16;
+    }
+    if (emphasis & 0x02) {
+      red = red * 13 / 16;
+      blue = blue * 13 / 16;
+    }
+    if (emphasis & 0x04) {
+      red = red * 13 / 16;
+      green = green * 13 / 16;
+    }
+    result[index] = 0xFF000000 | (blue << 16) | (green << 8) | red;
+  }
+  return result;
+}
+
+constexpr std::array<uint32_t, 512> NES_PALETTE_RGBA = MakeRGBAPalette();
+
+//把一帧颜色索引转换为 RGBA，rgba 需要 NES_FRAME_WIDTH * NES_FRAME_HEIGHT 个元素
+void ConvertFrame(const Frame &frame, uint32_t *rgba);
+
+//只转换 range 中的行，rgba 依然指向整帧的起始位置
+void ConvertLines(const Frame &frame, LineRange range, uint32_t *rgba);
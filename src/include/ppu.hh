@@ -0,0 +1,245 @@
+#pragma once
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <frame.hh>
+#include <span>
+#include <vector>
+
+class WorkerPool;
+
+// NTSC 每条扫描线的 dot 数和每帧的扫描线数，一个 CPU cycle 为 3 个 dot
+constexpr uint32_t PPU_DOTS_PER_SCANLINE = 341;
+constexpr uint32_t PPU_SCANLINES_PER_FRAME = 262;
+// vblank 开始的扫描线和 pre-render 扫描线
+constexpr uint32_t PPU_VBLANK_SCANLINE = 241;
+constexpr uint32_t PPU_PRERENDER_SCANLINE = 261;
+
+//每条扫描线最多显示的精灵数
+constexpr uint32_t SPRITES_PER_SCANLINE = 8;
+constexpr uint32_t OAM_SPRITE_COUNT = 64;
+
+//这一帧不会再发生的事件
+constexpr uint32_t PPU_NO_EVENT = UINT32_MAX;
+
+//nametable 的镜像方式，由卡带决定
+enum class Mirroring {
+  Horizontal,
+  Vertical,
+  SingleScreenLow,
+  SingleScreenHigh,
+  FourScreen
+};
+
+//一条扫描线上显示的精灵，按 OAM 顺序排列，序号小的优先
+struct ScanlineSprites {
+  uint8_t count = 0;
+  std::array<uint8_t, SPRITES_PER_SCANLINE> indices{};
+  //评估这条线的精灵时硬件会设置 sprite overflow
+  bool overflow = false;
+  //在上一条扫描线的这个 dot 设置 overflow
+  uint16_t overflowDot = 0;
+};
+
+/*
+ * 2C02 PPU，按扫描线渲染
+ * 模拟线程每运行完一条扫描线的 CPU cycle 调用一次 RunScanline，
+ * 这条扫描线期间对寄存器的写入对整条扫描线生效。
+ * 滚动使用 loopy 的 v t x w 寄存器模型，和硬件在第 256、257 dot 以及
+ * pre-render 扫描线上对 v 的更新一致。
+ *
+ * 精灵评估不在每条扫描线扫描 64 个 OAM，而是在 OAM 或者精灵高度变化后
+ * 把精灵一次性分到它们出现的扫描线上，渲染时只处理这条线上的精灵。
+ * 每条线最多 8 个，sprite overflow 按照硬件的错误行为计算：
+ * 找到 8 个之后继续检查时 OAM 中的字节偏移也会递增。
+ *
+ * 背景按照 4 个 nametable 的排列缓存为 512x480 的调色板序号，渲染一条
+ * 扫描线只需要按照 v 和 fine x 从缓存中复制一行。写入 nametable、属性表
+ * 或者 pattern 时只让用到它们的 tile 失效，下次用到时重新解码，只有滚动
+ * 的帧不需要解码任何 tile。
+ * 帧中途切换背景 pattern table 时缓存和之后的扫描线不一致，
+ * 这一帧剩下的扫描线改为逐个 tile 解码，下一帧开始前再切换缓存。
+ *
+ * 并行渲染时 CPU 对寄存器的访问连同所在的扫描线记录下来，可见扫描线
+ * 只更新 v 和状态，不生成画面。pre-render 扫描线结束后每个线程持有的
+ * PPU 副本按顺序重放整帧的访问记录，只渲染分给自己的一段扫描线。
+ *
+ * sprite 0 hit 和 sprite overflow 不等到渲染时才设置，而是根据当前的
+ * OAM、tile 和背景预测这一帧中发生的 dot，作为事件交给模拟线程，
+ * CPU 运行到这个 dot 时设置。寄存器访问后重新预测。CPU 轮询 $2002 时
+ * 不需要让 PPU 追赶，并行渲染时也不需要立即渲染 sprite 0 所在的扫描线。
+ */
+class PPU {
+public:
+  PPU();
+
+  //没有 CHR ROM 的卡带使用 8KB CHR RAM
+  void LoadChr(std::span<const uint8_t> chr);
+  void SetMirroring(Mirroring mirroring);
+
+  //背景缓存默认打开，关闭后每条扫描线都从 nametable 解码
+  void SetBackgroundCache(bool enabled);
+
+  //在 workerPool 上按扫描线分段并行渲染，为 nullptr 时在模拟线程中逐行渲染
+  //需要在一帧开始之前调用，workerPool 在关闭之前保持有效
+  void SetParallelRendering(WorkerPool *workerPool);
+
+  // CPU 读写 $2000-$3FFF，只使用地址的低 3 位
+  uint8_t ReadRegister(uint16_t address);
+  void WriteRegister(uint16_t address, uint8_t value);
+
+  // $4014，page 为 CPU 内存中的 256 字节
+  void WriteOamDma(std::span<const uint8_t, 256> page);
+
+  //完成第 line 条扫描线，可见扫描线的画面写入 frame
+  void RunScanline(uint32_t line, Frame &frame);
+
+  // vblank 开始时 PPUCTRL 允许 NMI 则返回 true，读取后清除
+  bool TakeNmi();
+
+  //下一个事件在这一帧中的 dot，第 line 条扫描线的第 dot 个 dot 为
+  //line * PPU_DOTS_PER_SCANLINE + dot，没有时为 PPU_NO_EVENT
+  uint32_t NextEventDot();
+  //运行到 dot 为止的事件，设置 PPUSTATUS 中对应的位
+  void RunEvents(uint32_t dot);
+
+  //第 line 条可见扫描线上的精灵，OAM 变化后第一次调用时重新分组
+  const ScanlineSprites &SpritesOnLine(uint32_t line);
+
+private:
+  // CPU 对 PPU 的一次访问，读取也会改变 w 和 v，同样需要记录
+  struct RegisterAccess {
+    enum class Kind : uint8_t { Read, Write, Mirroring, Chr };
+    //访问时 CPU 所在的扫描线
+    uint16_t line;
+    Kind kind;
+    uint8_t address;
+    // Write 写入的值，Mirroring 时为镜像方式
+    // Chr 的数据按顺序保存在 m_chrLog 中
+    uint8_t value;
+  };
+
+  void LogAccess(RegisterAccess::Kind kind, uint8_t address, uint8_t value);
+
+  //这条可见扫描线是否需要在 RunScanline 中渲染
+  bool ShouldRender(uint32_t line) const;
+
+  //从当前扫描线开始预测 sprite 0 hit 和 overflow 的 dot
+  void PredictEvents();
+  //扫描线开始时 v 为 v，sprite 0 hit 的 x，没有时为 NES_FRAME_WIDTH
+  uint32_t SpriteZeroHitX(uint32_t line, uint16_t v);
+
+  //在各个副本中重放这一帧的访问记录，渲染整帧
+  void RenderBands(Frame &frame);
+  void Replay(const std::vector<RegisterAccess> &accesses,
+              std::span<const std::vector<uint8_t>> chrLoads, Frame &frame);
+
+  uint8_t ReadVram(uint16_t address) const;
+  void WriteVram(uint16_t address, uint8_t value);
+  uint16_t NametableIndex(uint16_t address) const;
+  static uint8_t PaletteIndex(uint16_t address);
+
+  bool RenderingEnabled() const { return (m_mask & 0x18) != 0; }
+  uint32_t SpriteHeight() const { return (m_ctrl & 0x20) ? 16 : 8; }
+
+  //把 OAM 中的精灵分到扫描线上，并找出设置 sprite overflow 的扫描线
+  void BuildSpriteLists();
+
+  //按照 v 和 fine x 渲染一行背景，结果为 0-15 的调色板序号，0 为透明
+  void RenderBackground(uint16_t v,
+                        std::array<uint8_t, NES_FRAME_WIDTH> &background);
+  void DecodeBackground(uint16_t v,
+                        std::array<uint8_t, NES_FRAME_WIDTH> &background) const;
+  void ComposeBackground(uint16_t v,
+                         std::array<uint8_t, NES_FRAME_WIDTH> &background);
+
+  // v 的低 12 位指向的 tile 的属性，已经左移 2 位
+  uint8_t BackgroundPalette(uint16_t v) const;
+  //解码一行 tile 的 8 个像素
+  void DecodeTileRow(uint16_t pattern, uint16_t fineY, uint8_t palette,
+                     uint8_t *pixels) const;
+
+  //解码缓存中的一个 tile
+  void DecodeCacheTile(uint32_t tile);
+  //写入 nametable 或属性表后，让所有镜像到这里的 tile 失效
+  void InvalidateNametable(uint16_t address);
+  void InvalidateCache();
+  //背景使用的 pattern table 的第一个 tile 序号
+  uint16_t BackgroundPatternTable() const;
+  //不在帧中间时让缓存使用 PPUCTRL 选择的 pattern table
+  void SyncCachePatternTable();
+  //当前 CPU 所在的扫描线是否处于可见扫描线的中间
+  bool MidFrame() const;
+
+  //第 index 个精灵在第 line 条扫描线上的 8 个像素，已经处理翻转，0 为透明
+  void DecodeSpriteRow(uint32_t index, uint32_t line,
+                       std::array<uint8_t, 8> &pixels) const;
+
+  //在背景上叠加精灵并转换为 9 位颜色
+  void RenderSprites(uint32_t line,
+                     const std::array<uint8_t, NES_FRAME_WIDTH> &background,
+                     uint16_t *pixels);
+
+  void RenderScanline(uint32_t line, uint16_t *pixels);
+
+  // v 的更新，和硬件在渲染过程中的行为一致
+  static void IncrementY(uint16_t &v);
+  void CopyHorizontal(uint16_t &v) const;
+  void CopyVertical(uint16_t &v) const;
+
+private:
+  std::array<uint8_t, 0x2000> m_patterns{};
+  // 4 个 nametable，只有 FourScreen 使用后两个
+  std::array<uint8_t, 0x1000> m_nametables{};
+  std::array<uint8_t, 32> m_palette{};
+  std::array<uint8_t, 256> m_oam{};
+  Mirroring m_mirroring = Mirroring::Horizontal;
+  bool m_chrRam = true;
+
+  uint8_t m_ctrl = 0;
+  uint8_t m_mask = 0;
+  uint8_t m_status = 0;
+  uint8_t m_oamAddress = 0;
+  // PPUDATA 读取的缓冲
+  uint8_t m_readBuffer = 0;
+
+  // loopy 寄存器，v 为当前 VRAM 地址，t 为临时地址
+  uint16_t m_v = 0;
+  uint16_t m_t = 0;
+  uint8_t m_fineX = 0;
+  bool m_writeToggle = false;
+  bool m_nmi = false;
+
+  std::array<ScanlineSprites, NES_FRAME_HEIGHT> m_scanlineSprites{};
+  bool m_spriteListsDirty = true;
+
+  //下一次 RunScanline 的扫描线，CPU 正在运行这条线的 cycle
+  uint32_t m_scanline = 0;
+
+  //预测的事件，寄存器访问后失效
+  bool m_eventsPredicted = false;
+  uint32_t m_spriteZeroHitDot = PPU_NO_EVENT;
+  uint32_t m_overflowDot = PPU_NO_EVENT;
+
+  // 4 个 nametable 拼成的背景，每个像素和 RenderBackground 的结果相同
+  std::vector<uint8_t> m_backgroundCache;
+  //缓存中每个 tile 解码时使用的 pattern tile 序号，0xFFFF 表示需要解码
+  std::vector<uint16_t> m_cacheTiles;
+  //写入过的 pattern tile，下一次使用缓存前让用到它们的 tile 失效
+  std::bitset<512> m_dirtyPatterns;
+  bool m_patternsDirty = false;
+  bool m_cacheEnabled = true;
+  //缓存中 tile 使用的 pattern table，和 PPUCTRL 不一致时直接解码
+  uint16_t m_cachePatternTable = 0;
+
+  //串行渲染时渲染的可见扫描线 [m_bandFirst, m_bandEnd)
+  uint32_t m_bandFirst = 0;
+  uint32_t m_bandEnd = NES_FRAME_HEIGHT;
+  //并行渲染使用
+  WorkerPool *m_workerPool = nullptr;
+  std::vector<PPU> m_replicas;
+  std::vector<RegisterAccess> m_accessLog;
+  //这一帧中 LoadChr 的数据，前 m_chrLogCount 个有效，保留容量重复使用
+  std::vector<std::vector<uint8_t>> m_chrLog;
+  uint32_t m_chrLogCount = 0;
+};
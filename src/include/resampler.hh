@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+//重采样的质量，对应 FIR 覆盖的 sinc 过零点数和通带宽度
+enum class ResamplerQuality {
+  // 8 个过零点，通带到输出 Nyquist 的 80%
+  Low,
+  // 16 个过零点，85%
+  Medium,
+  // 32 个过零点，90%
+  High
+};
+
+/*
+ * 多相 FIR 重采样，用于把 APU 按 CPU cycle 采样的振幅降到输出采样率
+ * 滤波器是加 Blackman 窗的 sinc，截止频率按输出采样率确定，预先计算
+ * PHASE_COUNT 个相位的系数，输出位置的小数部分选择其中一个相位，
+ * 每个输出采样是一段输入和一组系数的点积。
+ * 每次处理一整帧的输入，末尾不够一个滤波器长度的输入留到下一帧。
+ * 点积按 8 个 float 对齐，x86-64 上运行时检测 AVX2 和 FMA，否则使用标量实现。
+ */
+class Resampler {
+public:
+  // useSimd 为 false 时总是使用标量实现，用于测试和对比
+  Resampler(double inputRate, double outputRate, ResamplerQuality quality,
+            bool useSimd = true);
+
+  //修改输入和输出的比例，滤波器不变，用于动态采样率控制的微调
+  void SetRates(double inputRate, double outputRate);
+
+  //处理 count 个输入，结果写入 output，返回输出的采样数
+  uint32_t Process(const float *input, uint32_t count, float *output);
+
+  // count 个输入最多产生的输出数
+  uint32_t MaxOutput(uint32_t count) const;
+
+  //每个输出采样的乘加次数
+  uint32_t Taps() const { return m_taps; }
+  bool Simd() const { return m_simd; }
+
+  void Clear();
+
+  //处理一段输入的实现，position 为 32.32 定点数，返回输出的采样数
+  using Kernel = uint32_t (*)(const float *input, uint32_t count,
+                              const float *coefficients, uint32_t taps,
+                              uint64_t &position, uint64_t step,
+                              float *output);
+
+private:
+  //小数位置分成的相位数
+  static constexpr uint32_t PHASE_BITS = 7;
+  static constexpr uint32_t PHASE_COUNT = 1 << PHASE_BITS;
+
+  uint32_t m_taps = 0;
+  // PHASE_COUNT 组系数，每组 m_taps 个
+  std::vector<float> m_coefficients;
+  Kernel m_kernel = nullptr;
+  bool m_simd = false;
+
+  //每个输出前进的输入数，32.32 定点数
+  uint64_t m_step = 0;
+  //下一个输出的第一个输入在 m_buffer 中的位置
+  uint64_t m_position = 0;
+  //上一帧留下的输入和这一帧的输入
+  std::vector<float> m_buffer;
+};
@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdint>
+#include <frame.hh>
+#include <span>
+#include <vector>
+#include <workerpool.hh>
+
+// CPU 上的像素画放大算法
+enum class ScaleFilter {
+  None,
+  // AdvMAME2x，只复制邻居像素，不产生新颜色
+  Scale2x,
+  // AdvMAME3x
+  Scale3x,
+  // Hyllian 的 xBR 2x，按 YUV 距离判断边缘方向并混合颜色
+  Xbr2x
+};
+
+//放大倍数，None 为 1
+uint32_t ScaleFactor(ScaleFilter filter);
+
+/*
+ * 调色板转换之后、上传之前的放大步骤，离屏截图和不能依赖 shader 的环境使用
+ * 源画面复制到四周扩展了 PADDING 个像素的缓冲区中，边缘像素重复，内层循环
+ * 读取邻居时不需要判断边界。每行按 AVX2/SSE4.1 一次处理 8/4 个像素，
+ * 运行时根据 CPU 选择，行按段交给 WorkerPool。
+ * 输出像素只取决于源画面中半径为 1(xBR 为 2)以内的像素，所以只需要重新计算
+ * 变化的行和它们的邻居。
+ */
+class PixelScaler {
+public:
+  PixelScaler(WorkerPool &workerPool, ScaleFilter filter);
+
+  uint32_t Factor() const { return ScaleFactor(m_filter); }
+
+  //输出画面每行的像素数
+  uint32_t OutputWidth() const { return NES_FRAME_WIDTH * Factor(); }
+
+  //source 为整帧的 RGBA，ranges 为其中变化的行，第一次调用需要是整帧
+  //结果写入 output 中对应的位置，返回时 ranges 变为 output 中被改写的行
+  void Scale(const uint32_t *source, std::vector<LineRange> &ranges,
+             uint32_t *output);
+
+private:
+  //处理一行源画面，source 和 yuv 指向扩展缓冲区中这一行的第一个像素，
+  //output 指向这一行对应的第一行输出
+  using LineKernel = void (*)(const uint32_t *source, const uint32_t *yuv,
+                              uint32_t *output);
+
+  //把变化的行复制到扩展缓冲区，并补上边缘
+  void UpdateSource(const uint32_t *source, std::span<const LineRange> ranges);
+
+private:
+  WorkerPool &m_workerPool;
+  ScaleFilter m_filter;
+  LineKernel m_kernel = nullptr;
+
+  std::vector<uint32_t> m_source;
+  // xBR 比较颜色使用的 YUV，布局和 m_source 相同
+  std::vector<uint32_t> m_yuv;
+  //复用的待处理行
+  std::vector<uint32_t> m_lines;
+};
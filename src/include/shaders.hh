@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+
+/*
+ * 构建时由 glslc 把 src/shaders 下的 shader 编译成 SPIR-V，
+ * 以逗号分隔的 32 位数字输出到 <name>.inc，这里直接嵌入为常量数组，
+ * 运行时不需要读取文件。见 src/CMakeLists.txt
+ */
+namespace shaders {
+
+constexpr uint32_t presentVert[] = {
+#include "present.vert.inc"
+};
+
+constexpr uint32_t presentFrag[] = {
+#include "present.frag.inc"
+};
+
+} // namespace shaders
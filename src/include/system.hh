@@ -1,11 +1,151 @@
 #pragma once
+#include <apu.hh>
+#include <atomic>
+#include <audioring.hh>
+#include <chrono>
+#include <condition_variable>
+#include <cpu.hh>
+#include <frame.hh>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ppu.hh>
+#include <thread>
+#include <triplebuffer.hh>
+#include <workerpool.hh>
+
+class FrameCapture;
 
 /*
  * system 主要是用来负责控制各个部分模块，控制各个模块的运行，窗口显示之类的。
  * 用来读取文件之类的。
+ * 模拟在独立的线程中运行，每帧结果通过三缓冲交给渲染线程，
+ * 两边互不等待。
+ * 模拟的帧率是唯一的节奏来源，每完成一帧通知渲染线程绘制一次，
+ * 暂停时不再产生画面，渲染也随之停止。
+ * 显示器测得的刷新周期和 NES 接近时，每一帧都对齐到离原定时间最近的
+ * 一次实际 vblank，周期的误差和两边时钟的漂移不会累积，正常情况下每次
+ * 刷新有一帧新的画面，但线程唤醒或者渲染来不及时仍然可能重复或跳过一帧。
+ * 这样模拟和声卡的时钟不再一致，由动态采样率控制补偿：根据音频缓冲的
+ * 水位把 APU 的输出采样率调整最多 ±0.5%，缓冲既不会耗尽也不会堆积。
 */
 class System{
+public:
+  // NTSC 每帧的 CPU cycle 数 1789773 / 60.0988
+  static constexpr int CPU_CYCLES_PER_FRAME = 29781;
+  static constexpr double NES_FRAME_RATE =
+      NES_CPU_CLOCK_RATE / CPU_CYCLES_PER_FRAME;
+
+  //音频环形缓冲的容量，约 170ms
+  static constexpr uint32_t AUDIO_RING_SAMPLES = 8192;
+  //动态采样率控制的目标水位，约 50ms
+  static constexpr uint32_t AUDIO_TARGET_SAMPLES = AUDIO_SAMPLE_RATE / 20;
+  //输出采样率最多调整的比例，音高的变化听不出来
+  static constexpr double MAX_AUDIO_RATE_ADJUST = 0.005;
+
+  //落后超过这么多帧时不再追赶，重新对齐时钟
+  static constexpr int MAX_FRAMES_BEHIND = 4;
+
+  //显示器最近一次 vblank 的时间和刷新周期
+  struct VsyncTiming {
+    std::chrono::steady_clock::time_point time;
+    std::chrono::duration<double> period;
+  };
+
+  System() = default;
+  System(const System &) = delete;
+  System &operator=(const System &) = delete;
+  ~System() { Stop(); }
+
+  //启动模拟线程，startTime 是第一帧开始的时间，通常对齐到显示器的 vblank
+  void Start(std::chrono::steady_clock::time_point startTime =
+                 std::chrono::steady_clock::now());
+
+  //停止模拟线程并等待退出
+  void Stop();
+
+  //不启动模拟线程，在调用线程中模拟一帧并发布，用于无窗口运行和测试
+  void StepFrame();
+
+  //暂停时模拟线程阻塞等待，恢复后从当前时间重新计时
+  void SetPaused(bool paused);
+  bool Paused();
+
+  //每发布一帧在模拟线程中调用一次，需要在 Start 之前设置
+  void SetFrameCallback(std::function<void()> callback) {
+    m_frameCallback = std::move(callback);
+  }
+
+  //窗口最小化或者被遮挡时模拟和声音照常运行，但不再调用 frame callback，
+  //渲染线程不会每帧被唤醒，可以在任意线程调用
+  void SetDisplayVisible(bool visible) { m_displayVisible = visible; }
+
+  //每完成一帧复制一份交给 capture，为 nullptr 时不录制，需要在 Start 之前设置
+  void SetCapture(FrameCapture *capture) { m_capture = capture; }
+
+  //每帧结束时在模拟线程中查询，周期和 NES 的帧率相差在采样率的调整范围内时
+  //按实际的 vblank 安排下一帧，否则或者返回 nullopt 时按 NES 的帧率运行
+  //需要在 Start 之前设置
+  void SetVsyncSource(std::function<std::optional<VsyncTiming>()> source) {
+    m_vsyncSource = std::move(source);
+  }
+
+  //APU 的输出使用多相 FIR 重采样，为空时使用 BlipBuffer，需要在 Start 之前设置
+  void SetAudioResampler(std::optional<ResamplerQuality> quality) {
+    m_apu.SetResampler(quality);
+  }
+
+  // PPU 在 threads 个线程上分段并行渲染，小于 2 时在模拟线程中逐行渲染
+  //需要在 Start 之前设置
+  void SetPpuThreads(uint32_t threads);
+
+  //渲染线程从这里读取最新完成的画面
+  TripleBuffer<Frame> &Frames() { return m_frames; }
+
+  //音频输出从这里读取 APU 的采样，单声道 AUDIO_SAMPLE_RATE
+  AudioRing &Audio() { return m_audio; }
+
+private:
+  void EmulationLoop(std::chrono::steady_clock::time_point startTime);
+
+  //暂停时阻塞，发生过暂停返回 true
+  bool WaitWhilePaused();
+
+  //模拟一帧，每条扫描线先运行对应的 CPU cycle，再由 PPU 完成这条线
+  void RunFrame(Frame &frame);
+
+  //把 APU 这一帧的采样放入音频缓冲，放不下的丢弃
+  void DrainAudio();
+
+  //按音频缓冲的水位调整下一帧的输出采样率，只在实时运行时使用
+  void AdjustAudioRate();
+
+  //可以用来安排下一帧的 vblank，刷新周期和 NES 相差太大时返回 nullopt
+  std::optional<VsyncTiming> DisplayVsync();
+
 private:
   //用来控制文件模块
 
+  CPU m_cpu;
+  // PPU 并行渲染使用，和渲染线程的 WorkerPool 分开
+  std::unique_ptr<WorkerPool> m_ppuWorkerPool;
+  PPU m_ppu;
+  APU m_apu;
+  AudioRing m_audio{AUDIO_RING_SAMPLES};
+  //当前扫描线还没有被 CPU 消耗的 dot，CPU 指令跨越扫描线时为负数
+  int m_dotBudget = 0;
+  TripleBuffer<Frame> m_frames;
+  std::function<void()> m_frameCallback;
+  std::atomic<bool> m_displayVisible = true;
+  std::function<std::optional<VsyncTiming>()> m_vsyncSource;
+  FrameCapture *m_capture = nullptr;
+
+  std::atomic<bool> m_running = false;
+  std::thread m_thread;
+  uint64_t m_frameNumber = 0;
+
+  std::mutex m_pauseMutex;
+  std::condition_variable m_pauseCondition;
+  bool m_paused = false;
 };
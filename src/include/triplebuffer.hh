@@ -0,0 +1,51 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+/*
+ * 单生产者单消费者的无锁三缓冲
+ * 生产者总有一个可写的缓冲，写完后和中间缓冲交换；消费者取数据时把中间
+ * 缓冲交换到读缓冲。双方都不会等待对方，消费者总是拿到最新发布的数据，
+ * 来不及读取的旧数据直接被覆盖。
+ */
+template <typename T> class TripleBuffer {
+public:
+  TripleBuffer() = default;
+  TripleBuffer(const TripleBuffer &) = delete;
+  TripleBuffer &operator=(const TripleBuffer &) = delete;
+
+  //生产者线程: 当前可写的缓冲
+  T &WriteBuffer() { return m_buffers[m_writeIndex]; }
+
+  //生产者线程: 发布写好的缓冲，换回上一次的中间缓冲继续写
+  void Publish() {
+    auto previous =
+        m_middle.exchange(m_writeIndex | FRESH_BIT, std::memory_order_acq_rel);
+    m_writeIndex = previous & INDEX_MASK;
+  }
+
+  //消费者线程: 有新发布的数据时交换到读缓冲并返回 true
+  bool Update() {
+    if ((m_middle.load(std::memory_order_relaxed) & FRESH_BIT) == 0) {
+      return false;
+    }
+    auto previous = m_middle.exchange(m_readIndex, std::memory_order_acq_rel);
+    m_readIndex = previous & INDEX_MASK;
+    return true;
+  }
+
+  //消费者线程: 最近一次 Update 得到的数据
+  const T &ReadBuffer() const { return m_buffers[m_readIndex]; }
+
+private:
+  static constexpr uint8_t INDEX_MASK = 0x03;
+  //中间缓冲是否是还没有被读取的新数据
+  static constexpr uint8_t FRESH_BIT = 0x04;
+
+  std::array<T, 3> m_buffers{};
+
+  uint8_t m_writeIndex = 0;
+  std::atomic<uint8_t> m_middle{1};
+  uint8_t m_readIndex = 2;
+};
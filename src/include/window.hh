@@ -1,14 +1,20 @@
 #pragma once
 #include <cstddef>
 
+#include <chrono>
+#include <cmath>
 #include <cstdint>
+#include <cstring>
 #define VULKAN_HPP_NO_CONSTRUCTORS
+#include <filesystem>
+#include <fmt/format.h>
 #include <fstream>
-#include <glm/glm.hpp>
 #include <iostream>
 #include <iterator>
+#include <memory>
 #include <optional>
 #include <set>
+#include <span>
 #include <spdlog/spdlog.h>
 #include <stdexcept>
 #include <string>
@@ -16,13 +22,48 @@
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_raii.hpp>
 
+#include <allocator.hh>
+#include <audio.hh>
+#include <capture.hh>
+#include <frame.hh>
+#include <latency.hh>
+#include <ntsc.hh>
+#include <palette.hh>
+#include <scaler.hh>
+#include <system.hh>
+#include <triplebuffer.hh>
+#include <workerpool.hh>
+
+#include <QKeyEvent>
+#include <QMetaObject>
 #include <QPlatformSurfaceEvent>
 #include <QVulkanInstance>
 #include <QWindow>
 
 namespace raii = vk::raii;
 
-const int MAX_FRAMES_IN_FLIGHT = 2;
+//frames in flight 的上限，实际数量由 RenderConfig 决定
+const int MAX_FRAMES_IN_FLIGHT = 3;
+
+//和延迟相关的渲染设置
+struct RenderConfig {
+  //设备不支持时回退到 FIFO
+  vk::PresentModeKHR presentMode = vk::PresentModeKHR::eMailbox;
+  // 1 到 MAX_FRAMES_IN_FLIGHT，越少延迟越低，但 CPU 和 GPU 并行度越低
+  uint32_t framesInFlight = 2;
+  //只按整数倍放大，窗口小于 1 倍时退化为按比例缩放
+  bool integerScale = true;
+  //采样 NES 画面使用的过滤方式
+  vk::Filter filter = vk::Filter::eNearest;
+  //上传前经过 NTSC 滤镜，画面宽度变为 NTSC_OUTPUT_WIDTH
+  bool ntsc = false;
+  //上传前在 CPU 上放大画面，离屏截图不依赖 shader 也能得到平滑的边缘
+  //和 ntsc 同时开启时忽略
+  ScaleFilter scaler = ScaleFilter::None;
+};
+
+// NES 画面在 target 中显示的区域，保持宽高比并居中
+vk::Rect2D computePresentRect(vk::Extent2D target, bool integerScale);
 
 struct QueueFamilyIndices {
   std::optional<uint32_t> graphicsFamily;
@@ -38,41 +79,13 @@ struct SwapChainSupportDetails {
   std::vector<vk::PresentModeKHR> presentModes;
 };
 
-//顶点
-struct Vertex {
-  glm::vec2 pos;
-  glm::vec3 color;
-
-  static vk::VertexInputBindingDescription getBindingDescription() {
-    vk::VertexInputBindingDescription bindingDescription{
-        .binding = 0,
-        .stride = sizeof(Vertex),
-        .inputRate = vk::VertexInputRate::eVertex};
-    return bindingDescription;
-  }
-
-  static std::array<vk::VertexInputAttributeDescription, 2>
-  getAttributeDescriptions() {
-    std::array<vk::VertexInputAttributeDescription, 2> attributeDescriptions{};
-
-    attributeDescriptions[0].binding = 0;
-    attributeDescriptions[0].location = 0;
-    attributeDescriptions[0].format = ::vk::Format::eR32G32Sfloat;
-    attributeDescriptions[0].offset = offsetof(Vertex, pos);
-
-    attributeDescriptions[1].binding = 0;
-    attributeDescriptions[1].location = 1;
-    attributeDescriptions[1].format = ::vk::Format::eR32G32B32Sfloat;
-    attributeDescriptions[1].offset = offsetof(Vertex, color);
-
-    return attributeDescriptions;
-  }
-};
-
 class VulkanWindow {
 public:
   VulkanWindow() = default;
 
+  //需要在 initVulkanOther 之前设置
+  void setRenderConfig(const RenderConfig &config);
+
   void initInstance(std::vector<std::string> &&extensions) {
 
     m_instanceExtensions = extensions;
@@ -83,12 +96,46 @@ public:
   void initWindow(QWindow *window) { m_window = window; }
 
   void initVulkanOther(const VkSurfaceKHR &surface);
+
+  //不创建 swapchain，渲染到 width x height 的 image，用于 CI 和没有显示器的机器
+  //可以使用 lavapipe 之类的 CPU 实现，需要在 initInstance 之后调用
+  void initOffscreen(uint32_t width, uint32_t height);
+
+  //离屏模式下同步渲染一帧并读回，pixels 为 RGBA8，大小为 width * height
+  void renderOffscreen(std::span<uint32_t> pixels);
+
+  vk::Extent2D extent() const { return m_swapChainExtent; }
+
+  //切换采样方式，等待 GPU 空闲后更新 descriptor set 并重新记录 command buffer
+  void setFilter(vk::Filter filter);
+  vk::Filter filter() const { return m_config.filter; }
+  std::string deviceName() const { return m_deviceProperties.deviceName; }
   VkInstance getVulkanInstance() { return *m_instance; }
   void waitDrawClean() { m_device.waitIdle(); };
   void cleanup();
   void drawFrame();
 
-  void resize() { recreateSwapChain(); }
+  //只做标记，在下一次 drawFrame present 之后重建 swapchain
+  void resize() {
+    m_framebufferResized = true;
+    m_redrawRequired = true;
+  }
+
+  //画面没有变化时 drawFrame 不会重绘，窗口重新显示等情况需要强制重绘一次
+  void invalidate() { m_redrawRequired = true; }
+
+  //等待最近一次 present 的图像显示出来，返回显示的时间，近似为 vblank
+  //不支持 present wait 时退化为等待 present 队列空闲
+  std::chrono::steady_clock::time_point waitPresentComplete();
+
+  //最近一次显示完成的时间和测得的刷新周期，可以在其他线程调用
+  //不支持 present wait 或者样本不够时返回 nullopt
+  std::optional<PresentLatencyMonitor::PresentTiming> presentTiming() {
+    return m_latencyMonitor ? m_latencyMonitor->presentTiming() : std::nullopt;
+  }
+
+  //设置画面来源，drawFrame 每次取最新完成的一帧转换后写入 staging buffer
+  void setFrameSource(TripleBuffer<Frame> *frames) { m_frameSource = frames; }
 
   ~VulkanWindow() { spdlog::info("in Vulkan Window destructor"); }
 
@@ -98,21 +145,75 @@ private:
   void createInstance();
   void createSyncObjects();
 
+  //记录绘制 swapchain image 的命令，内容只依赖 swapchain 和 pipeline
   void recordCommandBuffer(const raii::CommandBuffer &commandBuffer,
                            uint32_t imageIndex);
 
+  //为每个 frame in flight 分配画面上传的 command buffer
   void createCommandBuffers();
 
+  //为每个 swapchain image 预先记录一个 command buffer，swapchain 重建时重新记录
+  void recordCommandBuffers();
+
   void createCommandPool();
 
-  void createVertexBuffer();
+  //画面纹理的 descriptor set layout，pipeline layout 依赖它
+  void createDescriptorSetLayout();
+
+  //nearest 和 linear 两个 sampler 都提前创建，切换时只更新 descriptor
+  void createSamplers();
+
+  void createDescriptorSet();
+
+  //把画面 image 和当前 filter 对应的 sampler 写入 descriptor set
+  void updateDescriptorSet();
+
+  //创建接收画面数据的 device local image，并转换到 shader 读取的 layout
+  void createFrameImage();
+
+  //为每个 frame in flight 创建常驻映射的 staging buffer
+  void createFrameStagingBuffers();
+
+  //离屏模式下代替 swapchain 的 image 和读回用的 buffer
+  void createOffscreenTarget();
+
+  //画面 image 和 staging buffer 每行的像素数
+  uint32_t frameWidth() const {
+    if (m_ntscFilter) {
+      return NTSC_OUTPUT_WIDTH;
+    }
+    return m_pixelScaler ? m_pixelScaler->OutputWidth() : NES_FRAME_WIDTH;
+  }
+
+  //画面 image 和 staging buffer 的行数
+  uint32_t frameHeight() const {
+    return m_pixelScaler ? NES_FRAME_HEIGHT * m_pixelScaler->Factor()
+                         : NES_FRAME_HEIGHT;
+  }
+
+  //取最新完成的画面，和已经上传的内容比较 hash 决定是否需要上传
+  void pollFrameSource();
+
+  //需要上传时把变化的行转换到第 slot 个 staging buffer 并记录上传命令，
+  //返回是否需要提交上传命令
+  bool uploadFrame(uint32_t slot);
+
+  //在 command buffer 中记录第 slot 个 staging buffer 中 ranges 对应的行
+  //到画面 image 的拷贝
+  void recordFrameUpload(const raii::CommandBuffer &commandBuffer,
+                         uint32_t slot, std::span<const LineRange> ranges);
 
+  void createAllocator();
+
+  //内存从 m_allocator 子分配，host visible 的内存已经映射
   void createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage,
                     vk::MemoryPropertyFlags properties, raii::Buffer &buffer,
-                    raii::DeviceMemory &bufferMemory);
+                    DeviceAllocation &bufferMemory,
+                    MemoryPool pool = MemoryPool::FreeList);
 
-  void copyBuffer(vk::Buffer srcBuffer, vk::Buffer dstBuffer,
-                  vk::DeviceSize size);
+  void createImage(uint32_t width, uint32_t height, vk::Format format,
+                   vk::ImageUsageFlags usage, vk::MemoryPropertyFlags properties,
+                   raii::Image &image, DeviceAllocation &imageMemory);
 
   void createFramebuffers();
 
@@ -120,7 +221,15 @@ private:
 
   void createGraphicsPipeline();
 
-  raii::ShaderModule createShaderModule(const std::vector<char> &code);
+  //从用户缓存目录读取 pipeline cache，和设备不匹配时丢弃
+  void createPipelineCache();
+
+  void savePipelineCache();
+
+  // $XDG_CACHE_HOME/alpha-emu/pipeline-<vendor>-<device>-<driver>.bin
+  std::filesystem::path pipelineCachePath() const;
+
+  raii::ShaderModule createShaderModule(std::span<const uint32_t> code);
 
   void createImageViews();
 
@@ -149,9 +258,6 @@ private:
   SwapChainSupportDetails
   querySwapChainSupport(const vk::PhysicalDevice &device);
 
-  uint32_t findMemoryType(uint32_t typeFilter,
-                          const vk::MemoryPropertyFlags &properties);
-
   // void mainLoop() {
   //   drawFrame();
   //   m_device.waitIdle();
@@ -159,15 +265,8 @@ private:
 
   // std::vector<const char *> getRequiredExtensions();
 
-  void recreateSwapChain() {
-    m_device.waitIdle();
-    createSwapChain();
-    createImageViews();
-    createRenderPass();
-    createGraphicsPipeline();
-    createFramebuffers();
-    createCommandBuffers();
-  }
+  //重建 swapchain 相关对象，render pass 和 pipeline 只在格式变化时重建
+  void recreateSwapChain();
 
   void populateDebugMessengerCreateInfo(
       vk::DebugUtilsMessengerCreateInfoEXT &createInfo);
@@ -208,36 +307,97 @@ private:
 
   vk::SurfaceKHR m_surface{nullptr};
   raii::PhysicalDevice m_physicalDevice{nullptr};
+  vk::PhysicalDeviceProperties m_deviceProperties;
   raii::Device m_device{nullptr};
   raii::Queue m_graphicsQueue{nullptr};
   raii::Queue m_presentQueue{nullptr};
+  //需要在所有 DeviceAllocation 之前声明，保证最后析构
+  std::unique_ptr<DeviceAllocator> m_allocator;
+  //设备支持 VK_KHR_present_id 和 VK_KHR_present_wait 时才创建
+  std::unique_ptr<PresentLatencyMonitor> m_latencyMonitor;
+  bool m_presentWaitSupported = false;
+  uint64_t m_presentId = 0;
   raii::SwapchainKHR m_swapChain{nullptr};
 
-  raii::Buffer m_vertexBuffer{nullptr};
-  raii::DeviceMemory m_vertexBufferMemory{nullptr};
-  // raii::Buffer m_stagingBuffer{nullptr};
-  // raii::DeviceMemory m_stagingBufferMemory{nullptr};
+  //画面纹理，由 staging ring 更新，不上传时保持 eShaderReadOnlyOptimal
+  raii::Image m_frameImage{nullptr};
+  DeviceAllocation m_frameImageMemory;
+  raii::ImageView m_frameImageView{nullptr};
+  raii::Sampler m_nearestSampler{nullptr};
+  raii::Sampler m_linearSampler{nullptr};
+  raii::DescriptorSetLayout m_descriptorSetLayout{nullptr};
+  raii::DescriptorPool m_descriptorPool{nullptr};
+  raii::DescriptorSet m_descriptorSet{nullptr};
+
+  //离屏模式的渲染目标，作为唯一的 "swapchain image" 使用
+  raii::Image m_offscreenImage{nullptr};
+  DeviceAllocation m_offscreenImageMemory;
+  //渲染结果拷贝到这里，host visible 常驻映射
+  raii::Buffer m_readbackBuffer{nullptr};
+  DeviceAllocation m_readbackMemory;
+
+  //每个 frame in flight 一个 staging buffer，创建时映射，之后不再 unmap
+  std::vector<raii::Buffer> m_frameStagingBuffers;
+  std::vector<DeviceAllocation> m_frameStagingMemories;
+  TripleBuffer<Frame> *m_frameSource = nullptr;
+  //开启 NTSC 滤镜或者放大时使用
+  std::unique_ptr<WorkerPool> m_workerPool;
+  std::unique_ptr<NtscFilter> m_ntscFilter;
+  std::unique_ptr<PixelScaler> m_pixelScaler;
+  //放大前调色板转换的结果，只更新变化的行
+  std::vector<uint32_t> m_scalerSource;
+  // m_frameSource 的 ReadBuffer 中有还没上传的新内容
+  bool m_frameDirty = false;
+  //最后一次上传的画面的 hash，没有上传过时为空
+  std::optional<uint32_t> m_uploadedFrameHash;
+  //画面 image 中每一行对应的 hash
+  std::array<uint32_t, NES_FRAME_HEIGHT> m_uploadedLineHashes{};
+  //复用的变化区间，避免每帧分配
+  std::vector<LineRange> m_dirtyRanges;
+  //复用的拷贝区域，每个变化区间一个
+  std::vector<vk::BufferImageCopy> m_copyRegions;
+  // swapchain 重建、窗口重新显示等情况下即使画面没有变化也要重绘
+  bool m_redrawRequired = true;
+  //每 FRAME_STATS_INTERVAL 帧输出一次跳过的帧数
+  static constexpr uint32_t FRAME_STATS_INTERVAL = 600;
+  uint32_t m_receivedFrames = 0;
+  uint32_t m_unchangedFrames = 0;
+  uint64_t m_uploadedBytes = 0;
+  uint64_t m_uploadRegions = 0;
+  uint32_t m_uploadCount = 0;
 
   std::vector<vk::Image> m_swapChainImages;
-  vk::Format m_swapChainImageFormat;
+  vk::Format m_swapChainImageFormat = vk::Format::eUndefined;
   vk::Extent2D m_swapChainExtent;
   std::vector<raii::ImageView> m_swapChainImageViews;
   raii::PipelineLayout m_pipelineLayout{nullptr};
   raii::RenderPass m_renderPass{nullptr};
   raii::Pipeline m_graphicsPipeline{nullptr};
+  //跨 swapchain 重建和启动复用，退出时写回磁盘
+  raii::PipelineCache m_pipelineCache{nullptr};
   std::vector<raii::Framebuffer> m_swapChainFramebuffers;
   raii::CommandPool m_commandPool{nullptr};
 
+  //每个 swapchain image 一个，预先记录好绘制命令
   std::vector<raii::CommandBuffer> m_commandBuffers;
+  //每个 frame in flight 一个，上传对应 staging buffer 中变化的行
+  std::vector<raii::CommandBuffer> m_uploadCommandBuffers;
+  //每个 swapchain image 最后一次提交使用的 fence，预先记录的 command buffer
+  //不能在执行完成前再次提交
+  std::vector<vk::Fence> m_imagesInFlight;
   std::vector<raii::Semaphore> m_imageAvailableSemaphores;
   std::vector<raii::Semaphore> m_renderFinishedSemaphores;
   std::vector<raii::Fence> m_inFlightFences;
 
-  const std::vector<Vertex> m_vertices = {{{0.0f, -0.5f}, {1.0f, 1.0f, 1.0f}},
-                                          {{0.5f, 0.5f}, {0.0f, 1.0f, 0.0f}},
-                                          {{-0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}}};
-
+  RenderConfig m_config;
+  //没有 surface 和 swapchain
+  bool m_offscreen = false;
   uint32_t m_currentFrame = 0;
+  bool m_framebufferResized = false;
+
+  //用于统计启动到第一帧 present 的时间
+  std::chrono::steady_clock::time_point m_initStartTime;
+  bool m_firstFramePresented = false;
   QWindow *m_window{nullptr};
   const uint32_t m_WIDTH = 800;
   const uint32_t m_HEIGHT = 600;
@@ -247,6 +407,9 @@ private:
   std::vector<std::string> m_instanceExtensions;
 
   const std::vector<const char *> m_deviceExtensions{"VK_KHR_swapchain"};
+  //用于统计 present 延迟，可选
+  const std::vector<const char *> m_presentWaitExtensions{"VK_KHR_present_id",
+                                                         "VK_KHR_present_wait"};
 #ifdef NDEBUG
   const bool m_enableValidationLayers = false;
 #else
@@ -258,28 +421,95 @@ private:
 class VulkanGameWindow : public QWindow {
 
 public:
-  VulkanGameWindow(QVulkanInstance *qVulkanInstance)
+  VulkanGameWindow(QVulkanInstance *qVulkanInstance,
+                   const RenderConfig &config = {})
       : QWindow(), m_qVulkanInstance(qVulkanInstance),
-        m_vulkanWindow(new VulkanWindow()) {
+        m_system(new System()), m_vulkanWindow(new VulkanWindow()) {
     QWindow::setSurfaceType(QSurface::VulkanSurface);
+    m_vulkanWindow->setRenderConfig(config);
+  }
+
+  //录制模拟完成的每一帧，需要在窗口显示之前设置
+  void setCapture(std::unique_ptr<FrameCapture> capture) {
+    m_capture = std::move(capture);
+    m_system->SetCapture(m_capture.get());
+  }
+
+  // PPU 并行渲染的线程数，需要在窗口显示之前设置
+  void setPpuThreads(uint32_t threads) { m_system->SetPpuThreads(threads); }
+
+  // APU 输出的重采样方式，需要在窗口显示之前设置
+  void setAudioResampler(std::optional<ResamplerQuality> quality) {
+    m_system->SetAudioResampler(quality);
   }
 
   void exposeEvent(QExposeEvent *) override {
     spdlog::info("exposeEvent");
+    //最小化或者完全被遮挡时不再每帧请求绘制，重新显示时再恢复
+    m_system->SetDisplayVisible(isExposed());
     if (isExposed()) {
       if (!m_initialized) {
         m_initialized = true;
         init();
+        m_vulkanWindow->setFrameSource(&m_system->Frames());
+
+        //模拟的帧率是唯一的节奏来源，每发布一帧请求绘制一次
+        m_system->SetFrameCallback([this] {
+          QMetaObject::invokeMethod(
+              this, [this] { requestUpdate(); }, Qt::QueuedConnection);
+        });
+
+        m_audioOutput = std::make_unique<AudioOutput>(m_system->Audio());
+        m_audioOutput->start();
+        //按实际显示的时间和测得的刷新周期产生画面，声音的差别由动态采样率补偿
+        m_system->SetVsyncSource(
+            [this]() -> std::optional<System::VsyncTiming> {
+              auto timing = m_vulkanWindow->presentTiming();
+              if (!timing) {
+                return std::nullopt;
+              }
+              return System::VsyncTiming{.time = timing->time,
+                                         .period = timing->refreshPeriod};
+            });
+
+        //先显示一帧，模拟从这一帧显示的时间开始，使之后的帧对齐 vblank
         m_vulkanWindow->drawFrame();
+        m_system->Start(m_vulkanWindow->waitPresentComplete());
+      } else {
+        m_vulkanWindow->invalidate();
         requestUpdate();
       }
     }
   }
 
+  //P 或 Pause 键暂停和恢复模拟，暂停时不再产生新的帧，也就不再绘制
+  //F 键切换采样方式
+  void keyPressEvent(QKeyEvent *ev) override {
+    if (m_initialized &&
+        (ev->key() == Qt::Key_P || ev->key() == Qt::Key_Pause)) {
+      auto paused = !m_system->Paused();
+      m_system->SetPaused(paused);
+      spdlog::info(paused ? "emulation paused" : "emulation resumed");
+      return;
+    }
+    // F 键在 nearest 和 linear 之间切换
+    if (m_initialized && ev->key() == Qt::Key_F) {
+      auto filter = m_vulkanWindow->filter() == vk::Filter::eNearest
+                        ? vk::Filter::eLinear
+                        : vk::Filter::eNearest;
+      m_vulkanWindow->setFilter(filter);
+      spdlog::info("sampler filter {}", vk::to_string(filter));
+      return;
+    }
+    QWindow::keyPressEvent(ev);
+  }
+
   void resizeEvent(QResizeEvent *ev) override {
     spdlog::info("resize");
     if (m_initialized) {
       m_vulkanWindow->resize();
+      //暂停时没有新的帧触发绘制
+      requestUpdate();
     }
   }
 
@@ -290,8 +520,10 @@ public:
 
       if (e->type() == QEvent::UpdateRequest) {
 
-        m_vulkanWindow->drawFrame();
-        requestUpdate();
+        //最小化或者被完全遮挡时不绘制，等下一次 expose
+        if (m_initialized && isExposed()) {
+          m_vulkanWindow->drawFrame();
+        }
       } else if (e->type() == QEvent::PlatformSurface) {
 
         auto nowEvent = dynamic_cast<QPlatformSurfaceEvent *>(e);
@@ -300,6 +532,7 @@ public:
         if (nowEvent->surfaceEventType() ==
             QPlatformSurfaceEvent::SurfaceEventType::
                 SurfaceAboutToBeDestroyed) {
+          m_system->Stop();
           m_vulkanWindow->waitDrawClean();
           m_vulkanWindow->cleanup();
           //删除suface 才能删除vulkaninstance
@@ -315,7 +548,11 @@ public:
 
     return QWindow::event(e);
   }
-  virtual ~VulkanGameWindow() { spdlog::info("in VulkanGameWindow"); }
+  virtual ~VulkanGameWindow() {
+    //回调中引用了 this，先停止模拟线程
+    m_system->Stop();
+    spdlog::info("in VulkanGameWindow");
+  }
 
 private:
   //初始化vulkan 设置相关数据
@@ -353,6 +590,15 @@ private:
   QVulkanInstance *m_qVulkanInstance;
   // VulkanWindow * m_vulkanWindow;
 
+  //模拟线程中使用，需要比 m_system 晚析构
+  std::unique_ptr<FrameCapture> m_capture;
+
+  //模拟线程，需要比 m_vulkanWindow 晚析构
+  std::unique_ptr<System> m_system;
+
+  //读取 m_system 的音频缓冲，需要比 m_system 早析构
+  std::unique_ptr<AudioOutput> m_audioOutput;
+
   std::unique_ptr<VulkanWindow> m_vulkanWindow;
   bool m_initialized = false;
 };
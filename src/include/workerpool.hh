@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * 固定数量的工作线程，用来把一帧的图像处理按行分段并行
+ * ParallelFor 把 [0, count) 分成若干段，调用线程也参与处理，全部完成后返回。
+ * 同一时间只能有一个线程调用 ParallelFor。
+ */
+class WorkerPool {
+public:
+  //threadCount 包括调用线程，为 0 时使用 hardware_concurrency
+  explicit WorkerPool(uint32_t threadCount = 0);
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+  ~WorkerPool();
+
+  //参与计算的线程数，包括调用线程
+  uint32_t ThreadCount() const {
+    return static_cast<uint32_t>(m_threads.size()) + 1;
+  }
+
+  //task(begin, end) 处理 [begin, end)，每段至少 minBand 个
+  void ParallelFor(uint32_t count,
+                   const std::function<void(uint32_t, uint32_t)> &task,
+                   uint32_t minBand = 1);
+
+private:
+  void WorkerLoop();
+
+  //领取并执行分段，直到没有剩余的分段
+  void RunBands();
+
+private:
+  std::vector<std::thread> m_threads;
+
+  std::mutex m_mutex;
+  std::condition_variable m_startCondition;
+  std::condition_variable m_doneCondition;
+  //每次 ParallelFor 加一，工作线程据此判断是否有新任务
+  uint64_t m_generation = 0;
+  bool m_running = true;
+  //还没有完成当前任务的工作线程数
+  uint32_t m_activeWorkers = 0;
+
+  //当前任务，ParallelFor 返回前保持有效
+  const std::function<void(uint32_t, uint32_t)> *m_task = nullptr;
+  uint32_t m_count = 0;
+  uint32_t m_bandSize = 0;
+  std::atomic<uint32_t> m_nextBand = 0;
+};
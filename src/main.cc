@@ -11,17 +11,241 @@
 // #else
 #include "mainwindow.hh"
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QCoreApplication>
 #include <QLayout>
 #include <QVulkanInstance>
 #include <memory>
 #include <QWindow>
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <window.hh>
 
 
+//命令行设置
+struct CommandLineOptions {
+  RenderConfig renderConfig;
+  //不创建窗口，离屏渲染指定帧数后退出
+  bool headless = false;
+  uint32_t frames = 600;
+  uint32_t scale = 3;
+  //最后一帧写入的 PPM 文件，为空时不写
+  std::string output;
+  //录制设置，没有指定 --capture 时为空
+  std::optional<CaptureConfig> capture;
+  // PPU 并行渲染的线程数，小于 2 时不并行
+  uint32_t ppuThreads = 1;
+  //无窗口运行时写入声音的 WAV 文件，为空时不写
+  std::string audioWav;
+  // APU 输出的多相 FIR 重采样质量，为空时使用 BlipBuffer
+  std::optional<ResamplerQuality> audioResampler;
+};
+
+CommandLineOptions parseCommandLine(const QCoreApplication &app) {
+  QCommandLineParser parser;
+  parser.addHelpOption();
+  QCommandLineOption presentModeOption(
+      "present-mode", "present mode: fifo, mailbox or immediate", "mode",
+      "mailbox");
+  QCommandLineOption framesInFlightOption(
+      "frames-in-flight", "frames in flight, 1 to 3", "count", "2");
+  QCommandLineOption scalingOption(
+      "scaling", "picture scaling: integer or fit", "mode", "integer");
+  QCommandLineOption filterOption("filter", "sampler filter: nearest or linear",
+                                  "filter", "nearest");
+  QCommandLineOption ntscOption("ntsc", "apply the NTSC composite video filter");
+  QCommandLineOption scalerOption(
+      "scaler", "CPU pixel art scaler: none, scale2x, scale3x or xbr",
+      "scaler", "none");
+  QCommandLineOption headlessOption(
+      "headless", "render offscreen without a window or swapchain");
+  QCommandLineOption framesOption("frames", "frames to render in headless mode",
+                                  "count", "600");
+  QCommandLineOption scaleOption(
+      "scale", "offscreen size as a multiple of the NES resolution", "factor",
+      "3");
+  QCommandLineOption outputOption(
+      "output", "write the last headless frame to a PPM file", "file");
+  QCommandLineOption captureOption(
+      "capture", "record every emulated frame to a file or directory", "path");
+  QCommandLineOption captureFormatOption(
+      "capture-format", "capture format: png, y4m or ffmpeg", "format", "y4m");
+  QCommandLineOption ppuThreadsOption(
+      "ppu-threads", "render PPU scanline bands on this many threads", "count",
+      "1");
+  QCommandLineOption audioWavOption(
+      "audio-wav", "write the headless audio output to a WAV file", "file");
+  QCommandLineOption audioResamplerOption(
+      "audio-resampler", "APU output resampling: blip, low, medium or high",
+      "mode", "blip");
+  parser.addOption(presentModeOption);
+  parser.addOption(framesInFlightOption);
+  parser.addOption(scalingOption);
+  parser.addOption(filterOption);
+  parser.addOption(ntscOption);
+  parser.addOption(scalerOption);
+  parser.addOption(headlessOption);
+  parser.addOption(framesOption);
+  parser.addOption(scaleOption);
+  parser.addOption(outputOption);
+  parser.addOption(captureOption);
+  parser.addOption(captureFormatOption);
+  parser.addOption(ppuThreadsOption);
+  parser.addOption(audioWavOption);
+  parser.addOption(audioResamplerOption);
+  parser.process(app);
+
+  CommandLineOptions options;
+  auto &config = options.renderConfig;
+  auto presentMode = parser.value(presentModeOption);
+  if (presentMode == "fifo") {
+    config.presentMode = vk::PresentModeKHR::eFifo;
+  } else if (presentMode == "immediate") {
+    config.presentMode = vk::PresentModeKHR::eImmediate;
+  } else if (presentMode == "mailbox") {
+    config.presentMode = vk::PresentModeKHR::eMailbox;
+  } else {
+    spdlog::warn("unknown present mode {}", presentMode.toStdString());
+  }
+  config.framesInFlight = parser.value(framesInFlightOption).toUInt();
+  config.integerScale = parser.value(scalingOption) != "fit";
+  config.ntsc = parser.isSet(ntscOption);
+  auto scaler = parser.value(scalerOption);
+  if (scaler == "scale2x") {
+    config.scaler = ScaleFilter::Scale2x;
+  } else if (scaler == "scale3x") {
+    config.scaler = ScaleFilter::Scale3x;
+  } else if (scaler == "xbr") {
+    config.scaler = ScaleFilter::Xbr2x;
+  } else if (scaler != "none") {
+    spdlog::warn("unknown scaler {}", scaler.toStdString());
+  }
+  config.filter = parser.value(filterOption) == "linear" ? vk::Filter::eLinear
+                                                         : vk::Filter::eNearest;
+
+  options.headless = parser.isSet(headlessOption);
+  options.frames = parser.value(framesOption).toUInt();
+  options.scale = std::max(1U, parser.value(scaleOption).toUInt());
+  options.output = parser.value(outputOption).toStdString();
+  options.ppuThreads = parser.value(ppuThreadsOption).toUInt();
+  options.audioWav = parser.value(audioWavOption).toStdString();
+  auto resampler = parser.value(audioResamplerOption);
+  if (resampler == "low") {
+    options.audioResampler = ResamplerQuality::Low;
+  } else if (resampler == "medium") {
+    options.audioResampler = ResamplerQuality::Medium;
+  } else if (resampler == "high") {
+    options.audioResampler = ResamplerQuality::High;
+  } else if (resampler != "blip") {
+    spdlog::warn("unknown audio resampler {}", resampler.toStdString());
+  }
+
+  if (parser.isSet(captureOption)) {
+    CaptureConfig capture;
+    capture.path = parser.value(captureOption).toStdString();
+    auto format = parser.value(captureFormatOption);
+    if (format == "png") {
+      capture.format = CaptureFormat::Png;
+    } else if (format == "ffmpeg") {
+      capture.format = CaptureFormat::Ffmpeg;
+      // ffmpeg 提前退出时写入返回错误，而不是结束整个进程
+      std::signal(SIGPIPE, SIG_IGN);
+    } else if (format != "y4m") {
+      spdlog::warn("unknown capture format {}", format.toStdString());
+    }
+    options.capture = capture;
+  }
+  return options;
+}
+
+//写入 binary PPM，pixels 为 RGBA8
+void writePPM(const std::string &path, const std::vector<uint32_t> &pixels,
+              vk::Extent2D extent) {
+  std::ofstream file(path, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error(fmt::format("failed to open {}", path));
+  }
+  file << "P6\n" << extent.width << " " << extent.height << "\n255\n";
+  for (auto pixel : pixels) {
+    auto *rgba = reinterpret_cast<const char *>(&pixel);
+    file.write(rgba, 3);
+  }
+}
+
+//不依赖窗口系统，模拟和渲染同步进行，统计每帧的耗时
+int runHeadless(const CommandLineOptions &options) {
+  System system;
+  VulkanWindow renderer;
+  renderer.setRenderConfig(options.renderConfig);
+  renderer.initInstance({});
+  renderer.initOffscreen(NES_FRAME_WIDTH * options.scale,
+                         NES_FRAME_HEIGHT * options.scale);
+  renderer.setFrameSource(&system.Frames());
+  system.SetPpuThreads(options.ppuThreads);
+  system.SetAudioResampler(options.audioResampler);
+
+  std::unique_ptr<FrameCapture> capture;
+  if (options.capture) {
+    capture = std::make_unique<FrameCapture>(*options.capture);
+    system.SetCapture(capture.get());
+  }
+
+  std::unique_ptr<WavWriter> wav;
+  if (!options.audioWav.empty()) {
+    wav = std::make_unique<WavWriter>(options.audioWav, AUDIO_SAMPLE_RATE, 1);
+  }
+  std::vector<int16_t> samples(System::AUDIO_RING_SAMPLES);
+
+  auto extent = renderer.extent();
+  std::vector<uint32_t> pixels(static_cast<size_t>(extent.width) *
+                               extent.height);
+
+  auto startTime = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < options.frames; i++) {
+    system.StepFrame();
+    renderer.renderOffscreen(pixels);
+    //每帧取走全部采样，没有写文件时也要取，保持缓冲不满
+    auto count = system.Audio().Read(samples.data(), samples.size());
+    if (wav) {
+      wav->Write(samples.data(), count);
+    }
+  }
+  auto totalTime = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - startTime);
+  spdlog::info("headless {} frames on {}: {:.3f} ms/frame", options.frames,
+               renderer.deviceName(),
+               totalTime.count() / std::max(1U, options.frames));
+
+  if (!options.output.empty()) {
+    writePPM(options.output, pixels, extent);
+  }
+  if (capture) {
+    capture->Stop();
+  }
+  if (wav) {
+    wav->Close();
+  }
+
+  renderer.waitDrawClean();
+  renderer.cleanup();
+  return EXIT_SUCCESS;
+}
+
 int main(int argc, char *argv[]) {
   auto resultcode = 0;
   try {
+    //离屏模式不能依赖显示服务器，在创建 QApplication 之前判断
+    auto headless = std::any_of(argv + 1, argv + argc, [](const char *arg) {
+      return std::strcmp(arg, "--headless") == 0;
+    });
+    if (headless) {
+      QCoreApplication app(argc, argv);
+      return runHeadless(parseCommandLine(app));
+    }
+
     QApplication app(argc, argv);
 
     spdlog::info(app.applicationDirPath().toStdString());
@@ -29,8 +253,15 @@ int main(int argc, char *argv[]) {
     auto qVulkanInstance=std::make_unique<QVulkanInstance>();
 
     //auto vulkanWindow= std::make_unique<VulkanWindow>();
-    auto vulkanGameWindow= std::make_unique<VulkanGameWindow>(qVulkanInstance.get()
-                                                            );
+    auto options = parseCommandLine(app);
+    auto vulkanGameWindow= std::make_unique<VulkanGameWindow>(qVulkanInstance.get(),
+                                                            options.renderConfig);
+    vulkanGameWindow->setPpuThreads(options.ppuThreads);
+    vulkanGameWindow->setAudioResampler(options.audioResampler);
+    if (options.capture) {
+      vulkanGameWindow->setCapture(
+          std::make_unique<FrameCapture>(*options.capture));
+    }
     MainWindow w;
 
     auto *widget = w.centralWidget();
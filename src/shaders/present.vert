@@ -0,0 +1,11 @@
+#version 450
+
+// 不使用 vertex buffer，用一个覆盖整个 viewport 的三角形
+// (-1,-1) (3,-1) (-1,3)，超出 viewport 的部分被裁剪
+layout(location = 0) out vec2 fragTexCoord;
+
+void main() {
+  vec2 uv = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+  gl_Position = vec4(uv * 2.0 - 1.0, 0.0, 1.0);
+  fragTexCoord = uv;
+}
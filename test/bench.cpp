@@ -0,0 +1,200 @@
+#include "apu.hh"
+#include "frame.hh"
+#include "ntsc.hh"
+#include "palette.hh"
+#include "ppu.hh"
+#include "resampler.hh"
+#include "scaler.hh"
+#include "system.hh"
+#include "workerpool.hh"
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * CPU 画面处理的耗时，每项处理整帧
+ * alpha-emu-bench [次数]
+ */
+
+namespace {
+
+//类似游戏画面的测试图案：8x8 的 tile，每个 tile 内有 4 种颜色的斜线和块
+void FillTestPattern(Frame &frame) {
+  for (uint32_t y = 0; y < NES_FRAME_HEIGHT; y++) {
+    for (uint32_t x = 0; x < NES_FRAME_WIDTH; x++) {
+      auto tile = (x / 8) * 7 + (y / 8) * 13;
+      auto shade = ((x + y) % 8 < 3) + ((x % 8) > (y % 8)) * 2;
+      frame.pixels[y * NES_FRAME_WIDTH + x] =
+          static_cast<uint16_t>((tile + shade * 0x10) & 0x3F);
+    }
+  }
+}
+
+void Report(const char *name, uint32_t iterations,
+            const std::function<void()> &task) {
+  //先运行一次，排除第一次的分配和缓存缺失
+  task();
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++) {
+    task();
+  }
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::printf("%-24s %8.3f ms/frame\n", name, elapsed.count() / iterations);
+}
+
+// x86 上为 TSC 的计数，其他平台为纳秒
+uint64_t Ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+//task 返回这一次的输出数，报告每个输出平均的 tick
+void ReportPerSample(const char *name, uint32_t iterations,
+                     const std::function<uint32_t()> &task) {
+  task();
+  uint64_t samples = 0;
+  auto start = Ticks();
+  for (uint32_t i = 0; i < iterations; i++) {
+    samples += task();
+  }
+  auto ticks = Ticks() - start;
+  std::printf("%-24s %8.1f cycles/sample\n", name,
+              static_cast<double>(ticks) / std::max<uint64_t>(samples, 1));
+}
+
+//每帧横向滚动一个像素，背景之外没有变化
+void RunScrollingFrame(PPU &ppu, Frame &frame, uint8_t scroll) {
+  ppu.WriteRegister(0x2005, scroll);
+  ppu.WriteRegister(0x2005, 0);
+  ppu.RunScanline(PPU_PRERENDER_SCANLINE, frame);
+  for (uint32_t line = 0; line < PPU_PRERENDER_SCANLINE; line++) {
+    ppu.RunScanline(line, frame);
+  }
+}
+
+//一帧每个 CPU cycle 混音一次，返回结果的和，避免被优化掉
+template <typename Mixer>
+int64_t MixFrame(const std::vector<std::array<uint8_t, 5>> &outputs,
+                 Mixer mixer) {
+  int64_t sum = 0;
+  for (const auto &output : outputs) {
+    sum += mixer(output[0], output[1], output[2], output[3], output[4]);
+  }
+  return sum;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  uint32_t iterations =
+      argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 200;
+
+  auto frame = std::make_unique<Frame>();
+  FillTestPattern(*frame);
+  std::vector<uint32_t> rgba(NES_FRAME_WIDTH * NES_FRAME_HEIGHT);
+  //最大的输出为 3 倍
+  std::vector<uint32_t> output(NES_FRAME_WIDTH * NES_FRAME_HEIGHT * 9);
+  const LineRange fullFrame{.first = 0, .count = NES_FRAME_HEIGHT};
+
+  Report("palette", iterations, [&] { ConvertFrame(*frame, rgba.data()); });
+
+  for (auto cache : {false, true}) {
+    PPU ppu;
+    ppu.SetBackgroundCache(cache);
+    //填满 CHR RAM 和 nametable
+    ppu.WriteRegister(0x2006, 0x00);
+    ppu.WriteRegister(0x2006, 0x00);
+    for (uint32_t i = 0; i < 0x3000; i++) {
+      ppu.WriteRegister(0x2007, static_cast<uint8_t>(i * 37));
+    }
+    ppu.WriteRegister(0x2001, 0x0A);
+    uint8_t scroll = 0;
+    Report(cache ? "ppu background cached" : "ppu background", iterations,
+           [&] { RunScrollingFrame(ppu, *frame, scroll++); });
+  }
+  FillTestPattern(*frame);
+
+  //各声道随机的输出，每帧 29781 个 CPU cycle
+  std::vector<std::array<uint8_t, 5>> apuOutputs(System::CPU_CYCLES_PER_FRAME);
+  uint32_t seed = 1;
+  for (auto &output : apuOutputs) {
+    seed = seed * 1103515245 + 12345;
+    output = {static_cast<uint8_t>((seed >> 8) & 0x0F),
+              static_cast<uint8_t>((seed >> 12) & 0x0F),
+              static_cast<uint8_t>((seed >> 16) & 0x0F),
+              static_cast<uint8_t>((seed >> 20) & 0x0F),
+              static_cast<uint8_t>((seed >> 24) & 0x7F)};
+  }
+  volatile int64_t mixed = 0;
+  Report("apu mix formula", iterations,
+         [&] { mixed = MixFrame(apuOutputs, MixApuOutputsFormula); });
+  Report("apu mix table", iterations,
+         [&] { mixed = MixFrame(apuOutputs, MixApuOutputs); });
+
+  //一帧 APU cycle 的振幅，方波加上噪声，降到 48kHz
+  std::vector<float> apuSamples(System::CPU_CYCLES_PER_FRAME / 2);
+  for (size_t i = 0; i < apuSamples.size(); i++) {
+    seed = seed * 1103515245 + 12345;
+    apuSamples[i] = static_cast<float>((i / 1017) % 2 * 4000 + (seed >> 20));
+  }
+  const std::pair<const char *, ResamplerQuality> qualities[] = {
+      {"low", ResamplerQuality::Low},
+      {"medium", ResamplerQuality::Medium},
+      {"high", ResamplerQuality::High}};
+  for (auto [name, quality] : qualities) {
+    for (auto simd : {false, true}) {
+      Resampler resampler(NES_CPU_CLOCK_RATE / 2, AUDIO_SAMPLE_RATE, quality,
+                          simd);
+      if (simd && !resampler.Simd()) {
+        continue;
+      }
+      //上一帧留下的输入不超过一个滤波器长度
+      std::vector<float> resampled(resampler.MaxOutput(apuSamples.size()) +
+                                   resampler.Taps());
+      auto label = std::string("resample ") + name + (simd ? " avx2" : "");
+      ReportPerSample(label.c_str(), iterations, [&] {
+        return resampler.Process(apuSamples.data(), apuSamples.size(),
+                                 resampled.data());
+      });
+    }
+  }
+
+  WorkerPool singleThread(1);
+  WorkerPool allThreads;
+  for (auto *pool : {&singleThread, &allThreads}) {
+    std::printf("-- %u threads\n", pool->ThreadCount());
+
+    NtscFilter ntsc(*pool);
+    Report("ntsc", iterations,
+           [&] { ntsc.Filter(*frame, {&fullFrame, 1}, output.data()); });
+
+    const std::pair<const char *, ScaleFilter> scalers[] = {
+        {"scale2x", ScaleFilter::Scale2x},
+        {"scale3x", ScaleFilter::Scale3x},
+        {"xbr2x", ScaleFilter::Xbr2x}};
+    for (auto [name, filter] : scalers) {
+      PixelScaler scaler(*pool, filter);
+      std::vector<LineRange> ranges;
+      Report(name, iterations, [&] {
+        ranges.assign(1, fullFrame);
+        scaler.Scale(rgba.data(), ranges, output.data());
+      });
+    }
+  }
+  return 0;
+}
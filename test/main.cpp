@@ -1,6 +1,32 @@
+#include "apu.hh"
+#include "audioring.hh"
+#include "capture.hh"
 #include "clock.hh"
 #include "cpu.hh"
+#include "crc32c.hh"
+#include "frame.hh"
+#include "ntsc.hh"
+#include "palette.hh"
+#include "ppu.hh"
+#include "resampler.hh"
+#include "scaler.hh"
+#include "system.hh"
+#include "triplebuffer.hh"
+#include "workerpool.hh"
+#include "window.hh"
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <numbers>
+#include <string>
+#include <thread>
+#include <vector>
 using namespace std::chrono;
 #define BOOST_TEST_MODULE My Test
 #include <boost/test/included/unit_test.hpp>
@@ -34,3 +60,709 @@ BOOST_AUTO_TEST_CASE(second_test){
   BOOST_TEST(1);
 
 }
+
+BOOST_AUTO_TEST_CASE(triple_buffer_test) {
+  TripleBuffer<int> buffer;
+
+  //没有发布时读不到新数据
+  BOOST_TEST(!buffer.Update());
+
+  buffer.WriteBuffer() = 1;
+  buffer.Publish();
+  buffer.WriteBuffer() = 2;
+  buffer.Publish();
+
+  //消费者只拿到最新发布的数据
+  BOOST_TEST(buffer.Update());
+  BOOST_TEST(buffer.ReadBuffer() == 2);
+  BOOST_TEST(!buffer.Update());
+
+  buffer.WriteBuffer() = 3;
+  buffer.Publish();
+  BOOST_TEST(buffer.Update());
+  BOOST_TEST(buffer.ReadBuffer() == 3);
+}
+
+BOOST_AUTO_TEST_CASE(present_rect_test) {
+  //整数倍放大，剩余部分居中留黑边
+  auto rect = computePresentRect(vk::Extent2D{800, 600}, true);
+  BOOST_TEST(rect.extent.width == 512U);
+  BOOST_TEST(rect.extent.height == 480U);
+  BOOST_TEST(rect.offset.x == 144);
+  BOOST_TEST(rect.offset.y == 60);
+
+  //按比例填满较短的一边
+  rect = computePresentRect(vk::Extent2D{800, 600}, false);
+  BOOST_TEST(rect.extent.height == 600U);
+  BOOST_TEST(rect.extent.width == 640U);
+
+  //窗口小于 1 倍时不再取整
+  rect = computePresentRect(vk::Extent2D{128, 240}, true);
+  BOOST_TEST(rect.extent.width == 128U);
+  BOOST_TEST(rect.extent.height == 120U);
+}
+
+BOOST_AUTO_TEST_CASE(crc32c_test) {
+  //标准测试向量
+  const char check[] = "123456789";
+  BOOST_TEST(Crc32c(check, 9) == 0xE3069283U);
+  BOOST_TEST(Crc32cPortable(check, 9) == 0xE3069283U);
+
+  //长度不是 8 的倍数、起始地址不对齐时和查表实现一致
+  std::vector<unsigned char> data(4099);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = static_cast<unsigned char>(i * 31 + 7);
+  }
+  BOOST_TEST(Crc32c(data.data() + 1, data.size() - 1) ==
+             Crc32cPortable(data.data() + 1, data.size() - 1));
+}
+
+BOOST_AUTO_TEST_CASE(dirty_line_ranges_test) {
+  auto frame = std::make_unique<Frame>();
+  frame->UpdateHashes();
+  auto previous = frame->lineHashes;
+  std::vector<LineRange> ranges;
+
+  //没有上传过时整帧上传
+  DirtyLineRanges(*frame, nullptr, ranges);
+  BOOST_TEST(ranges.size() == 1U);
+  BOOST_TEST(ranges[0].count == NES_FRAME_HEIGHT);
+
+  DirtyLineRanges(*frame, &previous, ranges);
+  BOOST_TEST(ranges.empty());
+
+  //相邻的行合并
+  frame->pixels[10 * NES_FRAME_WIDTH] = 1;
+  frame->pixels[11 * NES_FRAME_WIDTH + 5] = 1;
+  frame->pixels[200 * NES_FRAME_WIDTH + 255] = 1;
+  frame->UpdateHashes();
+  DirtyLineRanges(*frame, &previous, ranges);
+  BOOST_TEST(ranges.size() == 2U);
+  BOOST_TEST(ranges[0].first == 10U);
+  BOOST_TEST(ranges[0].count == 2U);
+  BOOST_TEST(ranges[1].first == 200U);
+  BOOST_TEST(ranges[1].count == 1U);
+}
+
+BOOST_AUTO_TEST_CASE(ntsc_filter_test) {
+  WorkerPool pool(4);
+  NtscFilter filter(pool);
+  auto frame = std::make_unique<Frame>();
+  std::vector<uint32_t> output(NTSC_OUTPUT_WIDTH * NES_FRAME_HEIGHT);
+  LineRange all{.first = 0, .count = NES_FRAME_HEIGHT};
+
+  //纯色画面中间的颜色和调色板接近
+  for (uint16_t index : {0x00, 0x16, 0x21, 0x2A, 0x30}) {
+    frame->pixels.fill(index);
+    filter.Filter(*frame, {&all, 1}, output.data());
+    auto ntsc = output[120 * NTSC_OUTPUT_WIDTH + NTSC_OUTPUT_WIDTH / 2];
+    auto palette = NES_PALETTE_RGBA[index];
+    for (int shift = 0; shift < 32; shift += 8) {
+      int difference = static_cast<int>((ntsc >> shift) & 0xFF) -
+                       static_cast<int>((palette >> shift) & 0xFF);
+      BOOST_TEST(std::abs(difference) <= 16);
+    }
+  }
+
+  //多线程和单线程的结果相同
+  for (size_t i = 0; i < frame->pixels.size(); i++) {
+    frame->pixels[i] = static_cast<uint16_t>((i * 7 + i / 256 * 13) & 0x1FF);
+  }
+  filter.Filter(*frame, {&all, 1}, output.data());
+  std::vector<uint32_t> line(NTSC_OUTPUT_WIDTH * NES_FRAME_HEIGHT);
+  filter.FilterLine(*frame, 77, line.data());
+  BOOST_TEST(std::equal(line.begin() + 77 * NTSC_OUTPUT_WIDTH,
+                        line.begin() + 78 * NTSC_OUTPUT_WIDTH,
+                        output.begin() + 77 * NTSC_OUTPUT_WIDTH));
+
+  // SIMD 和标量实现的舍入方式相同，结果逐个像素相等
+  NtscFilter portable(pool, {}, false);
+  BOOST_TEST(!portable.Simd());
+  std::vector<uint32_t> portableOutput(output.size());
+  for (const NtscSetup &setup :
+       {NtscSetup{}, NtscSetup{.hue = 17.0f, .saturation = 1.7f}}) {
+    filter.Setup(setup);
+    portable.Setup(setup);
+    filter.Filter(*frame, {&all, 1}, output.data());
+    portable.Filter(*frame, {&all, 1}, portableOutput.data());
+    BOOST_TEST(output == portableOutput);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(pixel_scaler_test) {
+  WorkerPool pool(2);
+  const uint32_t black = 0xFF000000, white = 0xFFFFFFFF;
+  std::vector<uint32_t> source(NES_FRAME_WIDTH * NES_FRAME_HEIGHT, white);
+  //左上到右下的对角线
+  for (uint32_t i = 0; i < NES_FRAME_HEIGHT; i++) {
+    source[i * NES_FRAME_WIDTH + i] = black;
+  }
+
+  PixelScaler scale2x(pool, ScaleFilter::Scale2x);
+  std::vector<uint32_t> output(NES_FRAME_WIDTH * NES_FRAME_HEIGHT * 4);
+  std::vector<LineRange> ranges{{.first = 0, .count = NES_FRAME_HEIGHT}};
+  scale2x.Scale(source.data(), ranges, output.data());
+  BOOST_TEST(ranges.size() == 1);
+  BOOST_TEST(ranges[0].count == NES_FRAME_HEIGHT * 2);
+  //对角线上的像素保持不变，两侧的白色像素靠近对角线的一角补上黑色
+  auto width = scale2x.OutputWidth();
+  BOOST_TEST(output[20 * width + 20] == black);
+  BOOST_TEST(output[21 * width + 21] == black);
+  BOOST_TEST(output[21 * width + 22] == black);
+  BOOST_TEST(output[22 * width + 21] == black);
+  BOOST_TEST(output[20 * width + 22] == white);
+  BOOST_TEST(output[22 * width + 20] == white);
+
+  //只更新变化的行和全部重新计算结果相同
+  for (auto filter :
+       {ScaleFilter::Scale2x, ScaleFilter::Scale3x, ScaleFilter::Xbr2x}) {
+    PixelScaler partial(pool, filter);
+    PixelScaler full(pool, filter);
+    auto size = source.size() * partial.Factor() * partial.Factor();
+    std::vector<uint32_t> partialOutput(size), fullOutput(size);
+    ranges.assign(1, LineRange{.first = 0, .count = NES_FRAME_HEIGHT});
+    partial.Scale(source.data(), ranges, partialOutput.data());
+
+    auto changed = source;
+    changed[100 * NES_FRAME_WIDTH + 50] = black;
+    changed[(NES_FRAME_HEIGHT - 1) * NES_FRAME_WIDTH + 3] = black;
+    ranges = {{.first = 100, .count = 1}, {.first = NES_FRAME_HEIGHT - 1, .count = 1}};
+    partial.Scale(changed.data(), ranges, partialOutput.data());
+    BOOST_TEST(ranges.front().first < 100 * partial.Factor());
+
+    ranges.assign(1, LineRange{.first = 0, .count = NES_FRAME_HEIGHT});
+    full.Scale(changed.data(), ranges, fullOutput.data());
+    BOOST_TEST((partialOutput == fullOutput));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(frame_capture_test) {
+  auto path = std::filesystem::temp_directory_path() / "alpha-emu-test.y4m";
+  auto frame = std::make_unique<Frame>();
+  const uint32_t submitted = 50;
+  uint64_t captured = 0;
+  {
+    FrameCapture capture(CaptureConfig{.format = CaptureFormat::Y4m,
+                                       .path = path.string(),
+                                       .bufferCount = 2});
+    //编码跟不上时丢弃，不会阻塞提交
+    for (uint32_t i = 0; i < submitted; i++) {
+      frame->number = i;
+      capture.Submit(*frame);
+    }
+    capture.Stop();
+    captured = capture.CapturedFrames();
+    BOOST_TEST(captured >= 2);
+    BOOST_TEST(captured + capture.DroppedFrames() == submitted);
+  }
+
+  std::ifstream file(path, std::ios::binary);
+  std::string header;
+  std::getline(file, header);
+  BOOST_TEST(header.starts_with("YUV4MPEG2 W256 H240"));
+  auto frameSize = std::string("FRAME\n").size() +
+                   NES_FRAME_WIDTH * NES_FRAME_HEIGHT * 3 / 2;
+  BOOST_TEST(std::filesystem::file_size(path) ==
+             header.size() + 1 + captured * frameSize);
+  file.close();
+  std::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(ppu_sprite_evaluation_test) {
+  PPU ppu;
+  std::array<uint8_t, 256> oam{};
+  //默认放到画面外
+  oam.fill(0xFF);
+  // 10 个精灵从第 51 条线开始
+  for (uint32_t i = 0; i < 10; i++) {
+    oam[i * 4] = 50;
+    oam[i * 4 + 3] = static_cast<uint8_t>(i * 20);
+  }
+  // Y 为 239 的精灵不显示
+  oam[10 * 4] = 239;
+  ppu.WriteOamDma(oam);
+
+  const auto &sprites = ppu.SpritesOnLine(51);
+  BOOST_TEST(sprites.count == 8);
+  for (uint32_t i = 0; i < 8; i++) {
+    BOOST_TEST(sprites.indices[i] == i);
+  }
+  BOOST_TEST(sprites.overflow);
+  BOOST_TEST(ppu.SpritesOnLine(58).count == 8);
+  BOOST_TEST(ppu.SpritesOnLine(59).count == 0);
+  BOOST_TEST(ppu.SpritesOnLine(50).count == 0);
+  for (uint32_t line = 0; line < NES_FRAME_HEIGHT; line++) {
+    if (line < 51 || line > 58) {
+      BOOST_TEST(ppu.SpritesOnLine(line).count == 0);
+    }
+  }
+
+  //渲染第 50 条线时评估第 51 条线的精灵
+  auto frame = std::make_unique<Frame>();
+  ppu.WriteRegister(0x2001, 0x18);
+  for (uint32_t line = 0; line < 50; line++) {
+    ppu.RunScanline(line, *frame);
+  }
+  BOOST_TEST((ppu.ReadRegister(0x2002) & 0x20) == 0);
+  ppu.RunScanline(50, *frame);
+  BOOST_TEST((ppu.ReadRegister(0x2002) & 0x20) != 0);
+
+  // 8x16 时覆盖 16 条线，pre-render 扫描线清除 overflow
+  ppu.WriteRegister(0x2000, 0x20);
+  BOOST_TEST(ppu.SpritesOnLine(66).count == 8);
+  BOOST_TEST(ppu.SpritesOnLine(67).count == 0);
+  ppu.RunScanline(PPU_PRERENDER_SCANLINE, *frame);
+  BOOST_TEST((ppu.ReadRegister(0x2002) & 0x20) == 0);
+
+  //只有 8 个精灵时不设置 overflow
+  oam[8 * 4] = 0xFF;
+  oam[9 * 4] = 0xFF;
+  ppu.WriteRegister(0x2003, 0);
+  ppu.WriteOamDma(oam);
+  BOOST_TEST(ppu.SpritesOnLine(51).count == 8);
+  BOOST_TEST(!ppu.SpritesOnLine(51).overflow);
+}
+
+BOOST_AUTO_TEST_CASE(ppu_background_cache_test) {
+  //两个 PPU 执行相同的写入，使用背景缓存的结果应该和逐个 tile 解码相同
+  PPU cached, decoded;
+  decoded.SetBackgroundCache(false);
+  auto write = [&](uint16_t address, uint8_t value) {
+    cached.WriteRegister(address, value);
+    decoded.WriteRegister(address, value);
+  };
+  auto writeVram = [&](uint16_t address, const std::vector<uint8_t> &data) {
+    write(0x2006, static_cast<uint8_t>(address >> 8));
+    write(0x2006, static_cast<uint8_t>(address));
+    for (auto value : data) {
+      write(0x2007, value);
+    }
+  };
+  uint32_t seed = 1;
+  auto random = [&] {
+    seed = seed * 1103515245 + 12345;
+    return static_cast<uint8_t>(seed >> 16);
+  };
+  auto randomData = [&](size_t size) {
+    std::vector<uint8_t> data(size);
+    std::generate(data.begin(), data.end(), random);
+    return data;
+  };
+
+  writeVram(0x0000, randomData(0x2000));
+  writeVram(0x2000, randomData(0x1000));
+  writeVram(0x3F00, randomData(32));
+
+  auto cachedFrame = std::make_unique<Frame>();
+  auto decodedFrame = std::make_unique<Frame>();
+  for (uint32_t frame = 0; frame < 16; frame++) {
+    // vblank 期间修改少量 nametable、属性表和 pattern
+    writeVram(0x2000 + random() * 16, randomData(3));
+    writeVram(0x23C0 | (random() & 0x3F), randomData(1));
+    writeVram(0x1000 + random() * 16, randomData(16));
+    if (frame == 8) {
+      cached.SetMirroring(Mirroring::Vertical);
+      decoded.SetMirroring(Mirroring::Vertical);
+    }
+
+    write(0x2000, 0x10 | (random() & 0x03));
+    write(0x2005, random());
+    write(0x2005, random());
+    write(0x2001, 0x0A);
+
+    // pre-render 扫描线把滚动复制到 v
+    cached.RunScanline(PPU_PRERENDER_SCANLINE, *cachedFrame);
+    decoded.RunScanline(PPU_PRERENDER_SCANLINE, *decodedFrame);
+    for (uint32_t line = 0; line < PPU_PRERENDER_SCANLINE; line++) {
+      //帧中途改变滚动和 pattern table
+      if (line == 120) {
+        write(0x2000, random() & 0x13);
+        write(0x2005, random());
+        write(0x2005, random());
+      }
+      cached.RunScanline(line, *cachedFrame);
+      decoded.RunScanline(line, *decodedFrame);
+    }
+    BOOST_TEST((cachedFrame->pixels == decodedFrame->pixels));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(ppu_parallel_rendering_test) {
+  //并行渲染和逐行渲染执行相同的访问，画面和 CPU 读到的状态都应该相同
+  WorkerPool workerPool(4);
+  PPU parallel, serial;
+  parallel.SetParallelRendering(&workerPool);
+  auto write = [&](uint16_t address, uint8_t value) {
+    parallel.WriteRegister(address, value);
+    serial.WriteRegister(address, value);
+  };
+  uint32_t seed = 7;
+  auto random = [&] {
+    seed = seed * 1103515245 + 12345;
+    return static_cast<uint8_t>(seed >> 16);
+  };
+  auto writeVram = [&](uint16_t address, size_t size) {
+    write(0x2006, static_cast<uint8_t>(address >> 8));
+    write(0x2006, static_cast<uint8_t>(address));
+    for (size_t i = 0; i < size; i++) {
+      write(0x2007, random());
+    }
+  };
+  auto dma = [&] {
+    std::array<uint8_t, 256> page;
+    std::generate(page.begin(), page.end(), random);
+    // sprite 0 放在画面中间
+    page[0] = 100;
+    page[3] = 120;
+    parallel.WriteOamDma(page);
+    serial.WriteOamDma(page);
+  };
+
+  writeVram(0x0000, 0x2000);
+  writeVram(0x2000, 0x1000);
+  writeVram(0x3F00, 32);
+
+  auto parallelFrame = std::make_unique<Frame>();
+  auto serialFrame = std::make_unique<Frame>();
+  for (uint32_t frame = 0; frame < 4; frame++) {
+    for (uint32_t line = 0; line < PPU_SCANLINES_PER_FRAME; line++) {
+      if (line == PPU_VBLANK_SCANLINE + 1) {
+        writeVram(0x2000 + random() * 4, 8);
+        dma();
+        write(0x2000, random() & 0x3B);
+        write(0x2005, random());
+        write(0x2005, random());
+        write(0x2001, 0x1E);
+      }
+      //帧中间的滚动分割、关闭渲染后写入 VRAM 和修改 OAM
+      if (line == 60) {
+        write(0x2006, random() & 0x0F);
+        write(0x2005, random());
+        write(0x2005, random());
+        write(0x2006, random());
+      }
+      if (line == 150) {
+        write(0x2001, 0x00);
+        writeVram(0x2000 + random() * 4, 4);
+        //读取同样会移动 VRAM 地址
+        BOOST_TEST(parallel.ReadRegister(0x2007) == serial.ReadRegister(0x2007));
+        write(0x2007, random());
+        write(0x2003, 0x80);
+        write(0x2004, random());
+        write(0x2001, 0x1E);
+      }
+      //帧中间切换 CHR bank，之前的扫描线使用原来的 pattern
+      if (line == 100 && frame % 2 == 1) {
+        std::vector<uint8_t> chr(0x2000);
+        std::generate(chr.begin(), chr.end(), random);
+        parallel.LoadChr(chr);
+        serial.LoadChr(chr);
+      }
+      parallel.RunScanline(line, *parallelFrame);
+      serial.RunScanline(line, *serialFrame);
+      BOOST_TEST(parallel.ReadRegister(0x2002) == serial.ReadRegister(0x2002));
+    }
+    BOOST_TEST((parallelFrame->pixels == serialFrame->pixels));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(ppu_event_prediction_test) {
+  PPU ppu;
+  // tile 1 的 4 个像素都不透明
+  std::vector<uint8_t> chr(0x2000);
+  std::fill_n(chr.begin() + 16, 16, 0xFF);
+  ppu.LoadChr(chr);
+  //背景 tile 在第 2 行第 3 列和第 31 列，覆盖 y 16-23，x 24-31 和 248-255
+  ppu.WriteRegister(0x2006, 0x20);
+  ppu.WriteRegister(0x2006, 0x43);
+  ppu.WriteRegister(0x2007, 1);
+  ppu.WriteRegister(0x2006, 0x20);
+  ppu.WriteRegister(0x2006, 0x5F);
+  ppu.WriteRegister(0x2007, 1);
+
+  std::array<uint8_t, 256> oam;
+  oam.fill(0xFF);
+  // sprite 0 覆盖 x 28-35，第 21-28 条线，第 100 条线上有 9 个精灵
+  oam[0] = 20;
+  oam[1] = 1;
+  oam[2] = 0;
+  oam[3] = 28;
+  for (uint32_t i = 1; i <= 9; i++) {
+    oam[i * 4] = 99;
+  }
+  ppu.WriteOamDma(oam);
+
+  ppu.WriteRegister(0x2006, 0);
+  ppu.WriteRegister(0x2006, 0);
+  ppu.WriteRegister(0x2001, 0x1E);
+  auto frame = std::make_unique<Frame>();
+  ppu.RunScanline(PPU_PRERENDER_SCANLINE, *frame);
+
+  //像素 28 在第 29 个 dot 输出
+  auto hitDot = 21 * PPU_DOTS_PER_SCANLINE + 29;
+  BOOST_TEST(ppu.NextEventDot() == hitDot);
+  for (uint32_t line = 0; line < 21; line++) {
+    ppu.RunScanline(line, *frame);
+  }
+  ppu.RunEvents(hitDot - 1);
+  BOOST_TEST((ppu.ReadRegister(0x2002) & 0x40) == 0);
+  ppu.RunEvents(hitDot);
+  BOOST_TEST((ppu.ReadRegister(0x2002) & 0x40) != 0);
+
+  //第 9 个精灵在评估第 99 条线时找到
+  auto overflowDot = 99 * PPU_DOTS_PER_SCANLINE + 65 + 8 * 8 + 2 + 2;
+  BOOST_TEST(ppu.NextEventDot() == overflowDot);
+  for (uint32_t line = 21; line < 99; line++) {
+    ppu.RunScanline(line, *frame);
+  }
+  BOOST_TEST((ppu.ReadRegister(0x2002) & 0x20) == 0);
+  ppu.RunEvents(overflowDot);
+  BOOST_TEST((ppu.ReadRegister(0x2002) & 0x20) != 0);
+  BOOST_TEST(ppu.NextEventDot() == PPU_NO_EVENT);
+
+  //写入 OAM 后重新预测，x 为 255 时不会 hit
+  ppu.RunScanline(PPU_PRERENDER_SCANLINE, *frame);
+  oam[3] = 250;
+  ppu.WriteOamDma(oam);
+  BOOST_TEST(ppu.NextEventDot() == 21 * PPU_DOTS_PER_SCANLINE + 251);
+  oam[3] = 255;
+  ppu.WriteOamDma(oam);
+  BOOST_TEST(ppu.NextEventDot() == overflowDot);
+}
+
+BOOST_AUTO_TEST_CASE(audio_ring_test) {
+  AudioRing ring(1000);
+  BOOST_TEST(ring.Capacity() == 1024);
+
+  std::vector<int16_t> input(1500);
+  for (size_t i = 0; i < input.size(); i++) {
+    input[i] = static_cast<int16_t>(i);
+  }
+  //写满时只写入能放下的部分
+  BOOST_TEST(ring.Write(input.data(), 1000) == 1000);
+  BOOST_TEST(ring.Write(input.data() + 1000, 500) == 24);
+  BOOST_TEST(ring.Size() == 1024);
+
+  std::vector<int16_t> output(1500);
+  BOOST_TEST(ring.Read(output.data(), 600) == 600);
+  //跨过缓冲的末尾
+  BOOST_TEST(ring.Write(input.data() + 1024, 476) == 476);
+  BOOST_TEST(ring.Read(output.data() + 600, 2000) == 900);
+  BOOST_TEST(ring.Size() == 0);
+  BOOST_TEST(output == input);
+}
+
+BOOST_AUTO_TEST_CASE(apu_test) {
+  APU apu;
+  //pulse 1，占空比 50%，固定音量 15，长度计数停止，周期 253 约 440Hz
+  apu.WriteRegister(0x4015, 0x01, 0);
+  apu.WriteRegister(0x4000, 0xBF, 0);
+  apu.WriteRegister(0x4001, 0x00, 0);
+  apu.WriteRegister(0x4002, 253, 0);
+  apu.WriteRegister(0x4003, 0x00, 0);
+  //pulse 2 没有打开，不装载长度计数
+  apu.WriteRegister(0x4007, 0x08, 0);
+  BOOST_TEST(apu.ReadStatus(0) == 0x01);
+
+  constexpr uint32_t frames = 60;
+  constexpr uint32_t cycles = 29781;
+  std::vector<int16_t> samples;
+  std::vector<int16_t> buffer(2048);
+  for (uint32_t i = 0; i < frames; i++) {
+    apu.EndFrame(cycles);
+    auto available = apu.SamplesAvailable();
+    //每帧 29781 * 48000 / 1789773 约 798.7 个采样
+    BOOST_TEST((available == 798 || available == 799));
+    auto count = apu.ReadSamples(buffer.data(), buffer.size());
+    samples.insert(samples.end(), buffer.begin(), buffer.begin() + count);
+  }
+
+  //去掉高通稳定之前的部分，按过零的次数估计频率
+  auto begin = AUDIO_SAMPLE_RATE / 10;
+  uint32_t crossings = 0;
+  int16_t peak = 0;
+  for (size_t i = begin + 1; i < samples.size(); i++) {
+    if (samples[i - 1] < 0 && samples[i] >= 0) {
+      crossings++;
+    }
+    peak = std::max(peak, samples[i]);
+  }
+  auto seconds = static_cast<double>(samples.size() - begin) / AUDIO_SAMPLE_RATE;
+  auto frequency = crossings / seconds;
+  BOOST_TEST(frequency > 435);
+  BOOST_TEST(frequency < 445);
+  BOOST_TEST(peak > 1000);
+
+  //4 步模式每个序列末尾产生 frame IRQ，读取 $4015 时清除
+  BOOST_TEST(apu.Irq());
+  BOOST_TEST((apu.ReadStatus(0) & 0x40) != 0);
+  BOOST_TEST(!apu.Irq());
+
+  //长度为 2 的 pulse 2 经过两个 half frame 后停止，写入 $4017 重新开始序列
+  apu.WriteRegister(0x4017, 0x40, 0);
+  apu.WriteRegister(0x4015, 0x03, 0);
+  apu.WriteRegister(0x4004, 0x1F, 0);
+  apu.WriteRegister(0x4006, 253, 0);
+  apu.WriteRegister(0x4007, 0x18, 0);
+  BOOST_TEST(apu.ReadStatus(0) == 0x03);
+  BOOST_TEST(apu.ReadStatus(29828) == 0x03);
+  BOOST_TEST(apu.ReadStatus(29829) == 0x01);
+  BOOST_TEST(!apu.Irq());
+}
+
+BOOST_AUTO_TEST_CASE(apu_mixer_table_test) {
+  static_assert(APU_PULSE_TABLE[0] == 0 && APU_TND_TABLE[0] == 0);
+  //tnd 的线性近似和浮点公式的差别不超过满幅的 2%
+  int32_t maxError = 0;
+  for (uint8_t pulse = 0; pulse <= 15; pulse++) {
+    for (uint8_t triangle = 0; triangle <= 15; triangle++) {
+      for (uint8_t noise = 0; noise <= 15; noise++) {
+        for (uint8_t dmc = 0; dmc <= 127; dmc += 7) {
+          auto table = MixApuOutputs(pulse, 15 - pulse, triangle, noise, dmc);
+          auto formula =
+              MixApuOutputsFormula(pulse, 15 - pulse, triangle, noise, dmc);
+          maxError = std::max(maxError, std::abs(table - formula));
+        }
+      }
+    }
+  }
+  BOOST_TEST(maxError < APU_MIX_SCALE / 50);
+}
+
+BOOST_AUTO_TEST_CASE(apu_sample_rate_scale_test) {
+  //动态采样率控制调整输出采样率，每帧的采样数随之变化
+  constexpr uint32_t frames = 100;
+  constexpr uint32_t cycles = 29781;
+  std::vector<int16_t> buffer(2048);
+  for (auto scale : {0.995, 1.0, 1.005}) {
+    APU apu;
+    apu.SetSampleRateScale(scale);
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < frames; i++) {
+      apu.EndFrame(cycles);
+      total += apu.ReadSamples(buffer.data(), buffer.size());
+    }
+    auto expected = static_cast<double>(frames) * cycles * AUDIO_SAMPLE_RATE *
+                    scale / NES_CPU_CLOCK_RATE;
+    BOOST_TEST(std::abs(total - expected) < 1.0);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(system_display_visibility_test) {
+  //窗口不可见时模拟照常运行但不请求绘制，暂停时不再产生新的帧
+  System system;
+  std::atomic<uint32_t> callbacks = 0;
+  system.SetFrameCallback([&] { callbacks++; });
+  auto latestFrame = [&] {
+    system.Frames().Update();
+    return system.Frames().ReadBuffer().number;
+  };
+  auto wait = [] { std::this_thread::sleep_for(milliseconds(100)); };
+
+  system.Start();
+  wait();
+  BOOST_TEST(callbacks > 0U);
+
+  system.SetDisplayVisible(false);
+  wait();
+  auto hiddenCallbacks = callbacks.load();
+  auto hiddenFrame = latestFrame();
+  wait();
+  BOOST_TEST(callbacks == hiddenCallbacks);
+  BOOST_TEST(latestFrame() > hiddenFrame);
+
+  system.SetPaused(true);
+  wait();
+  auto pausedFrame = latestFrame();
+  wait();
+  BOOST_TEST(latestFrame() == pausedFrame);
+
+  system.SetDisplayVisible(true);
+  system.SetPaused(false);
+  wait();
+  BOOST_TEST(callbacks > hiddenCallbacks);
+  BOOST_TEST(latestFrame() > pausedFrame);
+  system.Stop();
+}
+
+BOOST_AUTO_TEST_CASE(resampler_test) {
+  constexpr double inputRate = NES_CPU_CLOCK_RATE / 2;
+  //一帧约 14890 个输入，正弦波的振幅为 1
+  auto makeTone = [&](double frequency, uint32_t count) {
+    std::vector<float> tone(count);
+    for (uint32_t i = 0; i < count; i++) {
+      tone[i] = static_cast<float>(
+          std::sin(2 * std::numbers::pi * frequency * i / inputRate));
+    }
+    return tone;
+  };
+  //跳过滤波器的延迟之后的峰值
+  auto resample = [&](Resampler &resampler, const std::vector<float> &input) {
+    std::vector<float> output;
+    constexpr uint32_t frameInputs = 14890;
+    for (uint32_t i = 0; i < input.size(); i += frameInputs) {
+      auto count = std::min<uint32_t>(frameInputs, input.size() - i);
+      std::vector<float> frame(resampler.MaxOutput(count));
+      frame.resize(resampler.Process(input.data() + i, count, frame.data()));
+      output.insert(output.end(), frame.begin(), frame.end());
+    }
+    return output;
+  };
+  auto peak = [](const std::vector<float> &samples) {
+    float result = 0;
+    for (size_t i = samples.size() / 4; i < samples.size(); i++) {
+      result = std::max(result, std::abs(samples[i]));
+    }
+    return result;
+  };
+
+  auto passband = makeTone(1000, 14890 * 20);
+  auto stopband = makeTone(30000, 14890 * 20);
+  for (auto quality : {ResamplerQuality::Low, ResamplerQuality::Medium,
+                       ResamplerQuality::High}) {
+    Resampler resampler(inputRate, AUDIO_SAMPLE_RATE, quality);
+    auto output = resample(resampler, passband);
+    //20 帧的输出数量和采样率的比例一致，相差不超过滤波器长度对应的输出
+    auto expected = passband.size() * AUDIO_SAMPLE_RATE / inputRate;
+    BOOST_TEST(output.size() <= expected);
+    BOOST_TEST(output.size() + resampler.Taps() / 18 + 1 >= expected);
+    BOOST_TEST(std::abs(peak(output) - 1) < 0.01);
+
+    //高于输出 Nyquist 的频率被滤掉，不混叠到可以听到的范围
+    resampler.Clear();
+    BOOST_TEST(peak(resample(resampler, stopband)) < 0.01);
+
+    //SIMD 和标量实现的结果只有舍入的差别
+    Resampler scalar(inputRate, AUDIO_SAMPLE_RATE, quality, false);
+    BOOST_TEST(!scalar.Simd());
+    auto scalarOutput = resample(scalar, passband);
+    BOOST_TEST(scalarOutput.size() == output.size());
+    float maxDifference = 0;
+    for (size_t i = 0; i < output.size(); i++) {
+      maxDifference =
+          std::max(maxDifference, std::abs(output[i] - scalarOutput[i]));
+    }
+    BOOST_TEST(maxDifference < 1e-4);
+  }
+
+  //APU 使用 Resampler 时每帧的采样数和 BlipBuffer 相同
+  APU apu;
+  apu.SetResampler(ResamplerQuality::Medium);
+  apu.WriteRegister(0x4015, 0x01, 0);
+  apu.WriteRegister(0x4000, 0xBF, 0);
+  apu.WriteRegister(0x4002, 253, 0);
+  apu.WriteRegister(0x4003, 0x00, 0);
+  std::vector<int16_t> buffer(2048);
+  uint32_t total = 0;
+  int16_t loudest = 0;
+  for (uint32_t i = 0; i < 20; i++) {
+    apu.EndFrame(29781);
+    auto count = apu.ReadSamples(buffer.data(), buffer.size());
+    total += count;
+    for (uint32_t j = 0; j < count; j++) {
+      loudest = std::max(loudest, buffer[j]);
+    }
+  }
+  BOOST_TEST(total + 20 >= 20 * 29781 * AUDIO_SAMPLE_RATE / NES_CPU_CLOCK_RATE);
+  BOOST_TEST(loudest > 1000);
+}